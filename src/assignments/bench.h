@@ -0,0 +1,102 @@
+/**
+ * What walltest, turnbench and renderbench all need: the same argument parsing,
+ * and a run of generated floors from consecutive seeds.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "../macros.h"
+#include "../dungeon.h"
+#include "../random.h"
+
+/**
+ * Reads a count option like -n/--floors, if that's what argv[i] is.
+ *
+ * Params:
+ * - argc/argv: The command line
+ * - i: Index of the argument to look at. Moved onto the count if it matched.
+ * - short_name/long_name: The option's names, like "-n" and "--floors"
+ * - what: What it counts, like "floors"
+ * - min: The smallest count allowed
+ * - value: Set to the count
+ * Returns: True if argv[i] was this option
+ */
+inline bool count_arg(int argc, char *argv[], int &i, const char *short_name, const char *long_name,
+    const char *what, int min, unsigned int &value) {
+    if (strcmp(argv[i], short_name) != 0 && strcmp(argv[i], long_name) != 0) return false;
+    if (i + 1 >= argc || atoi(argv[i + 1]) < min)
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(short_name) + "/" + long_name + " needs a number of " + what);
+    value = atoi(argv[++i]);
+    return true;
+}
+
+/**
+ * Reads --seed, if that's what argv[i] is.
+ *
+ * Params:
+ * - argc/argv: The command line
+ * - i: Index of the argument to look at. Moved onto the seed if it matched.
+ * - seed: Set to the seed
+ * Returns: True if argv[i] was --seed
+ */
+inline bool seed_arg(int argc, char *argv[], int &i, uint64_t &seed) {
+    if (strcmp(argv[i], "--seed") != 0) return false;
+    if (i + 1 >= argc)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "--seed needs a number");
+    seed = strtoull(argv[++i], NULL, 10);
+    return true;
+}
+
+/**
+ * Options for a floor that's just rooms and halls, with no map file behind it.
+ *
+ * Params:
+ * - size: Width and height of the floor
+ * - rooms: Smallest and largest number of rooms
+ * Returns: The options
+ */
+inline DungeonOptions bench_options(IntPair size, IntPair rooms) {
+    DungeonOptions options;
+    options.size = size;
+    options.rooms = rooms;
+    options.up_staircase = "up";
+    options.down_staircase = "down";
+    return options;
+}
+
+/**
+ * Generates floors from seed, seed + 1, and so on, and hands each one to visit while
+ * its seed's stream is still the active one.
+ *
+ * Params:
+ * - options: What to generate. The floors point back at it, so it has to outlive them.
+ * - floors: How many seeds to try
+ * - seed: The first seed
+ * - visit: Called as visit(Dungeon &dungeon, unsigned int floor) with the floor's
+ *   index, and returns whether the floor was any use
+ * Returns: How many floors visit used
+ */
+template <typename VISIT>
+unsigned int for_each_seeded_floor(DungeonOptions &options, unsigned int floors, uint64_t seed, VISIT visit) {
+    unsigned int floor, used = 0;
+    for (floor = 0; floor < floors; floor++) {
+        Rng rng(seed + floor);
+        RngScope scope(rng);
+        Dungeon dungeon(options);
+        try {
+            dungeon.fill();
+        } catch (dungeon_exception &e) {
+            // Some seeds just don't fit enough rooms; they're no use for this.
+            continue;
+        }
+        if (visit(dungeon, floor)) used++;
+    }
+    return used;
+}
+
+#endif
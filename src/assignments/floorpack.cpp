@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../macros.h"
+#include "../game.h"
+#include "../logger.h"
+
+typedef struct {
+    const char *path;
+    unsigned int floors;
+    int threads;
+    uint64_t seed;
+    bool debug;
+} pack_args_t;
+
+int prepare_args(int argc, char* argv[], pack_args_t &args);
+
+int main(int argc, char* argv[]) {
+    pack_args_t args = {.path = "floors.pack", .floors = 1000, .threads = 0, .seed = 0, .debug = false};
+    std::chrono::steady_clock::time_point start;
+    double seconds;
+    uint64_t size;
+    if (prepare_args(argc, argv, args)) {
+        return 1;
+    }
+    if (!args.debug) {
+        Logger::get()->off(LOG_LEVEL_DEBUG);
+    }
+
+    Game game(false);
+    game.generation_threads = args.threads;
+    game.init_monster_defs("assets/enemies.txt");
+    game.init_item_defs("assets/items.txt");
+    game.init_maps("assets/maps");
+
+    start = std::chrono::steady_clock::now();
+    size = game.build_floor_pack(args.path, args.floors, args.seed);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("wrote %u floors to %s in %.1fs: %.1f MiB, %u retries (%.2f%% of attempts)\n",
+        game.floors_generated, args.path, seconds, size / 1048576.0, game.generation_retries,
+        100.0 * game.generation_retries / MAX(game.floors_generated + game.generation_retries, 1u));
+    return 0;
+}
+
+int prepare_args(int argc, char* argv[], pack_args_t &args) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) args.debug = true;
+        else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) {
+            if (i + 1 >= argc)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-o/--output needs a path");
+            args.path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--floors") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-n/--floors needs a number of floors");
+            args.floors = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-j/--threads needs a number of threads");
+            args.threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            if (i + 1 >= argc)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "--seed needs a number");
+            args.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printf("usage: %s [-o <path>] [-n <floors>]\n", argv[0]);
+            printf("pre-generates floors for every map in assets/maps, for killbill3 -p/--pack\n");
+            printf("  -d/--debug: log every floor\n  -h/--help: display this message\n");
+            printf("  -o/--output <path>: file to write the pack to (default: floors.pack)\n");
+            printf("  -n/--floors <floors>: floors to generate for each distinct floor layout (default: 1000)\n");
+            printf("  -j/--threads <threads>: generate floors on this many threads (default: one per core)\n");
+            printf("  --seed <seed>: seed for the first floor (default: 0)\n");
+            return 1;
+        }
+        else {
+            throw dungeon_exception(__PRETTY_FUNCTION__, "unrecognized argument. run -h/--help for usage");
+        }
+    }
+    return 0;
+}
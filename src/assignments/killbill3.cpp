@@ -13,18 +13,32 @@ typedef struct {
     bool debug;
     bool skip;
     bool quiet;
+    int retry_report;
+    int threads;
+    bool lazy;
+    uint64_t seed;
+    int autosave;
+    const char *save_path;
+    bool resume;
+    const char *pack_path;
+    bool crowd;
 } game_args_t;
 
 int prepare_args(int argc, char* argv[], game_args_t &args);
+int retry_report(int seeds, int threads);
 
 int main(int argc, char* argv[]) {
-    srand(time(NULL));
-
-    game_args_t args = {.debug = false, .skip = false, .quiet = false};
+    game_args_t args = {.debug = false, .skip = false, .quiet = false, .retry_report = 0, .threads = 0, .lazy = false, .seed = (uint64_t) time(NULL),
+        .autosave = 0, .save_path = nullptr, .resume = false, .pack_path = nullptr, .crowd = false};
     if (prepare_args(argc, argv, args)) {
         return 1;
     }
 
+    if (args.retry_report) {
+        Logger::get()->off(LOG_LEVEL_DEBUG);
+        return retry_report(args.retry_report, args.threads);
+    }
+
     if (args.quiet) {
         ResourceManager::get()->quiet = true;
     }
@@ -33,12 +47,23 @@ int main(int argc, char* argv[]) {
         Logger::get()->off(LOG_LEVEL_DEBUG);
     }
 
+    // The PC is rolled up before any map is picked, so the main thread's stream needs the seed too.
+    rng_seed(args.seed);
     Game game(args.debug);
+    game.generation_threads = args.threads;
+    game.lazy_floors = args.lazy;
+    game.rng = Rng(args.seed);
+    game.autosave_turns = args.autosave;
+    game.resume = args.resume;
+    game.crowd_movement = args.crowd;
+    if (args.save_path) game.save_path = args.save_path;
+    Logger::info(__FILE__, "seed: " + std::to_string(args.seed));
 
     game.init_monster_defs("assets/enemies.txt");
     game.init_item_defs("assets/items.txt");
     game.init_maps("assets/maps");
     game.init_voice_lines("assets/lines");
+    if (args.pack_path) game.use_floor_pack(args.pack_path);
 
     game.create_nc();
     ResourceManager::get()->load_visuals("assets/textures");
@@ -54,9 +79,51 @@ int prepare_args(int argc, char* argv[], game_args_t &args) {
         if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) args.debug = true;
         else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--skip") == 0) args.skip = true;
         else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--quiet") == 0) args.quiet = true;
+        else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--lazy") == 0) args.lazy = true;
+        else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--retry-report") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-r/--retry-report needs a number of seeds");
+            args.retry_report = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-j/--threads needs a number of threads");
+            args.threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--continue") == 0) args.resume = true;
+        else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--autosave") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-a/--autosave needs a number of turns");
+            args.autosave = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--save") == 0) {
+            if (i + 1 >= argc)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "--save needs a path");
+            args.save_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--pack") == 0) {
+            if (i + 1 >= argc)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-p/--pack needs a path");
+            args.pack_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--crowd") == 0) args.crowd = true;
+        else if (strcmp(argv[i], "--seed") == 0) {
+            if (i + 1 >= argc)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "--seed needs a number");
+            args.seed = strtoull(argv[++i], NULL, 10);
+        }
         else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             printf("usage: %s [-d]\n", argv[0]);
             printf("  -d/--debug: enable debugging features\n  -h/--help: display this message\n  -s/--skip: skip the intro\n  -q/--quiet: don't play sound\n");
+            printf("  -l/--lazy: only generate the first floor up front, and the rest as you get close to them\n");
+            printf("  -a/--autosave <turns>: save the game every <turns> turns\n");
+            printf("  -c/--continue: pick up from the last save instead of starting a new game\n");
+            printf("  -p/--pack <path>: pick floors out of a pack built by floorpack instead of generating them\n");
+            printf("  --crowd: have smart monsters spread out over side routes instead of piling up behind each other\n");
+            printf("  --save <path>: file to save to and continue from (default: killbill3.sav)\n");
+            printf("  --seed <seed>: seed for the game's random numbers, to replay a run (default: the current time)\n");
+            printf("  -j/--threads <threads>: generate floors and monster moves on this many threads (default: one per core)\n");
+            printf("  -r/--retry-report <seeds>: generate every map with seeds 0 to <seeds> - 1, print how often floors were retried, and exit\n");
             return 1;
         }
         else {
@@ -65,3 +132,29 @@ int prepare_args(int argc, char* argv[], game_args_t &args) {
     }
     return 0;
 }
+
+int retry_report(int seeds, int threads) {
+    int seed;
+    unsigned int floors = 0, retries = 0, failures = 0;
+    for (seed = 0; seed < seeds; seed++) {
+        rng_seed(seed);
+        Game game(false);
+        game.rng = Rng(seed);
+        game.generation_threads = threads;
+        game.init_monster_defs("assets/enemies.txt");
+        game.init_item_defs("assets/items.txt");
+        game.init_maps("assets/maps");
+        for (const std::string &name : game.map_names()) {
+            try {
+                game.init_from_map(name);
+            } catch (dungeon_exception &e) {
+                failures++;
+            }
+        }
+        floors += game.floors_generated;
+        retries += game.generation_retries;
+    }
+    printf("%u floors over %d seeds: %u retries (%.2f%% of attempts), %u maps failed outright\n",
+        floors, seeds, retries, 100.0 * retries / MAX(floors + retries, 1u), failures);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../macros.h"
+#include "../noise.h"
+
+typedef struct {
+    unsigned int seeds;
+    unsigned int rounds;
+    uint64_t seed;
+} noisebench_args_t;
+
+// Same sizes the maps use, plus the largest floor there can be.
+const int BENCH_SIZES[][2] = { {80, 21}, {110, 90}, {220, 160}, {255, 255} };
+
+int prepare_args(int argc, char* argv[], noisebench_args_t &args);
+
+/**
+ * Blurs a copy of a grid rounds times with one of the blur paths.
+ *
+ * Params:
+ * - input: Grid to start from
+ * - output: Set to the last blurred copy
+ * - width/height: Size of the grid
+ * - rounds: How many times to blur it
+ * - simd: Whether to use the SIMD path
+ * Returns: Microseconds per blur
+ */
+double time_blur(const std::vector<uint8_t> &input, std::vector<uint8_t> &output, int width, int height, unsigned int rounds, bool simd) {
+    std::vector<uint8_t> scratch(input.size());
+    std::chrono::steady_clock::time_point start;
+    double total = 0;
+    unsigned int i;
+    for (i = 0; i < rounds; i++) {
+        output = input;
+        start = std::chrono::steady_clock::now();
+        blur_hardness(output.data(), scratch.data(), width, height, simd);
+        total += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+    return total / rounds;
+}
+
+/**
+ * Generates a whole diffuse hardness map with one of the blur paths.
+ *
+ * Params:
+ * - output: Set to the map
+ * - width/height: Size of the map
+ * - seed: Seed to generate it from
+ * - simd: Whether to use the SIMD path
+ * Returns: Microseconds it took
+ */
+double time_fill(std::vector<uint8_t> &output, int width, int height, uint64_t seed, bool simd) {
+    DiffuseNoise noise(simd);
+    Rng rng(seed);
+    RngScope scope(rng);
+    std::chrono::steady_clock::time_point start;
+    double total;
+    output.assign(width * height, 0);
+    start = std::chrono::steady_clock::now();
+    noise.fill(output.data(), width, height);
+    total = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    noisebench_args_t args = {.seeds = 10, .rounds = 50, .seed = 0};
+    std::vector<uint8_t> input, scalar_out, simd_out;
+    double scalar_us, simd_us, scalar_fill_us, simd_fill_us;
+    unsigned int seed, size, mismatched = 0;
+    int width, height;
+    size_t i;
+    if (prepare_args(argc, argv, args)) {
+        return 1;
+    }
+
+    printf("blur SIMD: %s\n", blur_simd_name());
+    for (size = 0; size < ARRAY_SIZE(BENCH_SIZES); size++) {
+        width = BENCH_SIZES[size][0];
+        height = BENCH_SIZES[size][1];
+        scalar_us = simd_us = scalar_fill_us = simd_fill_us = 0;
+        for (seed = 0; seed < args.seeds; seed++) {
+            // Every byte value, not just what the diffusion happens to produce.
+            Rng rng(args.seed + seed);
+            RngScope scope(rng);
+            input.resize(width * height);
+            for (i = 0; i < input.size(); i++) input[i] = rng_rand() & 0xff;
+
+            scalar_us += time_blur(input, scalar_out, width, height, args.rounds, false);
+            simd_us += time_blur(input, simd_out, width, height, args.rounds, true);
+            if (scalar_out != simd_out) mismatched++;
+
+            scalar_fill_us += time_fill(scalar_out, width, height, args.seed + seed, false);
+            simd_fill_us += time_fill(simd_out, width, height, args.seed + seed, true);
+            if (scalar_out != simd_out) mismatched++;
+        }
+        printf("%3dx%-3d blur: scalar %7.1fus, SIMD %7.1fus (%.1fx); whole map: scalar %7.1fus, SIMD %7.1fus\n",
+            width, height, scalar_us / args.seeds, simd_us / args.seeds, scalar_us / MAX(simd_us, 0.001),
+            scalar_fill_us / args.seeds, simd_fill_us / args.seeds);
+    }
+
+    printf("%u of %u outputs differed between the scalar and SIMD paths\n", mismatched, 2 * args.seeds * ARRAY_SIZE(BENCH_SIZES));
+    return mismatched == 0 ? 0 : 1;
+}
+
+int prepare_args(int argc, char* argv[], noisebench_args_t &args) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--seeds") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-n/--seeds needs a number of seeds");
+            args.seeds = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--rounds") == 0) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "-r/--rounds needs a number of rounds");
+            args.rounds = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            if (i + 1 >= argc)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "--seed needs a number");
+            args.seed = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printf("usage: %s [-n <seeds>] [-r <rounds>]\n", argv[0]);
+            printf("times the SIMD stone hardness blur against the scalar one and checks they match\n");
+            printf("  -h/--help: display this message\n");
+            printf("  -n/--seeds <seeds>: grids to try at each size (default: 10)\n");
+            printf("  -r/--rounds <rounds>: times to blur each grid (default: 50)\n");
+            printf("  --seed <seed>: seed for the first grid (default: 0)\n");
+            return 1;
+        }
+        else {
+            throw dungeon_exception(__PRETTY_FUNCTION__, "unrecognized argument. run -h/--help for usage");
+        }
+    }
+    return 0;
+}
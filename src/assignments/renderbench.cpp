@@ -0,0 +1,282 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../macros.h"
+#include "../dungeon.h"
+#include "../character.h"
+#include "../logger.h"
+#include "bench.h"
+
+typedef struct {
+    unsigned int floors;
+    unsigned int monsters;
+    unsigned int frames;
+    uint64_t seed;
+} renderbench_args_t;
+
+// Same size as a full screen of cells.
+#define VIEW_WIDTH 80
+#define VIEW_HEIGHT 40
+
+// Stand-ins for the texture tables in game_loop.cpp. Only which one gets picked matters.
+const std::string BENCH_CELL_TEXTURES[] = {
+    "floor_stone", "floor_room", "", "floor_hall", "floor_up_staircase",
+    "floor_down_staircase", "floor_stone", "floor_stone", "floor_stone"
+};
+const std::string BENCH_WALL_TEXTURES[] = {
+    "floor_wall_t", "floor_wall_l", "floor_wall_r", "floor_wall_b", "floor_wall_tl", "floor_wall_tr",
+    "floor_wall_bl", "floor_wall_br", "floor_wall_endl", "floor_wall_endr", "floor_wall_endt",
+    "floor_wall_endb", "floor_wall_t_l_l", "floor_wall_t_l_r", "floor_wall_t_b_t", "floor_wall_t_b_b",
+    "floor_wall_single", "floor_wall_quad"
+};
+
+int prepare_args(int argc, char* argv[], renderbench_args_t &args);
+
+/**
+ * Stands in for the virtual type() characters used to have. One of these goes
+ * alongside each character, so telling them apart takes a call through a vtable.
+ */
+class VirtualKind {
+    public:
+        virtual ~VirtualKind() {}
+        virtual CHARACTER_TYPE get() const = 0;
+};
+
+class VirtualPC : public VirtualKind {
+    public:
+        CHARACTER_TYPE get() const override { return CHARACTER_TYPE_PC; }
+};
+
+class VirtualMonster : public VirtualKind {
+    public:
+        CHARACTER_TYPE get() const override { return CHARACTER_TYPE_MONSTER; }
+};
+
+/**
+ * Tells the PC from a monster, with either the kind tag or the virtual call.
+ *
+ * Params:
+ * - character_map: Who's where on the floor
+ * - kind_map: The VirtualKind for each of them
+ * - x/y: Where the character is
+ * Returns: CHARACTER_TYPE_PC or CHARACTER_TYPE_MONSTER
+ */
+template <bool VIRTUAL>
+CHARACTER_TYPE kind_of(Character ***character_map, VirtualKind ***kind_map, int x, int y) {
+    if constexpr (VIRTUAL) return kind_map[x][y]->get();
+    else return character_map[x][y]->type();
+}
+
+/**
+ * Picks a texture for every cell in a view, the same way render_frame does, minus
+ * items and drawing.
+ *
+ * Params:
+ * - dungeon: The floor
+ * - character_map: Who's where on it
+ * - kind_map: The VirtualKind for each of them
+ * - pc: The PC
+ * - x0/y0: Top left corner of the view
+ * Returns: Total length of the textures picked, so both ways can be checked against each other
+ */
+template <bool VIRTUAL>
+size_t compose(Dungeon &dungeon, Character ***character_map, VirtualKind ***kind_map, PC &pc, int x0, int y0) {
+    std::string texture;
+    Monster *monst;
+    size_t total = 0;
+    int x, y;
+    for (x = x0; x < x0 + VIEW_WIDTH; x++) {
+        for (y = y0; y < y0 + VIEW_HEIGHT; y++) {
+            texture = "";
+            if (x < 0 || x >= dungeon.width || y < 0 || y >= dungeon.height) {
+                texture = BENCH_CELL_TEXTURES[CELL_TYPE_STONE];
+            }
+            else if (character_map[x][y]) {
+                if (kind_of<VIRTUAL>(character_map, kind_map, x, y) == CHARACTER_TYPE_PC) {
+                    texture = std::string(PCEXTURE) + "_" + "nesw"[pc.direction];
+                }
+                else if (kind_of<VIRTUAL>(character_map, kind_map, x, y) == CHARACTER_TYPE_MONSTER) {
+                    monst = (Monster *) character_map[x][y];
+                    switch (monst->direction) {
+                        case DIRECTION_NORTH: texture = monst->definition->floor_texture_n; break;
+                        case DIRECTION_EAST: texture = monst->definition->floor_texture_e; break;
+                        case DIRECTION_SOUTH: texture = monst->definition->floor_texture_s; break;
+                        case DIRECTION_WEST: texture = monst->definition->floor_texture_w; break;
+                    }
+                }
+            }
+            else if (dungeon.cells[x][y].wall_type != WALL_TYPE_NONE) {
+                texture = BENCH_WALL_TEXTURES[dungeon.cells[x][y].wall_type];
+            }
+            else if (dungeon.cells[x][y].type == CELL_TYPE_DECORATION) {
+                texture = *dungeon.cells[x][y].decoration_texture;
+            }
+            else {
+                texture = BENCH_CELL_TEXTURES[dungeon.cells[x][y].type];
+            }
+            total += texture.length();
+        }
+    }
+    return total;
+}
+
+/**
+ * Asks every character on the floor what it is, with nothing else going on, which
+ * is as much of a difference as the kind tag can make.
+ *
+ * Params:
+ * - dungeon: The floor
+ * - character_map: Who's where on it
+ * - kind_map: The VirtualKind for each of them
+ * Returns: A count of what was found, so both ways can be checked against each other
+ */
+template <bool VIRTUAL>
+size_t sweep(Dungeon &dungeon, Character ***character_map, VirtualKind ***kind_map) {
+    size_t total = 0;
+    int x, y;
+    for (x = 0; x < dungeon.width; x++) {
+        for (y = 0; y < dungeon.height; y++) {
+            if (character_map[x][y]) total += kind_of<VIRTUAL>(character_map, kind_map, x, y) == CHARACTER_TYPE_MONSTER ? 1 : 2;
+        }
+    }
+    return total;
+}
+
+/**
+ * Times composing views around the PC and sweeping the floor, with one way of
+ * telling characters apart.
+ *
+ * Params:
+ * - args: How many frames
+ * - dungeon/character_map/kind_map/pc: The floor
+ * - compose_ns: Increased by nanoseconds per view
+ * - sweep_ns: Increased by nanoseconds per sweep
+ * Returns: Checksum of everything that was picked
+ */
+template <bool VIRTUAL>
+size_t time_frames(const renderbench_args_t &args, Dungeon &dungeon, Character ***character_map, VirtualKind ***kind_map, PC &pc, double &compose_ns, double &sweep_ns) {
+    std::chrono::steady_clock::time_point start;
+    size_t checksum = 0;
+    unsigned int frame;
+
+    start = std::chrono::steady_clock::now();
+    for (frame = 0; frame < args.frames; frame++) {
+        // Shuffle the view around a little, like the PC walking back and forth.
+        checksum += compose<VIRTUAL>(dungeon, character_map, kind_map, pc, pc.x - VIEW_WIDTH / 2 + frame % 7, pc.y - VIEW_HEIGHT / 2);
+    }
+    compose_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / args.frames;
+
+    start = std::chrono::steady_clock::now();
+    for (frame = 0; frame < args.frames; frame++) checksum += sweep<VIRTUAL>(dungeon, character_map, kind_map);
+    sweep_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / args.frames;
+    return checksum;
+}
+
+int main(int argc, char* argv[]) {
+    renderbench_args_t args = {.floors = 5, .monsters = 300, .frames = 2000, .seed = 0};
+    MonsterDefinition def;
+    // A big floor, so the view is never mostly stone.
+    DungeonOptions options = bench_options(IntPair(110, 90), IntPair(25, 35));
+    double kind_compose = 0, kind_sweep = 0, virtual_compose = 0, virtual_sweep = 0;
+    unsigned int used, mismatched = 0;
+    if (prepare_args(argc, argv, args)) {
+        return 1;
+    }
+    Logger::get()->off(LOG_LEVEL_DEBUG);
+
+    def.id = "bench";
+    def.color = 1;
+    def.speed = new Dice(10, 0, 1);
+    def.hp = new Dice(10, 0, 1);
+    def.damage = new Dice(1, 0, 1);
+    def.abilities = 0;
+    def.floor_texture_n = "characters_bench_n";
+    def.floor_texture_e = "characters_bench_e";
+    def.floor_texture_s = "characters_bench_s";
+    def.floor_texture_w = "characters_bench_w";
+
+    used = for_each_seeded_floor(options, args.floors, args.seed, [&](Dungeon &dungeon, unsigned int floor) {
+        std::vector<Monster *> monsters;
+        Character ***character_map;
+        VirtualKind ***kind_map;
+        IntPair coords;
+        size_t kind_sum, virtual_sum;
+        unsigned int i;
+        int x, y;
+
+        character_map = (Character ***) malloc(dungeon.width * sizeof (Character **));
+        for (x = 0; x < dungeon.width; x++) character_map[x] = (Character **) calloc(dungeon.height, sizeof (Character *));
+        kind_map = (VirtualKind ***) malloc(dungeon.width * sizeof (VirtualKind **));
+        for (x = 0; x < dungeon.width; x++) kind_map[x] = (VirtualKind **) calloc(dungeon.height, sizeof (VirtualKind *));
+        PC pc;
+        try {
+            coords = random_location_no_kill(&dungeon, character_map);
+            pc.move_to(coords, character_map);
+            kind_map[coords.x][coords.y] = new VirtualPC();
+            for (i = 0; i < args.monsters; i++) {
+                coords = random_location_no_kill(&dungeon, character_map);
+                monsters.push_back(new Monster(&def, nullptr));
+                monsters.back()->move_to(coords, character_map);
+                kind_map[coords.x][coords.y] = new VirtualMonster();
+                monsters.back()->direction = (direction_t) (rng_rand() % 4);
+            }
+        } catch (dungeon_exception &e) {
+            // Not enough room for everyone, so it just has fewer monsters.
+        }
+
+        // Whichever goes first warms the caches up for the other, so they take turns.
+        if (floor % 2) {
+            virtual_sum = time_frames<true>(args, dungeon, character_map, kind_map, pc, virtual_compose, virtual_sweep);
+            kind_sum = time_frames<false>(args, dungeon, character_map, kind_map, pc, kind_compose, kind_sweep);
+        } else {
+            kind_sum = time_frames<false>(args, dungeon, character_map, kind_map, pc, kind_compose, kind_sweep);
+            virtual_sum = time_frames<true>(args, dungeon, character_map, kind_map, pc, virtual_compose, virtual_sweep);
+        }
+        if (kind_sum != virtual_sum) mismatched++;
+
+        for (Monster *monst : monsters) delete monst;
+        for (x = 0; x < dungeon.width; x++) {
+            for (y = 0; y < dungeon.height; y++) delete kind_map[x][y];
+            free(kind_map[x]);
+            free(character_map[x]);
+        }
+        free(kind_map);
+        free(character_map);
+        return true;
+    });
+
+    printf("%u floors, %u monsters, %u frames:\n", used, args.monsters, args.frames);
+    printf("  compose %dx%d view: kind tag %.1fus, virtual call %.1fus (%.2fx)\n", VIEW_WIDTH, VIEW_HEIGHT,
+        kind_compose / MAX(used, 1u) / 1000, virtual_compose / MAX(used, 1u) / 1000, virtual_compose / MAX(kind_compose, 0.001));
+    printf("  sweep %dx%d floor: kind tag %.2fus, virtual call %.2fus (%.2fx)\n", options.size.x, options.size.y,
+        kind_sweep / MAX(used, 1u) / 1000, virtual_sweep / MAX(used, 1u) / 1000, virtual_sweep / MAX(kind_sweep, 0.001));
+    printf("%u of %u floors picked differently between the two\n", mismatched, used);
+    delete def.speed;
+    delete def.hp;
+    delete def.damage;
+    return mismatched == 0 && used > 0 ? 0 : 1;
+}
+
+int prepare_args(int argc, char* argv[], renderbench_args_t &args) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (count_arg(argc, argv, i, "-n", "--floors", "floors", 1, args.floors)) continue;
+        if (count_arg(argc, argv, i, "-m", "--monsters", "monsters", 0, args.monsters)) continue;
+        if (count_arg(argc, argv, i, "-f", "--frames", "frames", 1, args.frames)) continue;
+        if (seed_arg(argc, argv, i, args.seed)) continue;
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printf("usage: %s [-n <floors>] [-m <monsters>] [-f <frames>]\n", argv[0]);
+            printf("times picking textures for a view the way render_frame does, telling characters apart\n");
+            printf("with the kind tag (type()) against a virtual call\n");
+            printf("  -h/--help: display this message\n");
+            printf("  -n/--floors <floors>: floors to generate (default: 5)\n");
+            printf("  -m/--monsters <monsters>: monsters on each floor (default: 300)\n");
+            printf("  -f/--frames <frames>: views to compose on each floor (default: 2000)\n");
+            printf("  --seed <seed>: seed for the first floor (default: 0)\n");
+            return 1;
+        }
+        throw dungeon_exception(__PRETTY_FUNCTION__, "unrecognized argument. run -h/--help for usage");
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../macros.h"
+#include "../dungeon.h"
+#include "../character.h"
+#include "../pathfinding.h"
+#include "../logger.h"
+#include "bench.h"
+
+typedef struct {
+    unsigned int floors;
+    unsigned int monsters;
+    unsigned int rounds;
+    uint64_t seed;
+} turnbench_args_t;
+
+int prepare_args(int argc, char* argv[], turnbench_args_t &args);
+
+/**
+ * Makes a monster definition for one combination of MONSTER_KERNEL_* bits, so every
+ * kernel gets the same share of the monsters.
+ *
+ * Params:
+ * - kind: MONSTER_KERNEL_* bits
+ * Returns: The definition
+ */
+MonsterDefinition *make_definition(unsigned int kind) {
+    MonsterDefinition *def = new MonsterDefinition();
+    def->id = "kernel_" + std::to_string(kind);
+    def->color = 1;
+    def->speed = new Dice(10, 0, 1);
+    def->hp = new Dice(10, 0, 1);
+    def->damage = new Dice(1, 0, 1);
+    def->abilities = 0;
+    if (kind & MONSTER_KERNEL_INTELLIGENT) def->abilities |= MONSTER_ATTRIBUTE_INTELLIGENT;
+    if (kind & MONSTER_KERNEL_TELEPATHIC) def->abilities |= MONSTER_ATTRIBUTE_TELEPATHIC;
+    if (kind & MONSTER_KERNEL_DIGS) def->abilities |= MONSTER_ATTRIBUTE_TUNNELING;
+    if (kind & MONSTER_KERNEL_ERRATIC) def->abilities |= MONSTER_ATTRIBUTE_ERRATIC;
+    return def;
+}
+
+/**
+ * Gets at Monster's decision paths, which the game itself only reaches through decide_turn.
+ */
+class TurnBench {
+    public:
+        /**
+         * Has a monster decide its turn.
+         *
+         * Params:
+         * - monster: The monster
+         * - kernels: Whether to go through its kernel (decide_turn) or decide_generic
+         * - the rest: As for decide_turn
+         * Returns: What it decided
+         */
+        static MonsterIntent decide(Monster *monster, bool kernels, Dungeon *dungeon, PC *pc,
+            uint32_t **tunnel, uint32_t **no_tunnel) {
+            if (kernels) return monster->decide_turn(dungeon, pc, tunnel, no_tunnel, nullptr);
+            return monster->decide_generic(dungeon, pc, tunnel, no_tunnel, nullptr);
+        }
+};
+
+/**
+ * Fills a floor with monsters and has each of them decide its turn, round after round,
+ * with one of the decision paths. Each monster steps where it decided to go, the way
+ * it would in a game, so it keeps following the path it planned instead of planning
+ * a new one every round.
+ *
+ * Params:
+ * - args: How many monsters and rounds
+ * - defs: A definition for each kernel
+ * - dungeon: The floor
+ * - pc: The PC, already placed
+ * - tunnel/no_tunnel: Pathfinding maps to the PC
+ * - seed: Seed for where the monsters go and their own streams
+ * - kernels: Whether monsters decide with their kernels, or the generic path
+ * - checksum: Set to a hash of every decision made
+ * Returns: Nanoseconds per decision
+ */
+double time_decisions(const turnbench_args_t &args, MonsterDefinition **defs, Dungeon &dungeon, PC &pc,
+    uint32_t **tunnel, uint32_t **no_tunnel, uint64_t seed, bool kernels, uint64_t &checksum) {
+    std::vector<Monster *> monsters;
+    std::chrono::steady_clock::time_point start;
+    MonsterIntent intent;
+    Monster *monst;
+    std::optional<IntPair> coords;
+    double total;
+    unsigned int i, round;
+
+    Rng rng(seed);
+    RngScope scope(rng);
+    for (i = 0; i < args.monsters; i++) {
+        monst = new Monster(defs[i % MONSTER_KERNEL_COUNT], nullptr);
+        coords = dungeon.random_location();
+        if (coords) {
+            monst->x = coords->x;
+            monst->y = coords->y;
+        }
+        monst->rng = rng.split(i);
+        monsters.push_back(monst);
+    }
+
+    checksum = 14695981039346656037ull;
+    start = std::chrono::steady_clock::now();
+    for (round = 0; round < args.rounds; round++) {
+        for (Monster *monster : monsters) {
+            intent = TurnBench::decide(monster, kernels, &dungeon, &pc, tunnel, no_tunnel);
+            checksum = (checksum ^ (intent.next.x * 256 + intent.next.y) ^ ((uint64_t) intent.can_move << 16)) * 1099511628211ull;
+            // Nothing's in anyone's way here, so a monster goes wherever it decided to.
+            if (intent.can_move) {
+                monster->x = intent.next.x;
+                monster->y = intent.next.y;
+            }
+        }
+    }
+    total = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    for (Monster *monster : monsters) delete monster;
+    return total / (args.rounds * args.monsters);
+}
+
+int main(int argc, char* argv[]) {
+    turnbench_args_t args = {.floors = 20, .monsters = 64, .rounds = 200, .seed = 0};
+    MonsterDefinition *defs[MONSTER_KERNEL_COUNT];
+    DungeonOptions options = bench_options(IntPair(80, 40), IntPair(8, 14));
+    double generic_ns = 0, kernel_ns = 0;
+    unsigned int used, mismatched = 0;
+    int x;
+    if (prepare_args(argc, argv, args)) {
+        return 1;
+    }
+    Logger::get()->off(LOG_LEVEL_DEBUG);
+
+    for (x = 0; x < MONSTER_KERNEL_COUNT; x++) defs[x] = make_definition(x);
+
+    used = for_each_seeded_floor(options, args.floors, args.seed, [&](Dungeon &dungeon, unsigned int floor) {
+        uint32_t **tunnel, **no_tunnel;
+        uint64_t generic_sum, kernel_sum;
+        int x;
+        PC pc;
+        std::optional<IntPair> coords = dungeon.random_location();
+        if (!coords) return false;
+        pc.x = coords->x;
+        pc.y = coords->y;
+        tunnel = (uint32_t **) malloc(dungeon.width * sizeof (uint32_t *));
+        no_tunnel = (uint32_t **) malloc(dungeon.width * sizeof (uint32_t *));
+        for (x = 0; x < dungeon.width; x++) {
+            tunnel[x] = (uint32_t *) malloc(dungeon.height * sizeof (uint32_t));
+            no_tunnel[x] = (uint32_t *) malloc(dungeon.height * sizeof (uint32_t));
+        }
+        update_pathfinding(&dungeon, no_tunnel, tunnel, IntPair(pc.x, pc.y));
+
+        // Both paths start from the same monsters in the same spots, so they have to decide the same things.
+        // Which goes first switches every floor, so neither always gets the warm cache.
+        if (floor % 2) {
+            kernel_ns += time_decisions(args, defs, dungeon, pc, tunnel, no_tunnel, args.seed + floor, true, kernel_sum);
+            generic_ns += time_decisions(args, defs, dungeon, pc, tunnel, no_tunnel, args.seed + floor, false, generic_sum);
+        } else {
+            generic_ns += time_decisions(args, defs, dungeon, pc, tunnel, no_tunnel, args.seed + floor, false, generic_sum);
+            kernel_ns += time_decisions(args, defs, dungeon, pc, tunnel, no_tunnel, args.seed + floor, true, kernel_sum);
+        }
+        if (generic_sum != kernel_sum) mismatched++;
+
+        for (x = 0; x < dungeon.width; x++) {
+            free(tunnel[x]);
+            free(no_tunnel[x]);
+        }
+        free(tunnel);
+        free(no_tunnel);
+        return true;
+    });
+
+    printf("%u floors, %u monsters, %u rounds: generic %.1fns, kernels %.1fns per decision (%.2fx)\n",
+        used, args.monsters, args.rounds, generic_ns / MAX(used, 1u), kernel_ns / MAX(used, 1u), generic_ns / MAX(kernel_ns, 0.001));
+    printf("%u of %u floors decided differently between the generic path and the kernels\n", mismatched, used);
+    for (x = 0; x < MONSTER_KERNEL_COUNT; x++) {
+        delete defs[x]->speed;
+        delete defs[x]->hp;
+        delete defs[x]->damage;
+        delete defs[x];
+    }
+    return mismatched == 0 && used > 0 ? 0 : 1;
+}
+
+int prepare_args(int argc, char* argv[], turnbench_args_t &args) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (count_arg(argc, argv, i, "-n", "--floors", "floors", 1, args.floors)) continue;
+        if (count_arg(argc, argv, i, "-m", "--monsters", "monsters", 1, args.monsters)) continue;
+        if (count_arg(argc, argv, i, "-r", "--rounds", "rounds", 1, args.rounds)) continue;
+        if (seed_arg(argc, argv, i, args.seed)) continue;
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printf("usage: %s [-n <floors>] [-m <monsters>] [-r <rounds>]\n", argv[0]);
+            printf("times monsters deciding their turns through the generic path against the per-ability\n");
+            printf("kernels, and checks both decide the same things\n");
+            printf("  -h/--help: display this message\n");
+            printf("  -n/--floors <floors>: floors to generate (default: 20)\n");
+            printf("  -m/--monsters <monsters>: monsters on each floor, spread over every kernel (default: 64)\n");
+            printf("  -r/--rounds <rounds>: times each monster decides (default: 200)\n");
+            printf("  --seed <seed>: seed for the first floor (default: 0)\n");
+            return 1;
+        }
+        throw dungeon_exception(__PRETTY_FUNCTION__, "unrecognized argument. run -h/--help for usage");
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <cstdio>
+#include <vector>
+#include "../macros.h"
+#include "../dungeon.h"
+#include "../logger.h"
+#include "bench.h"
+
+typedef struct {
+    unsigned int floors;
+    unsigned int batches;
+    uint64_t seed;
+} walltest_args_t;
+
+int prepare_args(int argc, char* argv[], walltest_args_t &args);
+
+/**
+ * Digs a few random stone cells into hallway, the way a tunneling monster would,
+ * and queues them with mark_wall_edit.
+ *
+ * Params:
+ * - dungeon: Dungeon to dig in
+ * Returns: How many cells were dug
+ */
+int dig_batch(Dungeon &dungeon) {
+    int count = 1 + rng_rand() % 4;
+    int dug = 0, i, x, y;
+    for (i = 0; i < count; i++) {
+        x = 1 + rng_rand() % (dungeon.width - 2);
+        y = 1 + rng_rand() % (dungeon.height - 2);
+        if (dungeon.cells[x][y].type != CELL_TYPE_STONE) continue;
+        dungeon.cells[x][y].type = CELL_TYPE_HALL;
+        dungeon.mark_wall_edit(IntPair(x, y));
+        dug++;
+    }
+    return dug;
+}
+
+int main(int argc, char* argv[]) {
+    walltest_args_t args = {.floors = 200, .batches = 30, .seed = 0};
+    std::vector<uint8_t> attributes, wall_types;
+    DungeonOptions options = bench_options(IntPair(80, 40), IntPair(8, 14));
+    unsigned int checked = 0, mismatched = 0, dug = 0;
+    if (prepare_args(argc, argv, args)) {
+        return 1;
+    }
+    Logger::get()->off(LOG_LEVEL_DEBUG);
+
+    for_each_seeded_floor(options, args.floors, args.seed, [&](Dungeon &dungeon, unsigned int floor) {
+        unsigned int batch;
+        int x, y, i;
+        for (batch = 0; batch < args.batches; batch++) {
+            dug += dig_batch(dungeon);
+            dungeon.apply_wall_edits();
+
+            // What the incremental pass came up with...
+            attributes.clear();
+            wall_types.clear();
+            for (x = 0; x < dungeon.width; x++) {
+                for (y = 0; y < dungeon.height; y++) {
+                    attributes.push_back(dungeon.cells[x][y].attributes);
+                    wall_types.push_back(dungeon.cells[x][y].wall_type);
+                }
+            }
+
+            // ...has to match classifying everything from scratch.
+            dungeon.apply_walls();
+            i = 0;
+            for (x = 0; x < dungeon.width; x++) {
+                for (y = 0; y < dungeon.height; y++, i++) {
+                    if (attributes[i] == dungeon.cells[x][y].attributes && wall_types[i] == dungeon.cells[x][y].wall_type) continue;
+                    if (mismatched < 10)
+                        printf("floor %u batch %u: (%d, %d) is wall type %d, attributes %d after apply_wall_edits, but %d, %d after apply_walls\n",
+                            floor, batch, x, y, wall_types[i], attributes[i], dungeon.cells[x][y].wall_type, dungeon.cells[x][y].attributes);
+                    mismatched++;
+                }
+            }
+            checked++;
+        }
+        return true;
+    });
+
+    printf("checked %u batches (%u cells dug), %u mismatched cells\n", checked, dug, mismatched);
+    return mismatched == 0 && checked > 0 ? 0 : 1;
+}
+
+int prepare_args(int argc, char* argv[], walltest_args_t &args) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (count_arg(argc, argv, i, "-n", "--floors", "floors", 1, args.floors)) continue;
+        if (count_arg(argc, argv, i, "-b", "--batches", "batches", 1, args.batches)) continue;
+        if (seed_arg(argc, argv, i, args.seed)) continue;
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            printf("usage: %s [-n <floors>] [-b <batches>]\n", argv[0]);
+            printf("digs random cells out of generated floors and checks that re-classifying the walls\n");
+            printf("around them (apply_wall_edits) matches re-classifying the whole floor (apply_walls)\n");
+            printf("  -h/--help: display this message\n");
+            printf("  -n/--floors <floors>: floors to generate (default: 200)\n");
+            printf("  -b/--batches <batches>: batches of digging on each floor (default: 30)\n");
+            printf("  --seed <seed>: seed for the first floor (default: 0)\n");
+            return 1;
+        }
+        throw dungeon_exception(__PRETTY_FUNCTION__, "unrecognized argument. run -h/--help for usage");
+    }
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include "heap.h"
 #include "message_queue.h"
 #include "resource_manager.h"
+#include "save_file.h"
+#include "pathfinding.h"
 
 #include <cstdint>
 #include <cstdio>
@@ -14,13 +16,12 @@
 
 IntPair random_location_no_kill(Dungeon *dungeon, Character ***character_map) {
     int i;
-    IntPair coords;
+    std::optional<IntPair> coords;
     for (i = 0; i < MAX_ATTEMPTS; i++) {
-        try {
-            coords = dungeon->random_location();
-            if (character_map[coords.x][coords.y]) continue;
-            return coords;
-        } catch (dungeon_exception &e) {}
+        coords = dungeon->random_location();
+        if (!coords) break;
+        if (character_map[coords->x][coords->y]) continue;
+        return *coords;
     }
     throw dungeon_exception(__PRETTY_FUNCTION__, "no available space for a new monster in dungeon");
 }
@@ -31,7 +32,7 @@ void destroy_character(Character ***character_map, Character *ch) {
     delete ch;
 }
 
-int Monster::damage(int amount, game_result_t &result, Dungeon *dungeon, Item ***item_map, Character ***character_map) {
+int Monster::damage(int amount, game_result_t &result, Dungeon *dungeon, ItemMapStack **item_map, Character ***character_map) {
     hp -= amount;
     if (hp <= 0) {
         die(result, dungeon, character_map, item_map);
@@ -40,6 +41,44 @@ int Monster::damage(int amount, game_result_t &result, Dungeon *dungeon, Item **
     return amount;
 }
 
+Character::~Character() {
+    if (store) store->remove(this);
+}
+
+CharacterStore::~CharacterStore() {
+    // Whatever's left (the PC, usually) outlives the floor.
+    for (Character *ch : owners) ch->store = nullptr;
+}
+
+void CharacterStore::add(Character *ch) {
+    if (ch->store) ch->store->remove(ch);
+    ch->store = this;
+    ch->entity = owners.size();
+    owners.push_back(ch);
+    kinds.push_back(ch->type());
+    positions.push_back(IntPair(ch->x, ch->y));
+    speeds.push_back(ch->speed);
+}
+
+void CharacterStore::remove(Character *ch) {
+    uint32_t last = owners.size() - 1;
+    if (ch->store != this) return;
+    owners[ch->entity] = owners[last];
+    kinds[ch->entity] = kinds[last];
+    positions[ch->entity] = positions[last];
+    speeds[ch->entity] = speeds[last];
+    owners[ch->entity]->entity = ch->entity;
+    owners.pop_back();
+    kinds.pop_back();
+    positions.pop_back();
+    speeds.pop_back();
+    ch->store = nullptr;
+}
+
+void CharacterStore::moved(Character *ch) {
+    if (ch->store == this) positions[ch->entity] = IntPair(ch->x, ch->y);
+}
+
 void Character::move_to(IntPair to, Character ***character_map) {
     if (location_initialized && character_map[x][y] == this) {
         character_map[x][y] = NULL;
@@ -54,6 +93,7 @@ void Character::move_to(IntPair to, Character ***character_map) {
     
     x = to.x;
     y = to.y;
+    if (store) store->moved(this);
     
     location_initialized = true;
 }
@@ -106,10 +146,10 @@ bool Character::has_los(Dungeon *dungeon, IntPair to) {
     return true;
 }
 
-IntPair Monster::next_xy(Dungeon *dungeon, IntPair to) {
+IntPair Monster::next_xy(IntPair from, IntPair to) {
     // Butchered version of has_los.
-    unsigned int x0 = x;
-    unsigned int y0 = y;
+    unsigned int x0 = from.x;
+    unsigned int y0 = from.y;
     unsigned int x1 = to.x;
     unsigned int y1 = to.y;
     float m, b;
@@ -149,15 +189,19 @@ IntPair Monster::next_xy(Dungeon *dungeon, IntPair to) {
 }
 
 
-Monster::Monster(MonsterDefinition *definition, ItemDefinition *key_drop) {
+Monster::Monster(MonsterDefinition *definition, ItemDefinition *key_drop) : Character(CHARACTER_TYPE_MONSTER) {
     this->definition = definition;
     this->key_drop = key_drop;
     this->hp = definition->hp->roll();
+    this->base_hp = this->hp;
     this->speed = (uint8_t) CLAMP(definition->speed->roll(), 1, 255);
     this->attributes = (uint16_t) definition->abilities;
     this->display = definition->symbol;
     this->pc_seen = false;
+    this->pc_last_seen_x = 0;
+    this->pc_last_seen_y = 0;
     this->dead = false;
+    choose_kernel();
     color_count = 0;
     int i;
     int color_val = definition->color;
@@ -185,116 +229,328 @@ uint8_t Monster::current_color() {
 }
 
 int VALID_MOVES[][2] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}};
+// Indexed by direction_t.
+static const int DIRECTION_OFFSETS[][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+/**
+ * The step an intelligent monster takes from a cell: the lowest neighbour on the map,
+ *  preferring open cells on a tie.
+ *
+ * Params:
+ * - dungeon: Dungeon the map is for
+ * - map: Pathfinding map to follow
+ * - from: Cell to step from
+ * - next: Set to the cell to step into
+ * Returns: False if there's nowhere to go
+ */
+static bool downhill_step(Dungeon *dungeon, uint32_t **map, IntPair from, IntPair &next) {
+    uint32_t min = UINT32_MAX;
+    int x1, y1;
+    for (int *move : VALID_MOVES) {
+        x1 = from.x + move[0];
+        y1 = from.y + move[1];
+        if (x1 < 0 || x1 >= dungeon->width) continue;
+        if (y1 < 0 || y1 >= dungeon->height) continue;
+        if (map[x1][y1] == UINT32_MAX) continue;
+        // Find the minimum while preferring non-stone cells.
+        if (map[x1][y1] < min || (map[x1][y1] == min && dungeon->cells[x1][y1].type != CELL_TYPE_STONE)) {
+            min = map[x1][y1];
+            next.x = x1;
+            next.y = y1;
+        }
+    }
+    // There is a possibility we can't move in any direction if we generate a bad dungeon.
+    return min != UINT32_MAX;
+}
+
+void Monster::start_path(Dungeon *dungeon, IntPair target) {
+    path = 0;
+    path_length = 0;
+    path_x = x;
+    path_y = y;
+    path_target_x = target.x;
+    path_target_y = target.y;
+    path_terrain = dungeon->terrain_edits();
+}
+
+// Appends the step between two neighbouring cells to a path.
+static void push_step(uint32_t &path, uint8_t &length, IntPair from, IntPair to) {
+    direction_t direction;
+    if (to.x > from.x) direction = DIRECTION_EAST;
+    else if (to.x < from.x) direction = DIRECTION_WEST;
+    else if (to.y < from.y) direction = DIRECTION_NORTH;
+    else direction = DIRECTION_SOUTH;
+    path |= (uint32_t) direction << (length * 2);
+    length++;
+}
+
+void Monster::plan_downhill(Dungeon *dungeon, uint32_t **map, IntPair target) {
+    IntPair at(x, y), step;
+    start_path(dungeon, target);
+    while (path_length < CACHED_PATH_STEPS) {
+        if (!downhill_step(dungeon, map, at, step)) break;
+        push_step(path, path_length, at, step);
+        at = step;
+        if (map[at.x][at.y] == 0) break;
+    }
+}
+
+void Monster::plan_line(Dungeon *dungeon, IntPair target, bool digs) {
+    IntPair at(x, y), step;
+    start_path(dungeon, target);
+    while (path_length < CACHED_PATH_STEPS && (at.x != target.x || at.y != target.y)) {
+        step = next_xy(at, target);
+        // If the next move is diagonal, pick one.
+        if (step.x != at.x && step.y != at.y) {
+            if (rng_rand() % 2) step.x = at.x;
+            else step.y = at.y;
+        }
+        push_step(path, path_length, at, step);
+        at = step;
+        // Nothing past stone is any use to something that can't dig through it.
+        if (!digs && dungeon->cells[at.x][at.y].type == CELL_TYPE_STONE) break;
+    }
+}
+
+bool Monster::path_valid(Dungeon *dungeon, IntPair target) {
+    uint32_t edit, steps;
+    uint8_t i;
+    IntPair dug, at;
+    if (path_length == 0 || x != path_x || y != path_y) return false;
+    if (abs(target.x - path_target_x) > CACHED_PATH_TOLERANCE || abs(target.y - path_target_y) > CACHED_PATH_TOLERANCE) return false;
+    // Usually nothing's been dug at all, and this is all it takes.
+    if (dungeon->terrain_edits() == path_terrain) return true;
+    if (dungeon->terrain_edits() - path_terrain > TERRAIN_LOG_SIZE) return false;
+    for (edit = path_terrain; edit < dungeon->terrain_edits(); edit++) {
+        dug = dungeon->terrain_edit(edit);
+        at = IntPair(x, y);
+        steps = path;
+        for (i = 0; i < path_length; i++) {
+            at.x += DIRECTION_OFFSETS[steps & 3][0];
+            at.y += DIRECTION_OFFSETS[steps & 3][1];
+            steps >>= 2;
+            if (at.x == dug.x && at.y == dug.y) return false;
+        }
+    }
+    // None of those edits were in the way, so they don't need checking again.
+    path_terrain = dungeon->terrain_edits();
+    return true;
+}
+
+bool Monster::take_path_step(Dungeon *dungeon, IntPair target, IntPair &next) {
+    if (!path_valid(dungeon, target)) return false;
+    next.x = x + DIRECTION_OFFSETS[path & 3][0];
+    next.y = y + DIRECTION_OFFSETS[path & 3][1];
+    path >>= 2;
+    path_length--;
+    path_x = next.x;
+    path_y = next.y;
+    return true;
+}
 
-void Monster::take_turn(Dungeon *dungeon, PC *pc, BinaryHeap<Character *> &turn_queue, Character ***character_map, Item ***item_map, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, uint32_t priority, game_result_t &result) {
+bool Monster::look_for_pc(Dungeon *dungeon, PC *pc, IntPair &target) {
+    // If it has line of sight, it can.
+    if (has_los(dungeon, (IntPair) {pc->x, pc->y})) {
+        target = IntPair(pc->x, pc->y);
+
+        // For future use, we can also mark that the PC was seen.
+        pc_seen = 1;
+        pc_last_seen_x = pc->x;
+        pc_last_seen_y = pc->y;
+        return true;
+    }
+    // If it has a last seen location in mind, it can.
+    if (pc_seen) {
+        target = IntPair(pc_last_seen_x, pc_last_seen_y);
+        return true;
+    }
+    return false;
+}
+
+bool Monster::step_downhill(Dungeon *dungeon, PC *pc, uint32_t **map, const CongestionMap *congestion, IntPair &next) {
+    uint32_t score, best;
+    int x1, y1;
+
+    // In a crowd, the distance map plus how packed each cell is makes a flow field, so
+    // a group spreads out over side routes instead of queueing (and shoving) down one.
+    if (congestion) {
+        best = UINT32_MAX;
+        for (int *move : VALID_MOVES) {
+            x1 = x + move[0];
+            y1 = y + move[1];
+            if (x1 < 0 || x1 >= dungeon->width) continue;
+            if (y1 < 0 || y1 >= dungeon->height) continue;
+            // Never back off, and wait a turn rather than shove another monster out of the way.
+            if (map[x1][y1] == UINT32_MAX || map[x1][y1] > map[x][y]) continue;
+            if (congestion->occupied_at(x1, y1)) continue;
+            score = map[x1][y1] + CROWD_COST * congestion->at(x1, y1);
+            if (score < best || (score == best && dungeon->cells[x1][y1].type != CELL_TYPE_STONE)) {
+                best = score;
+                next.x = x1;
+                next.y = y1;
+            }
+        }
+        return best != UINT32_MAX;
+    }
+
+    // Otherwise, keep following the path from last time, or plan a new one downhill.
+    if (take_path_step(dungeon, IntPair(pc->x, pc->y), next)) return true;
+    plan_downhill(dungeon, map, IntPair(pc->x, pc->y));
+    return take_path_step(dungeon, IntPair(pc->x, pc->y), next);
+}
+
+template <bool DIGS>
+bool Monster::step_line(Dungeon *dungeon, IntPair target, IntPair &next) {
+    if (!take_path_step(dungeon, target, next)) {
+        plan_line(dungeon, target, DIGS);
+        // Already standing on the target.
+        if (!take_path_step(dungeon, target, next)) next = IntPair(x, y);
+    }
+    // Can't if it's non-tunneling and going towards stone.
+    if constexpr (!DIGS) {
+        if (dungeon->cells[next.x][next.y].type == CELL_TYPE_STONE) return false;
+    }
+    return true;
+}
+
+template <bool DIGS>
+bool Monster::step_erratic(Dungeon *dungeon, IntPair &next) {
+    uint8_t x_offset;
+    int i, j, x1, y1;
+    // Pick a random available cell around the monster.
+    x_offset = rng_rand();
+    j = ARRAY_SIZE(VALID_MOVES);
+    for (i = 0; i < j; i++) {
+        x1 = x + VALID_MOVES[(x_offset + i) % j][0];
+        y1 = y + VALID_MOVES[(x_offset + i) % j][1];
+        if (x1 < 0 || x1 >= dungeon->width) continue;
+        if (y1 < 0 || y1 >= dungeon->height) continue;
+        if (x1 == x && y1 == y) continue;
+        if (dungeon->cells[x1][y1].attributes & CELL_ATTRIBUTE_IMMUTABLE) continue;
+        if constexpr (!DIGS) {
+            if (dungeon->cells[x1][y1].type == CELL_TYPE_STONE || dungeon->cells[x1][y1].type == CELL_TYPE_DECORATION) continue;
+        }
+        // This cell is open
+        next.x = x1;
+        next.y = y1;
+        return true;
+    }
+    return false;
+}
+
+template <unsigned int KIND>
+MonsterIntent Monster::decide_as(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion) {
+    // Everything about the monster's abilities is settled here, at compile time, so the
+    // branches below that don't apply to this kind of monster aren't even there.
+    constexpr bool intelligent = KIND & MONSTER_KERNEL_INTELLIGENT;
+    constexpr bool telepathic = KIND & MONSTER_KERNEL_TELEPATHIC;
+    constexpr bool digs = KIND & MONSTER_KERNEL_DIGS;
+    constexpr bool erratic = KIND & MONSTER_KERNEL_ERRATIC;
     // Find out which direction this monster wants to go.
     // - Telepathic: Directly to the PC
     // - Intelligent: Towards the last seen location
     // - None: Only towards the PC if there's LOS
-    uint8_t min, x_offset, target_x, target_y;
-    IntPair next;
-    int i, j, x1, y1, dam, r;
-    uint32_t** map;
-    Cell* next_cell;
+    IntPair target, next;
     bool can_move;
+    MonsterIntent intent;
+    RngScope scope(rng);
 
-    // Slightly inefficient but I prefer the readability since this algorithm is a bit more complex.
     // 1: Determine if the monster is allowed to go to the PC.
-    can_move = false;
     //    a: If it's telepathic, it can.
-    if (attributes & MONSTER_ATTRIBUTE_TELEPATHIC) {
-        can_move = 1;
-        target_x = pc->x;
-        target_y = pc->y;
-    }
-    //    b: If it has line of sight, it can.
-    else if (has_los(dungeon, (IntPair) {pc->x, pc->y})) {
-        can_move = 1;
-        target_x = pc->x;
-        target_y = pc->y;
-
-        // For future use, we can also mark that the PC was seen.
-        pc_seen = 1;
-        pc_last_seen_x = pc->x;
-        pc_last_seen_y = pc->y;
+    if constexpr (telepathic) {
+        can_move = true;
+        target = IntPair(pc->x, pc->y);
     }
-    //    c: If it has a last seen location in mind, it can.
-    else if (pc_seen) {
-        can_move = 1;
-        target_x = pc_last_seen_x;
-        target_y = pc_last_seen_y;
+    //    b: Otherwise, only if it can see the PC or remembers where it was.
+    else {
+        can_move = look_for_pc(dungeon, pc, target);
     }
 
     // 2: If we can move, find out the cell we'll move to next.
     if (can_move) {
         // If the monster's intelligent, follow the shortest path to the destination.
-        if (attributes & MONSTER_ATTRIBUTE_INTELLIGENT) {
-            // We can use the pathfinding maps to go to the PC
-            if (attributes & (MONSTER_ATTRIBUTE_TUNNELING | MONSTER_ATTRIBUTE_GHOST))
-                map = pathfinding_tunnel;
-            else
-                map = pathfinding_no_tunnel;
-
-            // Pick the best direction
-            min = UINT8_MAX;
-            for (int *move : VALID_MOVES) {
-                x1 = x + move[0];
-                y1 = y + move[1];
-                if (x1 < 0 || x1 >= dungeon->width) continue;
-                if (y1 < 0 || y1 >= dungeon->height) continue;
-                if (x1 == x && y1 == y) continue;
-                if (map[x1][y1] == UINT32_MAX) continue;
-                // Find the minimum while preferring non-stone cells.
-                if (map[x1][y1] < min || (map[x1][y1] == min && dungeon->cells[x1][y1].type != CELL_TYPE_STONE)) {
-                    min = map[x1][y1];
-                    next.x = x1;
-                    next.y = y1;
-                }
-            }
-
-            // There is a possibility we can't move in any direction if we generate a bad dungeon.
-            if (min == UINT8_MAX) {
-                can_move = 0;
-            }
+        if constexpr (intelligent) {
+            can_move = step_downhill(dungeon, pc, digs ? pathfinding_tunnel : pathfinding_no_tunnel, congestion, next);
         }
-
         // Otherwise, we'll go in a straight line.
         else {
-            next = next_xy(dungeon, (IntPair) {target_x, target_y});
-            // If the next move is diagonal, pick one.
-            if (next.x != x && next.y != y) {
-                if (rand() % 2) next.x = x;
-                else next.y = y;
-            }
-            // Can't if it's non-tunneling and going towards stone.
-            if (!(attributes & (MONSTER_ATTRIBUTE_TUNNELING | MONSTER_ATTRIBUTE_GHOST)) && dungeon->cells[next.x][next.y].type == CELL_TYPE_STONE) {
-                can_move = 0;
-            }
+            can_move = step_line<digs>(dungeon, target, next);
         }
     }
 
     // And, of course, there's the possibility that the monster is erratic and will move randomly.
-    if ((attributes & MONSTER_ATTRIBUTE_ERRATIC) && rand() % 2 == 1) {
-        // Pick a random available cell around the monster.
-        x_offset = rand();
-        can_move = 0;
-        j = ARRAY_SIZE(VALID_MOVES);
-        for (i = 0; i < j; i++) {
-            x1 = x + VALID_MOVES[(x_offset + i) % j][0];
-            y1 = y + VALID_MOVES[(x_offset + i) % j][1];
-            if (x1 < 0 || x1 >= dungeon->width) continue;
-            if (y1 < 0 || y1 >= dungeon->height) continue;
-            if (x1 == x && y1 == y) continue;
-            if (dungeon->cells[x1][y1].attributes & CELL_ATTRIBUTE_IMMUTABLE) continue;
-            if ((dungeon->cells[x1][y1].type == CELL_TYPE_STONE || dungeon->cells[x1][y1].type == CELL_TYPE_DECORATION) && !(attributes & (MONSTER_ATTRIBUTE_TUNNELING | MONSTER_ATTRIBUTE_GHOST))) continue;
-            // This cell is open
-            next.x = x1;
-            next.y = y1;
-            can_move = 1;
-            break;
-        }
+    if constexpr (erratic) {
+        if (rng_rand() % 2 == 1) can_move = step_erratic<digs>(dungeon, next);
+    }
+
+    intent.from = IntPair{(int) x, (int) y};
+    intent.next = next;
+    intent.can_move = can_move;
+    return intent;
+}
+
+// One kernel for every combination of MONSTER_KERNEL_* bits, in order.
+const Monster::DecideKernel Monster::DECIDE_KERNELS[MONSTER_KERNEL_COUNT] = {
+    &Monster::decide_as<0x0>, &Monster::decide_as<0x1>, &Monster::decide_as<0x2>, &Monster::decide_as<0x3>,
+    &Monster::decide_as<0x4>, &Monster::decide_as<0x5>, &Monster::decide_as<0x6>, &Monster::decide_as<0x7>,
+    &Monster::decide_as<0x8>, &Monster::decide_as<0x9>, &Monster::decide_as<0xa>, &Monster::decide_as<0xb>,
+    &Monster::decide_as<0xc>, &Monster::decide_as<0xd>, &Monster::decide_as<0xe>, &Monster::decide_as<0xf>
+};
+
+MonsterIntent Monster::decide_generic(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion) {
+    // The same steps as decide_as, with each ability looked up as it comes.
+    bool intelligent = attributes & MONSTER_ATTRIBUTE_INTELLIGENT;
+    bool telepathic = attributes & MONSTER_ATTRIBUTE_TELEPATHIC;
+    bool digs = attributes & (MONSTER_ATTRIBUTE_TUNNELING | MONSTER_ATTRIBUTE_GHOST);
+    bool erratic = attributes & MONSTER_ATTRIBUTE_ERRATIC;
+    IntPair target, next;
+    bool can_move;
+    MonsterIntent intent;
+    RngScope scope(rng);
+
+    if (telepathic) {
+        can_move = true;
+        target = IntPair(pc->x, pc->y);
+    } else {
+        can_move = look_for_pc(dungeon, pc, target);
     }
 
+    if (can_move) {
+        if (intelligent)
+            can_move = step_downhill(dungeon, pc, digs ? pathfinding_tunnel : pathfinding_no_tunnel, congestion, next);
+        else
+            can_move = digs ? step_line<true>(dungeon, target, next) : step_line<false>(dungeon, target, next);
+    }
+
+    if (erratic && rng_rand() % 2 == 1)
+        can_move = digs ? step_erratic<true>(dungeon, next) : step_erratic<false>(dungeon, next);
+
+    intent.from = IntPair{(int) x, (int) y};
+    intent.next = next;
+    intent.can_move = can_move;
+    return intent;
+}
+
+void Monster::choose_kernel() {
+    unsigned int kind = 0;
+    if (attributes & MONSTER_ATTRIBUTE_INTELLIGENT) kind |= MONSTER_KERNEL_INTELLIGENT;
+    if (attributes & MONSTER_ATTRIBUTE_TELEPATHIC) kind |= MONSTER_KERNEL_TELEPATHIC;
+    if (attributes & (MONSTER_ATTRIBUTE_TUNNELING | MONSTER_ATTRIBUTE_GHOST)) kind |= MONSTER_KERNEL_DIGS;
+    if (attributes & MONSTER_ATTRIBUTE_ERRATIC) kind |= MONSTER_KERNEL_ERRATIC;
+    decide_kernel = DECIDE_KERNELS[kind];
+}
+
+MonsterIntent Monster::decide_turn(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion) {
+    return (this->*decide_kernel)(dungeon, pc, pathfinding_tunnel, pathfinding_no_tunnel, congestion);
+}
+
+void Monster::resolve_turn(const MonsterIntent &intent, Dungeon *dungeon, PC *pc, Character ***character_map, ItemMapStack **item_map, game_result_t &result) {
+    IntPair next = intent.next;
+    int x1, y1, dam, r;
+    Cell* next_cell;
+    bool can_move = intent.can_move;
+    RngScope scope(rng);
+
     // 3: Time to move!
     if (can_move && (next.x != x || next.y != y)) {
         // In the special case of non-telepathic monsters, we want to clear out the PC seen flag once we reach
@@ -308,10 +564,13 @@ void Monster::take_turn(Dungeon *dungeon, PC *pc, BinaryHeap<Character *> &turn_
         if (next_cell->type != CELL_TYPE_HALL && next_cell->type != CELL_TYPE_ROOM) {
             if (next_cell->type == CELL_TYPE_STONE && attributes & MONSTER_ATTRIBUTE_TUNNELING) {
                 next_cell->hardness -= MIN(next_cell->hardness, 85);
+                // Even a dent changes what the way through here costs.
+                dungeon->log_terrain_edit(next);
                 if (next_cell->hardness > 0) can_move = 0;
                 else {
                     next_cell->type = CELL_TYPE_HALL;
-                    dungeon->apply_walls();
+                    // Walls get re-classified once the turn's done, in case anything else digs.
+                    dungeon->mark_wall_edit(next);
                 }
             } else {
                 can_move = 0;
@@ -321,15 +580,9 @@ void Monster::take_turn(Dungeon *dungeon, PC *pc, BinaryHeap<Character *> &turn_
         // 1 byte of memory > readability :)
         if (can_move) {
             // If there's an item there, destroy it or pick it up.
-            if (item_map[next.x][next.y] != NULL) {
-                if (attributes & MONSTER_ATTRIBUTE_PICKUP) {
-                    add_to_inventory(item_map[next.x][next.y]);
-                    item_map[next.x][next.y] = NULL;
-                }
-                else if (attributes & MONSTER_ATTRIBUTE_DESTROY) {
-                    delete item_map[next.x][next.y];
-                    item_map[next.x][next.y] = NULL;
-                }
+            if (!item_map[next.x][next.y].empty()) {
+                if (attributes & MONSTER_ATTRIBUTE_PICKUP) inventory.append(item_map[next.x][next.y]);
+                else if (attributes & MONSTER_ATTRIBUTE_DESTROY) item_map[next.x][next.y].clear();
             }
 
             // If there's already a character there, deal damage or displace.
@@ -337,7 +590,7 @@ void Monster::take_turn(Dungeon *dungeon, PC *pc, BinaryHeap<Character *> &turn_
                 // If it's the PC, deal damage.
                 if (character_map[next.x][next.y] == pc) {
                     // See if the PC dodges.
-                    r = rand() % 100;
+                    r = rng_rand() % 100;
                     if (pc->dodge_bonus() >= r) {
                         MessageQueue::get()->add(
                             "You dodge an attack from &" +
@@ -384,48 +637,44 @@ void Monster::take_turn(Dungeon *dungeon, PC *pc, BinaryHeap<Character *> &turn_
             }
         }
     }
-
-    turn_queue.insert(this, priority + speed);
-    return;
 }
 
-void Monster::die(game_result_t &result, Dungeon *dungeon, Character ***character_map, Item ***item_map) {
+void Monster::die(game_result_t &result, Dungeon *dungeon, Character ***character_map, ItemMapStack **item_map) {
     // If the monster has stuff in its inventory, drop it here.
-    if (item != NULL) {
-        if (item_map[x][y]) {
-            item_map[x][y]->add_to_stack(item);
-        } else {
-            item_map[x][y] = item;
-        }
-    }
+    item_map[x][y].append(inventory);
     // Clear out this location on the character map...
+    CharacterStore *floor = store;
     if (character_map[x][y] == this)
         character_map[x][y] = NULL;
+    if (store) store->remove(this);
     // Deleting is left to whatever called this.
     dead = true;
 
     // We need to drop a keycard if:
     // - This is the last monster in this character map
     // - There is an up staircase
-    unsigned int x1, y1;
+    unsigned int x1, y1, i;
     bool other_monster_found = false;
     bool has_up_staircase = false;
     if (key_drop) {
-        for (x1 = 0; x1 < dungeon->width; x1++) {
-            for (y1 = 0; y1 < dungeon->height; y1++) {
-                if (!other_monster_found && character_map[x1][y1] && character_map[x1][y1]->type() == CHARACTER_TYPE_MONSTER) {
-                    other_monster_found = true;
-                    break;
-                }
-                if (!has_up_staircase && dungeon->cells[x1][y1].type == CELL_TYPE_UP_STAIRCASE) has_up_staircase = true;
+        // The floor's store already knows who's left, without looking at every cell.
+        if (floor) {
+            for (i = 0; i < floor->size() && !other_monster_found; i++)
+                other_monster_found = floor->kind(i) == CHARACTER_TYPE_MONSTER;
+        } else {
+            for (x1 = 0; x1 < dungeon->width && !other_monster_found; x1++) {
+                for (y1 = 0; y1 < dungeon->height && !other_monster_found; y1++)
+                    other_monster_found = character_map[x1][y1] && character_map[x1][y1]->type() == CHARACTER_TYPE_MONSTER;
             }
         }
+        for (x1 = 0; x1 < dungeon->width && !other_monster_found && !has_up_staircase; x1++) {
+            for (y1 = 0; y1 < dungeon->height && !has_up_staircase; y1++)
+                has_up_staircase = dungeon->cells[x1][y1].type == CELL_TYPE_UP_STAIRCASE;
+        }
         if (!other_monster_found && has_up_staircase) {
-            if (item_map[x][y]) {
-                item_map[x][y]->add_to_stack(new Item(key_drop));
-            } else {
-                item_map[x][y] = new Item(key_drop);
-            }
+            // It belongs to this floor, same as the monster.
+            ArenaScope arena_scope(FloorArena::of(this));
+            item_map[x][y].push(new Item(key_drop));
         }
     }
 
@@ -433,59 +682,98 @@ void Monster::die(game_result_t &result, Dungeon *dungeon, Character ***characte
     if (definition->abilities & MONSTER_ATTRIBUTE_BOSS) result = GAME_RESULT_WIN;
 }
 
-int Character::inventory_size() {
-    // We could use a separate size variable here, but we're returning Items directly,
-    // and they have methods on them to manage the stack. It's more reliable to re-count
-    // every time, though less efficient.
-    int i = 0;
-    Item *current = item;
-    while (current != NULL) {
-        i++;
-        current = current->next_in_stack();
-    }
-    return i;
+void Character::save_state(SaveWriter &out) {
+    out.write_u8(direction);
+    out.write_u8(display);
+    out.write_u8(x);
+    out.write_u8(y);
+    out.write_u8(speed);
+    out.write_u8(dead);
+    out.write_i32(hp);
+    out.write_i32(base_hp);
 }
-void Character::add_to_inventory(Item *item) {
-    if (this->item == NULL) this->item = item;
-    else this->item->add_to_stack(item);
-    item_count++;
+
+void Character::load_state(SaveReader &in) {
+    direction = (direction_t) (in.read_u8() & 3);
+    display = in.read_u8();
+    x = in.read_u8();
+    y = in.read_u8();
+    speed = in.read_u8();
+    if (speed == 0) speed = 1;
+    dead = in.read_u8();
+    hp = in.read_i32();
+    base_hp = in.read_i32();
+    location_initialized = true;
 }
-Item *Character::remove_from_inventory(int i) {
-    if (i < 0 || i >= item_count) throw dungeon_exception(__PRETTY_FUNCTION__, "inventory index out of bounds");
-    Item *current = item;
-    int j;
-    for (j = 0; j < i - 1; j++) {
-        current = current->next_in_stack();
-        if (current == NULL) throw dungeon_exception(__PRETTY_FUNCTION__, "inventory index out of bounds");
-    }
-    if (i == 0) {
-        current = item;
-        item = item->detach_stack();
-        return current;
-    }
-    else {
-        return current->remove_next_in_stack();
-    }
+
+ItemDefinition *Monster::get_key_drop() {
+    return key_drop;
 }
-Item *Character::remove_inventory_stack() {
-    Item *stack = item;
-    item_count = 0;
-    item = NULL;
-    return stack;
+
+bool Monster::can_go_dormant() {
+    return !(attributes & MONSTER_ATTRIBUTE_TELEPATHIC) && !pc_seen;
 }
 
-Item *Character::inventory_at(int i) {
-    if (i < 0 || i >= item_count) throw dungeon_exception(__PRETTY_FUNCTION__, "inventory index out of bounds");
-    Item *current = item;
-    int j;
-    for (j = 0; j < i; j++) {
-        current = current->next_in_stack();
-        if (current == NULL) throw dungeon_exception(__PRETTY_FUNCTION__, "inventory index out of bounds");
-    }
-    return current;
+void Monster::forget_pc() {
+    pc_seen = false;
 }
 
-PC::PC() {
+bool Monster::needs_pathfinding(Dungeon *dungeon, PC *pc, bool crowd) {
+    if (!(attributes & MONSTER_ATTRIBUTE_INTELLIGENT)) return false;
+    if (!crowd && path_valid(dungeon, IntPair(pc->x, pc->y))) return false;
+    // Only a monster that's actually after the PC follows a map at all.
+    return (attributes & MONSTER_ATTRIBUTE_TELEPATHIC) || pc_seen || has_los(dungeon, IntPair(pc->x, pc->y));
+}
+
+void Monster::save_state(SaveWriter &out) {
+    Character::save_state(out);
+    out.write_u8(pc_seen);
+    out.write_u8(pc_last_seen_x);
+    out.write_u8(pc_last_seen_y);
+    out.write_u16(attributes);
+    out.write_u8(color_i);
+    out.write_rng(rng);
+    out.write_u8(dormant);
+    out.write_u32(path);
+    out.write_u8(path_length);
+    out.write_u8(path_x);
+    out.write_u8(path_y);
+    out.write_u8(path_target_x);
+    out.write_u8(path_target_y);
+    out.write_u32(path_terrain);
+}
+
+void Monster::load_state(SaveReader &in) {
+    Character::load_state(in);
+    pc_seen = in.read_u8();
+    pc_last_seen_x = in.read_u8();
+    pc_last_seen_y = in.read_u8();
+    attributes = in.read_u16();
+    color_i = in.read_u8();
+    if (color_i >= color_count) color_i = 0;
+    // The saved attributes are what count, in case they ever differ from the definition's.
+    choose_kernel();
+    in.read_rng(rng);
+    dormant = in.read_u8();
+    path = in.read_u32();
+    path_length = in.read_u8();
+    if (path_length > CACHED_PATH_STEPS) path_length = 0;
+    path_x = in.read_u8();
+    path_y = in.read_u8();
+    path_target_x = in.read_u8();
+    path_target_y = in.read_u8();
+    path_terrain = in.read_u32();
+}
+
+void Character::add_to_inventory(Item *item) {
+    inventory.push(item);
+}
+
+Item *Character::remove_from_inventory(int i) {
+    return inventory.remove(i);
+}
+
+PC::PC() : Character(CHARACTER_TYPE_PC) {
     Dice dice(100, 1, 20);
     base_hp = dice.roll();
     hp = base_hp;
@@ -493,14 +781,6 @@ PC::PC() {
         equipment[i] = NULL;
 }
 
-CHARACTER_TYPE PC::type() {
-    return CHARACTER_TYPE_PC;
-}
-
-CHARACTER_TYPE Monster::type() {
-    return CHARACTER_TYPE_MONSTER;
-}
-
 
 int PC::speed_bonus() {
     int i;
@@ -549,7 +829,7 @@ int PC::defense_bonus() {
     return def;
 }
 
-int PC::damage(int amount, game_result_t &result, Dungeon *dungeon, Item ***item_map, Character ***character_map) {
+int PC::damage(int amount, game_result_t &result, Dungeon *dungeon, ItemMapStack **item_map, Character ***character_map) {
     amount -= defense_bonus();
     if (amount <= 0) return 0;
     hp -= amount;
@@ -557,16 +837,13 @@ int PC::damage(int amount, game_result_t &result, Dungeon *dungeon, Item ***item
         dead = true;
         if (character_map[x][y] == this)
             character_map[x][y] = NULL;
+        if (store) store->remove(this);
     }
     ResourceManager::get()->play_music("effects_damage2");
     return amount;
 }
 
-Monster::~Monster() {
-    if (item) delete item;
-}
 PC::~PC() {
-    if (item) delete item;
     for (unsigned int i = 0; i < ARRAY_SIZE(equipment); i++) {
         if (equipment[i]) delete equipment[i];
     }
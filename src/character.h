@@ -4,9 +4,14 @@
 #include <cinttypes>
 #include <cstdint>
 #include <string>
+#include <vector>
 #include "dungeon.h"
 #include "random.h"
 #include "item.h"
+#include "floor_arena.h"
+
+class CongestionMap;
+class CharacterStore;
 
 #define MONSTER_ATTRIBUTE_INTELLIGENT 0x001
 #define MONSTER_ATTRIBUTE_TELEPATHIC 0x002
@@ -18,6 +23,15 @@
 #define MONSTER_ATTRIBUTE_UNIQUE 0x080
 #define MONSTER_ATTRIBUTE_BOSS 0x100
 
+// The abilities that change how a monster decides where to go. Each combination gets its own
+// copy of the decision code, built at compile time, so none of them are checked turn to turn.
+#define MONSTER_KERNEL_INTELLIGENT 0x1
+#define MONSTER_KERNEL_TELEPATHIC 0x2
+// Tunneling and ghost monsters both go through stone, as far as deciding is concerned.
+#define MONSTER_KERNEL_DIGS 0x4
+#define MONSTER_KERNEL_ERRATIC 0x8
+#define MONSTER_KERNEL_COUNT 16
+
 typedef enum {
     CHARACTER_TYPE_PC,
     CHARACTER_TYPE_MONSTER
@@ -25,6 +39,8 @@ typedef enum {
 
 class MonsterDefinition {
     public:
+        // The name it's listed under in the definition file, for save files.
+        std::string id;
         std::string name;
         std::string description;
         int color;
@@ -32,7 +48,9 @@ class MonsterDefinition {
         int abilities;
         Dice *hp;
         Dice *damage;
-        char symbol;
+        // Nothing in the definition file sets this (monsters are drawn from their textures),
+        // but it's copied into every monster's save, so it needs a value.
+        char symbol = 0;
         int rarity;
         bool unique_slain = false;
         std::string floor_texture_n;
@@ -56,21 +74,31 @@ typedef enum {
  * The base class (abstract) for a dungeon character.
  */
 class Character {
+    friend class CharacterStore;
+
     protected:
-        Item *item = NULL;
-        int item_count = 0;
+        // Whatever it's carrying, oldest first. Only monsters ever carry more than MAX_CARRY_SLOTS.
+        InlineItemStack<MAX_CARRY_SLOTS> inventory;
+        // The floor this character's on, and where in it, while it's on one.
+        CharacterStore *store = nullptr;
+        uint32_t entity = 0;
+        // Fixed when the character's made, so telling the PC from a monster is just a load.
+        const CHARACTER_TYPE kind;
+
+        Character(CHARACTER_TYPE kind) : kind(kind) {}
         
     public:
         direction_t direction = DIRECTION_NORTH;
         char display;
-        uint8_t x;
-        uint8_t y;
+        // Placing a character faces it the way it moved from here, so this needs a value.
+        uint8_t x = 0;
+        uint8_t y = 0;
         uint8_t speed;
-        bool dead;
+        bool dead = false;
         bool location_initialized = false;
         int hp;
         int base_hp;
-        virtual ~Character() {};
+        virtual ~Character();
 
         /**
          * Deals damage.
@@ -79,7 +107,7 @@ class Character {
          * - amount: Amount of damage to deal
          * - character_map (modified if dead)
          */
-        virtual int damage(int amount, game_result_t &result, Dungeon *dungeon, Item ***item_map, Character ***character_map) = 0;
+        virtual int damage(int amount, game_result_t &result, Dungeon *dungeon, ItemMapStack **item_map, Character ***character_map) = 0;
 
         /**
          * Moves this character to a location.
@@ -101,17 +129,49 @@ class Character {
          */
         bool has_los(Dungeon *dungeon, IntPair to);
         /**
-         * Gets the type of this character.
+         * Gets the type of this character. Not virtual, since rendering and a few
+         *  other loops ask for it once per cell.
          *
          * Returns: CHARACTER_TYPE_PC or CHARACTER_TYPE_MONSTER
          */
-        virtual CHARACTER_TYPE type() = 0;
+        CHARACTER_TYPE type() const { return kind; }
+
+        /**
+         * Writes the state every character has (position, health, and so on) to a save.
+         * Inventories are left to the caller, since items are saved by definition name.
+         *
+         * Params:
+         * - out: Save to write to
+         */
+        virtual void save_state(SaveWriter &out);
+
+        /**
+         * Reads back what save_state wrote.
+         *
+         * Params:
+         * - in: Save to read from
+         */
+        virtual void load_state(SaveReader &in);
+
+        /**
+         * Returns: How many items this character is carrying
+         */
+        int inventory_size() const { return inventory.size(); }
+
+        /**
+         * Params:
+         * - i: Index into the inventory
+         * Returns: The item there
+         */
+        Item *inventory_at(int i) const { return inventory.at(i); }
 
-        int inventory_size();
         void add_to_inventory(Item *item);
         Item *remove_from_inventory(int i);
-        Item *remove_inventory_stack();
-        Item *inventory_at(int i);
+
+        /**
+         * Returns: Everything this character is carrying, for saving and loading it whole
+         */
+        ItemStack &get_inventory() { return inventory; }
 };
 
 typedef enum {
@@ -132,15 +192,30 @@ class PC : public Character {
 
         PC();
         ~PC();
-        CHARACTER_TYPE type() override;
-        int damage(int amount, game_result_t &result, Dungeon *dungeon, Item ***item_map, Character ***character_map) override;
+        int damage(int amount, game_result_t &result, Dungeon *dungeon, ItemMapStack **item_map, Character ***character_map) override;
         int speed_bonus();
         int damage_bonus();
         int dodge_bonus();
         int defense_bonus();
 };
 
+/**
+ * What a monster has decided to do with its turn, worked out before anything
+ * actually moves so a whole batch of monsters can decide at once.
+ */
+class MonsterIntent {
+    public:
+        // Where the monster was when it decided, since the move only makes sense from there.
+        IntPair from;
+        // The cell it wants to step into, if it's moving at all.
+        IntPair next;
+        bool can_move = false;
+};
+
 class Monster : public Character {
+    // Times the kernels against decide_generic.
+    friend class TurnBench;
+
     private:
         bool pc_seen;
         uint8_t pc_last_seen_x;
@@ -150,28 +225,264 @@ class Monster : public Character {
         uint8_t color_count;
         ItemDefinition *key_drop;
 
+        typedef MonsterIntent (Monster::*DecideKernel)(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion);
+        static const DecideKernel DECIDE_KERNELS[MONSTER_KERNEL_COUNT];
+        // Picked out of DECIDE_KERNELS by choose_kernel.
+        DecideKernel decide_kernel;
+
+        // Up to CACHED_PATH_STEPS steps planned ahead, two bits each (a direction_t), next step lowest.
+        uint32_t path = 0;
+        uint8_t path_length = 0;
+        // Where the monster has to be standing for the next step to make sense.
+        uint8_t path_x = 0;
+        uint8_t path_y = 0;
+        // What the path was planned towards.
+        uint8_t path_target_x = 0;
+        uint8_t path_target_y = 0;
+        // The floor's terrain_edits() as of the last time the path was known to be clear.
+        uint32_t path_terrain = 0;
+
+        /**
+         * Checks whether the cached path still works: the monster's where it expects,
+         *  the target hasn't wandered more than CACHED_PATH_TOLERANCE off, and nothing
+         *  along the way has been dug out since.
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - target: Where the monster's headed now
+         * Returns: True if the path can still be followed
+         */
+        bool path_valid(Dungeon *dungeon, IntPair target);
+
+        /**
+         * Takes the next step off the cached path, if it's still valid.
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - target: Where the monster's headed now
+         * - next: Set to the cell to step into
+         * Returns: True if there was a step to take
+         */
+        bool take_path_step(Dungeon *dungeon, IntPair target, IntPair &next);
+
+        /**
+         * Throws out the cached path and starts an empty one from the monster's cell.
+         */
+        void start_path(Dungeon *dungeon, IntPair target);
+
+        /**
+         * Plans a path by following a pathfinding map downhill, the same way an
+         *  intelligent monster picks its next cell.
+         */
+        void plan_downhill(Dungeon *dungeon, uint32_t **map, IntPair target);
+
+        /**
+         * Plans a path along a straight line, the way everything else moves. Stops early
+         *  at stone if the monster can't dig.
+         */
+        void plan_line(Dungeon *dungeon, IntPair target, bool digs);
+
+        /**
+         * Looks for the PC the way a monster that isn't telepathic does: by line of
+         *  sight, or else by heading where it was last seen.
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - pc: The PC
+         * - target: Set to where to head, if anywhere
+         * Returns: True if there's somewhere to head
+         */
+        bool look_for_pc(Dungeon *dungeon, PC *pc, IntPair &target);
+
+        /**
+         * Picks the next cell for an intelligent monster, down the pathfinding map (or
+         *  the flow field it makes with congestion, in a crowd).
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - pc: The PC
+         * - map: Pathfinding map to follow
+         * - congestion: How crowded the cells around are, or nullptr
+         * - next: Set to the cell to step into
+         * Returns: True if there's a cell to step into
+         */
+        bool step_downhill(Dungeon *dungeon, PC *pc, uint32_t **map, const CongestionMap *congestion, IntPair &next);
+
+        /**
+         * Picks the next cell along a straight line to the target.
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - target: Where the monster's headed
+         * - next: Set to the cell to step into
+         * Returns: False if it's stone and the monster can't dig
+         */
+        template <bool DIGS>
+        bool step_line(Dungeon *dungeon, IntPair target, IntPair &next);
+
+        /**
+         * Picks a random open cell next to the monster.
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - next: Set to the cell to step into, if there is one
+         * Returns: True if there was one
+         */
+        template <bool DIGS>
+        bool step_erratic(Dungeon *dungeon, IntPair &next);
+
+        /**
+         * decide_turn, for one combination of MONSTER_KERNEL_* bits.
+         */
+        template <unsigned int KIND>
+        MonsterIntent decide_as(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion);
+
+        /**
+         * decide_turn for any monster, checking its abilities as it goes instead of
+         *  through a kernel. Makes the same decisions; turnbench times the kernels
+         *  against it.
+         */
+        MonsterIntent decide_generic(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion);
+
+        /**
+         * Points decide_kernel at the kernel for this monster's abilities. Has to be
+         *  called again whenever the attributes change.
+         */
+        void choose_kernel();
+
     public:
         MonsterDefinition *definition;
+        // This monster's own stream, so what it does doesn't depend on who moved before it.
+        Rng rng;
+        // Too far from the PC to notice it, so it only checks in now and then instead of taking full turns.
+        bool dormant = false;
         Monster(MonsterDefinition *definition, ItemDefinition *key_drop);
-        ~Monster();
+
+        // Made out of the active floor's arena, if there is one.
+        static void *operator new(size_t size) { return FloorArena::allocate_block(size); }
+        static void operator delete(void *object, size_t size) { FloorArena::release_block(object, size); }
         /**
-         * Finds the next coordinate to move to on a direct line to a
-         *  coordinate pair.
+         * Finds the next coordinate to move to on a direct line between two
+         *  coordinate pairs.
          *
          * Params:
-         * - dungeon: Dungeon containing the cell map
+         * - from: Coordinates to start at
          * - to: Coordinates to path to
          * Returns: Next coordinates to move to (if possible),
-         *  otherwise the current coordinates
+         *  otherwise the starting coordinates
+         */
+        static IntPair next_xy(IntPair from, IntPair to);
+        /**
+         * Works out where this monster wants to go. Nothing outside the monster itself
+         * (its memory of the PC and its stream) is changed, so any number of monsters
+         * can decide at once, as long as nothing moves in the meantime.
+         *
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - pc: The PC
+         * - pathfinding_tunnel: Distances to the PC for tunneling monsters
+         * - pathfinding_no_tunnel: Distances to the PC for everything else
+         * - congestion: How crowded the floor is, if intelligent monsters should steer
+         *   around each other, or null to always take the shortest path
+         * Returns: The monster's intent
          */
-        IntPair next_xy(Dungeon *dungeon, IntPair to);
-        // A few too many parameters, but it'd be annoying to rework. Oh well.
-        void take_turn(Dungeon *dungeon, PC *pc, BinaryHeap<Character *> &turn_queue, Character ***character_map, Item ***item_map, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, uint32_t priority, game_result_t &result);
-        void die(game_result_t &result, Dungeon *dungeon, Character ***character_map, Item ***item_map);
+        MonsterIntent decide_turn(Dungeon *dungeon, PC *pc, uint32_t **pathfinding_tunnel, uint32_t **pathfinding_no_tunnel, const CongestionMap *congestion);
+        /**
+         * Carries out an intent from decide_turn: tunneling, picking up items, pushing
+         * other monsters aside, and attacking the PC. Only one monster can do this at a time.
+         *
+         * Params:
+         * - intent: What the monster decided to do
+         * - dungeon: Dungeon the monster's in
+         * - pc: The PC
+         * - character_map: Character map for the dungeon
+         * - item_map: Item map for the dungeon
+         * - result: Set if the PC dies
+         */
+        void resolve_turn(const MonsterIntent &intent, Dungeon *dungeon, PC *pc, Character ***character_map, ItemMapStack **item_map, game_result_t &result);
+        void die(game_result_t &result, Dungeon *dungeon, Character ***character_map, ItemMapStack **item_map);
         uint8_t next_color();
         uint8_t current_color();
-        CHARACTER_TYPE type() override;
-        int damage(int amount, game_result_t &result, Dungeon *dungeon, Item ***item_map, Character ***character_map) override;
+        /**
+         * Returns: The key this monster drops if it's the last one left, or null
+         */
+        ItemDefinition *get_key_drop();
+        /**
+         * Returns: Whether this monster is allowed to go dormant. Telepathic monsters always
+         *  know where the PC is, and ones heading for where they last saw it are still busy.
+         */
+        bool can_go_dormant();
+        /**
+         * Drops whatever this monster remembers about where the PC was.
+         */
+        void forget_pc();
+        /**
+         * Params:
+         * - dungeon: Dungeon the monster's in
+         * - pc: The PC
+         * - crowd: Whether crowd movement is on, which plans fresh every turn
+         * Returns: Whether this monster's next turn needs up to date pathfinding maps
+         */
+        bool needs_pathfinding(Dungeon *dungeon, PC *pc, bool crowd);
+        int damage(int amount, game_result_t &result, Dungeon *dungeon, ItemMapStack **item_map, Character ***character_map) override;
+        void save_state(SaveWriter &out) override;
+        void load_state(SaveReader &in) override;
+};
+
+/**
+ * Everything standing on one floor, with the fields floor-wide sweeps look at
+ * laid out in contiguous arrays by entity, so those sweeps don't have to visit
+ * every cell or chase a pointer per character. The characters themselves stay
+ * where they are; each one knows its entity and keeps its entry up to date as
+ * it moves, and leaves the store when it dies or is deleted.
+ *
+ * Entities are dense. Removing one moves the last entity into its place.
+ */
+class CharacterStore {
+    private:
+        std::vector<Character *> owners;
+        std::vector<CHARACTER_TYPE> kinds;
+        std::vector<IntPair> positions;
+        std::vector<uint8_t> speeds;
+
+    public:
+        CharacterStore() = default;
+        ~CharacterStore();
+        CharacterStore(const CharacterStore &) = delete;
+        CharacterStore &operator=(const CharacterStore &) = delete;
+
+        /**
+         * Puts a character on this floor, taking it out of whatever store it was in before.
+         *
+         * Params:
+         * - ch: Character to add
+         */
+        void add(Character *ch);
+
+        /**
+         * Takes a character off this floor. Does nothing if it isn't on it.
+         *
+         * Params:
+         * - ch: Character to remove
+         */
+        void remove(Character *ch);
+
+        /**
+         * Catches a character's entry up with where it is now.
+         *
+         * Params:
+         * - ch: Character that moved
+         */
+        void moved(Character *ch);
+
+        /**
+         * Returns: How many characters are on this floor
+         */
+        uint32_t size() const { return owners.size(); }
+        Character *owner(uint32_t entity) const { return owners[entity]; }
+        CHARACTER_TYPE kind(uint32_t entity) const { return kinds[entity]; }
+        IntPair position(uint32_t entity) const { return positions[entity]; }
+        uint8_t speed(uint32_t entity) const { return speeds[entity]; }
 };
 
 /**
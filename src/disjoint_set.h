@@ -0,0 +1,79 @@
+/**
+ * A union-find structure over the integers [0, size), used to track which
+ * rooms and cells are connected to each other.
+ */
+
+#ifndef DISJOINT_SET_H
+#define DISJOINT_SET_H
+
+#include <cstdint>
+#include <vector>
+
+class DisjointSet {
+    private:
+        std::vector<int> parent;
+        std::vector<uint8_t> rank;
+        int sets;
+
+    public:
+        /**
+         * Initializes a disjoint set where every element is in its own set.
+         *
+         * Params:
+         * - size: Number of elements
+         */
+        DisjointSet(int size) {
+            int i;
+            parent.resize(size);
+            rank.assign(size, 0);
+            for (i = 0; i < size; i++) parent[i] = i;
+            sets = size;
+        }
+
+        /**
+         * Finds the representative of the set an element is in.
+         *
+         * Params:
+         * - i: Element to look up
+         * Returns: The representative element
+         */
+        int find(int i) {
+            // Path halving: point every other node at its grandparent on the way up.
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        }
+
+        /**
+         * Merges the sets two elements are in.
+         *
+         * Params:
+         * - a: First element
+         * - b: Second element
+         * Returns: True if they were in different sets before this
+         */
+        bool merge(int a, int b) {
+            a = find(a);
+            b = find(b);
+            if (a == b) return false;
+            if (rank[a] < rank[b]) parent[a] = b;
+            else if (rank[a] > rank[b]) parent[b] = a;
+            else {
+                parent[b] = a;
+                rank[a]++;
+            }
+            sets--;
+            return true;
+        }
+
+        /**
+         * Returns: Number of separate sets remaining
+         */
+        int count() const {
+            return sets;
+        }
+};
+
+#endif
@@ -5,9 +5,10 @@
 #include "macros.h"
 #include <string.h>
 #include "logger.h"
-
-#define STONE_SEED_COUNT 10
-#define GAUSSIAN_CONVOLUTION_COUNT 2
+#include "noise.h"
+#include "disjoint_set.h"
+#include <algorithm>
+#include <map>
 
 #define ENSURE_INITIALIZED if (!is_initalized) throw dungeon_exception(__PRETTY_FUNCTION__, "dungeon is not initialized")
 
@@ -74,99 +75,185 @@ void Dungeon::fill() {
     is_initalized = true;
 }
 
-// The Gaussian values ripped from Assignment 1.01's solution code.
-int gaussian[5][5] = {
-    {  1,  4,  7,  4,  1 },
-    {  4, 16, 26, 16,  4 },
-    {  7, 26, 41, 26,  7 },
-    {  4, 16, 26, 16,  4 },
-    {  1,  4,  7,  4,  1 }
-};
+#define IS_PASSABLE(cell) ((cell).type != CELL_TYPE_STONE && (cell).type != CELL_TYPE_DECORATION && (cell).hardness != UINT8_MAX)
 
-// This function is partially based on 'smooth_hardness' provided in
-// the Assignment 1.01 solution code, Piazza post @80.
-// I might rewrite it before 1.03, but we'll see.
-// Update from 1.06: I didn't :)
-void Dungeon::fill_stone() {
-    uint8_t x, y, ix, iy;
-    QueueNode *head, *tail, *temp;
-    int i, step, s, t, p, q;
+const IntPair REPAIR_NEIGHBORS[] = {{0, 1}, {0, -1}, {1, 0}, {-1, 0}};
+
+void Dungeon::label_components(std::vector<int> &component, std::vector<int> &sizes) {
+    int x, y, i, root;
+    DisjointSet cells_sets(width * height);
 
+    // One pass joining every walkable cell to the ones above and to the left of it.
     for (x = 0; x < width; x++) {
         for (y = 0; y < height; y++) {
-            cells[x][y].type = CELL_TYPE_STONE;
-            cells[x][y].hardness = 0;
-            cells[x][y].attributes = 0;
+            if (!IS_PASSABLE(cells[x][y])) continue;
+            if (x > 0 && IS_PASSABLE(cells[x - 1][y])) cells_sets.merge(x * height + y, (x - 1) * height + y);
+            if (y > 0 && IS_PASSABLE(cells[x][y - 1])) cells_sets.merge(x * height + y, x * height + y - 1);
         }
     }
 
-    // Picks a random hardness and places it in a single random cell
-    // STONE_SEED_COUNT times, enqueuing them along the way.
-    step = 255 / STONE_SEED_COUNT - 1;
-    for (i = 0; i < STONE_SEED_COUNT; i++) {
-        // Since we've just initialized everything to 0 and we have an
-        // 80x21 grid, this can't fail. Though it can technically run
-        // forever if we're really unlucky. Oh well.
-        do {
-            x = rand() % width;
-            y = rand() % height;
-        } while (cells[x][y].hardness);
-
-        cells[x][y].hardness = (i == 0 ? 1 : i * step);
-        if (i == 0) {
-            head = new QueueNode;
-            tail = head;
+    // Then numbers the sets in the order they're first seen.
+    component.assign(width * height, -1);
+    sizes.clear();
+    for (i = 0; i < width * height; i++) {
+        if (!IS_PASSABLE(cells[i / height][i % height])) continue;
+        // Roots can come after the cells pointing at them, so the label is stored there.
+        root = cells_sets.find(i);
+        if (component[root] == -1) {
+            component[root] = sizes.size();
+            sizes.push_back(0);
         }
-        else {
-            tail->next = new QueueNode;
-            tail = tail->next;
+        component[i] = component[root];
+        sizes[component[i]]++;
+    }
+}
+
+ConnectivityReport Dungeon::check_connectivity() {
+    std::vector<int> component;
+    std::vector<int> sizes;
+    ConnectivityReport report;
+    int i, main;
+
+    label_components(component, sizes);
+    report.components = sizes.size();
+    if (report.components <= 1) return report;
+
+    main = std::max_element(sizes.begin(), sizes.end()) - sizes.begin();
+    for (i = 0; i < width * height; i++)
+        if (component[i] != -1 && component[i] != main)
+            report.unreachable.push_back(IntPair{i / height, i % height});
+    return report;
+}
+
+int Dungeon::repair_connectivity() {
+    // Same layout and 4-way movement as the pathfinding maps.
+    std::vector<int> component;
+    std::vector<int> sizes;
+    std::vector<int> from;
+    std::vector<int> queue;
+    std::vector<int> piece_at(width * height);
+    std::vector<int> taken_up;
+    // Each piece only gets moved once. If it's still in the way after that, it stays out.
+    std::vector<bool> moved(decoration_pieces.size(), false);
+    unsigned int head;
+    int x, y, x1, y1, i, j, c, main, target;
+    int repairs = 0;
+    bool split;
+
+    from.resize(width * height);
+    while (true) {
+        label_components(component, sizes);
+        if (sizes.size() <= 1) break;
+        main = std::max_element(sizes.begin(), sizes.end()) - sizes.begin();
+
+        std::fill(piece_at.begin(), piece_at.end(), -1);
+        for (i = 0; i < (int) decoration_pieces.size(); i++) {
+            if (!decoration_pieces[i].placed) continue;
+            for (const IntPair &cell : decoration_pieces[i].cells) piece_at[cell.x * height + cell.y] = i;
         }
-        tail->next = NULL;
-        tail->x = x;
-        tail->y = y;
-    }
-
-    // Diffuses values out until every cell is filled.
-    while (head) {
-        x = head->x;
-        y = head->y;
-        i = cells[x][y].hardness;
-
-        for (ix = x - 1; ix <= x + 1; ix++) {
-            for (iy = y - 1; iy <= y + 1; iy++) {
-                if (ix == x && iy == y) continue;
-                if (ix >= 0 && ix < width && iy >= 0 && iy < height
-                    && !cells[ix][iy].hardness) {
-                    cells[ix][iy].hardness = i;
-                    tail->next = new QueueNode;
-                    tail = tail->next;
-                    tail->next = NULL;
-                    tail->x = ix;
-                    tail->y = iy;
+
+        // Any furniture sitting between two patches gets taken up and put down somewhere
+        // else, which is usually all it takes.
+        taken_up.clear();
+        for (x = 0; x < width; x++) {
+            for (y = 0; y < height; y++) {
+                if (cells[x][y].type != CELL_TYPE_DECORATION || piece_at[x * height + y] == -1) continue;
+                c = -1;
+                split = false;
+                for (const IntPair &n : REPAIR_NEIGHBORS) {
+                    x1 = x + n.x;
+                    y1 = y + n.y;
+                    if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height) continue;
+                    j = component[x1 * height + y1];
+                    if (j == -1) continue;
+                    if (c == -1) c = j;
+                    else if (c != j) split = true;
                 }
+                if (!split || !decoration_pieces[piece_at[x * height + y]].placed) continue;
+                remove_decoration_piece(decoration_pieces[piece_at[x * height + y]]);
+                taken_up.push_back(piece_at[x * height + y]);
             }
         }
-        temp = head;
-        head = head->next;
-        delete temp;
-    }
 
-    // Applies a gaussian convolution to smooth it out.
-    for (i = 0; i < GAUSSIAN_CONVOLUTION_COUNT; i++) {
-        for (x = 0; x < width; x++) {
-            for (y = 0; y < height; y++) {
-                for (s = t = p = 0; p < 5; p++) {
-                    for (q = 0; q < 5; q++) {
-                        if (y + (p - 2) >= 0 && y + (p - 2) < height &&
-                            x + (q - 2) >= 0 && x + (q - 2) < width) {
-                            s += gaussian[p][q];
-                            t += cells[x + (q - 2)][y + (p - 2)].hardness * gaussian[p][q];
-                        }
-                    }
+        if (taken_up.empty()) {
+            // Then, digs the shortest way from the main patch to the nearest one it isn't
+            // connected to. Furniture in the way gets moved too.
+            std::fill(from.begin(), from.end(), -2);
+            queue.clear();
+            for (i = 0; i < width * height; i++) {
+                if (component[i] == main) {
+                    from[i] = -1;
+                    queue.push_back(i);
                 }
+            }
 
-                cells[x][y].hardness = t / s;
+            target = -1;
+            for (head = 0; head < queue.size() && target == -1; head++) {
+                x = queue[head] / height;
+                y = queue[head] % height;
+                for (const IntPair &n : REPAIR_NEIGHBORS) {
+                    x1 = x + n.x;
+                    y1 = y + n.y;
+                    if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height) continue;
+                    j = x1 * height + y1;
+                    if (from[j] != -2 || cells[x1][y1].attributes & CELL_ATTRIBUTE_IMMUTABLE
+                        || cells[x1][y1].hardness == UINT8_MAX) continue;
+                    from[j] = queue[head];
+                    if (component[j] != -1) {
+                        target = j;
+                        break;
+                    }
+                    queue.push_back(j);
+                }
             }
+            if (target == -1) throw dungeon_exception(__PRETTY_FUNCTION__, "floor can't be connected (walled off by immutable cells?)");
+
+            for (i = from[target]; from[i] != -1; i = from[i]) {
+                x = i / height;
+                y = i % height;
+                if (cells[x][y].type == CELL_TYPE_DECORATION && piece_at[i] != -1) {
+                    if (decoration_pieces[piece_at[i]].placed) {
+                        remove_decoration_piece(decoration_pieces[piece_at[i]]);
+                        taken_up.push_back(piece_at[i]);
+                    }
+                } else if (cells[x][y].type == CELL_TYPE_DECORATION) {
+                    // Not part of any piece, so there's nothing else to keep it in one piece with.
+                    cells[x][y].type = CELL_TYPE_ROOM;
+                    delete cells[x][y].decoration_texture;
+                    cells[x][y].decoration_texture = nullptr;
+                } else {
+                    cells[x][y].type = CELL_TYPE_HALL;
+                    cells[x][y].hardness = 0;
+                }
+            }
+        }
+
+        // Once everything in the way is up, what hasn't been moved yet gets put back down.
+        for (i = 0; i < (int) taken_up.size(); i++) {
+            if (moved[taken_up[i]]) continue;
+            moved[taken_up[i]] = true;
+            move_decoration_piece(decoration_pieces[taken_up[i]]);
+        }
+        repairs++;
+    }
+
+    // Digging might have gone through walls.
+    if (repairs) apply_walls();
+    return repairs;
+}
+
+void Dungeon::fill_stone() {
+    int x, y;
+    std::vector<uint8_t> hardness(width * height);
+    NoiseGenerator *generator = create_noise_generator(parse_noise_type(options->noise), options->noise_scale, options->noise_octaves);
+    generator->fill(hardness.data(), width, height);
+    delete generator;
+
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            cells[x][y].type = CELL_TYPE_STONE;
+            cells[x][y].hardness = hardness[y * width + x];
+            cells[x][y].attributes = 0;
         }
     }
 }
@@ -196,9 +283,10 @@ void Dungeon::create_rooms(int count, uint8_t min_width, uint8_t min_height, int
     int room_width, room_height;
 
     Logger::debug(__FILE__, "room count: " + std::to_string(count));
+    build_blocked_area();
     for (i = 0; i < count; i++) {
-        room_width = min_width + (rand() % size_randomness_max);
-        room_height = min_height + (rand() % size_randomness_max);
+        room_width = min_width + (rng_rand() % size_randomness_max);
+        room_height = min_height + (rng_rand() % size_randomness_max);
 
         try {
             rooms.push_back(create_room(room_width, room_height));
@@ -209,114 +297,227 @@ void Dungeon::create_rooms(int count, uint8_t min_width, uint8_t min_height, int
                 throw dungeon_exception(__PRETTY_FUNCTION__, e, "failed to create the minimum number of rooms (full?)");
         }
     }
+    // Nothing else places rooms, so the table would only go stale from here.
+    blocked_area.clear();
+    blocked_area.shrink_to_fit();
 }
 
-Room Dungeon::create_room(uint8_t room_width, uint8_t room_height) {
-    int x_offset = rand();
-    int y_offset = rand();
-    uint8_t ix, iy;
-    uint8_t x, y;
-    int16_t jx, jy;
-    int placed = 0;
+#define ROOM_PLACEMENT_GUESSES 16
+#define IS_BLOCKED(cell) ((cell).type != CELL_TYPE_STONE || (cell).attributes & CELL_ATTRIBUTE_IMMUTABLE)
 
+void Dungeon::build_blocked_area() {
+    int x, y;
+    int stride = height + 1;
+    blocked_area.assign((width + 1) * stride, 0);
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            blocked_area[(x + 1) * stride + y + 1] = IS_BLOCKED(cells[x][y])
+                + blocked_area[x * stride + y + 1]
+                + blocked_area[(x + 1) * stride + y]
+                - blocked_area[x * stride + y];
+        }
+    }
+}
+
+void Dungeon::block_area(int x0, int y0, int x1, int y1) {
+    int x, y;
+    int stride = height + 1;
+    // Every entry below and to the right of the corner covers part of the rectangle.
+    for (x = x0 + 1; x <= width; x++)
+        for (y = y0 + 1; y <= height; y++)
+            blocked_area[x * stride + y] += (MIN(x, x1 + 1) - x0) * (MIN(y, y1 + 1) - y0);
+}
+
+uint32_t Dungeon::blocked_in(int x0, int y0, int x1, int y1) {
+    int stride = height + 1;
+    return blocked_area[(x1 + 1) * stride + y1 + 1]
+        - blocked_area[x0 * stride + y1 + 1]
+        - blocked_area[(x1 + 1) * stride + y0]
+        + blocked_area[x0 * stride + y0];
+}
+
+Room Dungeon::create_room(uint8_t room_width, uint8_t room_height) {
+    // Rooms need a ring of clear stone around them, which also keeps them off the edge.
+    int x_count = width - room_width - 1;
+    int y_count = height - room_height - 1;
+    int x, y, i, choice;
+    int count = 0;
     Room room;
 
-    for (ix = 0; ix < width && !placed; ix++) {
-        x = (ix + x_offset) % width;
-        for (iy = 0; iy < height && !placed; iy++) {
-            y = (iy + y_offset) % height;
-
-            // Make sure the area is clear.
-            placed = 1;
-            for (jx = x - 1; jx < x + room_width + 1 && placed; jx++) {
-                for (jy = y - 1; jy < y + room_height + 1; jy++) {
-                    if (jx < 0 || jx >= width || jy < 0 || jy >= height
-                        || cells[jx][jy].type != CELL_TYPE_STONE
-                        || cells[jx][jy].attributes & CELL_ATTRIBUTE_IMMUTABLE) {
-                        placed = 0;
-                        break;
-                    }
-                }
+    if (x_count < 1 || y_count < 1) throw dungeon_exception(__PRETTY_FUNCTION__, "room does not fit in the dungeon");
+
+    // Most floors are still fairly empty, so random guesses usually land somewhere open.
+    // A guess that fits is uniform over the open spots, same as the full count below.
+    for (i = 0; i < ROOM_PLACEMENT_GUESSES; i++) {
+        x = 1 + rng_rand() % x_count;
+        y = 1 + rng_rand() % y_count;
+        if (!blocked_in(x - 1, y - 1, x + room_width, y + room_height)) {
+            count = 1;
+            break;
+        }
+    }
+
+    // Otherwise, counts every spot that works, then walks back through to a random one of them.
+    if (!count) {
+        for (x = 1; x <= x_count; x++)
+            for (y = 1; y <= y_count; y++)
+                if (!blocked_in(x - 1, y - 1, x + room_width, y + room_height)) count++;
+        if (count == 0) throw dungeon_exception(__PRETTY_FUNCTION__, "no space available to place room");
+
+        choice = rng_rand() % count;
+        for (x = 1; x <= x_count; x++) {
+            for (y = 1; y <= y_count; y++) {
+                if (!blocked_in(x - 1, y - 1, x + room_width, y + room_height) && choice-- == 0) break;
             }
+            if (y <= y_count) break;
+        }
+    }
+
+    room.x0 = x;
+    room.y0 = y;
+    room.x1 = x + room_width - 1;
+    room.y1 = y + room_height - 1;
+    for (x = room.x0; x <= room.x1; x++) {
+        for (y = room.y0; y <= room.y1; y++) {
+            cells[x][y].type = CELL_TYPE_ROOM;
+            cells[x][y].hardness = 0;
+        }
+    }
+    block_area(room.x0, room.y0, room.x1, room.y1);
+    return room;
+}
+
+// Each room starts out linked to this many of its nearest neighbors. Doubled until
+// the graph is connected, which only matters when the rooms are in far-off clusters.
+#define ROOM_GRAPH_NEIGHBORS 4
+
+class RoomEdge {
+    public:
+        uint32_t distance;
+        int a;
+        int b;
+
+        bool operator<(const RoomEdge &o) const {
+            if (distance != o.distance) return distance < o.distance;
+            if (a != o.a) return a < o.a;
+            return b < o.b;
+        }
+        bool operator==(const RoomEdge &o) const {
+            return a == o.a && b == o.b;
+        }
+};
+
+/**
+ * Links every room to its k nearest neighbors (by center), using a grid of buckets
+ * so that each lookup only visits the rooms around it.
+ *
+ * Params:
+ * - rooms: Rooms to link
+ * - width/height: Size of the dungeon
+ * - k: Neighbors per room
+ * Returns: Every edge, sorted by distance, without duplicates
+ */
+static std::vector<RoomEdge> nearest_room_edges(const std::vector<Room> &rooms, int width, int height, int k) {
+    int n = rooms.size();
+    // Sized so there's about one room per bucket.
+    int bucket_size = MAX(1, (int) sqrt((double) width * height / n));
+    int cols = width / bucket_size + 1;
+    int rows = height / bucket_size + 1;
+    std::vector<std::vector<int>> buckets(cols * rows);
+    std::vector<IntPair> centers(n);
+    std::vector<RoomEdge> edges;
+    std::vector<RoomEdge> nearest;
+    RoomEdge edge;
+    int i, r, bx, by, x, y, dx, dy;
+
+    for (i = 0; i < n; i++) {
+        centers[i] = IntPair((rooms[i].x0 + rooms[i].x1) / 2, (rooms[i].y0 + rooms[i].y1) / 2);
+        buckets[(centers[i].y / bucket_size) * cols + centers[i].x / bucket_size].push_back(i);
+    }
 
-            // Then, only place it if the area is open.
-            if (placed) {
-                room.x0 = x;
-                room.y0 = y;
-                room.x1 = x + room_width - 1;
-                room.y1 = y + room_height - 1;
-                for (jx = x; jx < x + room_width; jx++) {
-                    for (jy = y; jy < y + room_height; jy++) {
-                        cells[jx][jy].type = CELL_TYPE_ROOM;
-                        cells[jx][jy].hardness = 0;
+    for (i = 0; i < n; i++) {
+        bx = centers[i].x / bucket_size;
+        by = centers[i].y / bucket_size;
+        nearest.clear();
+        // Searches outward one ring of buckets at a time. Everything from ring r on is at
+        // least r - 1 buckets away, so once the k nearest are closer than that, we're done.
+        for (r = 0; r < MAX(cols, rows); r++) {
+            if (r > 0 && (int) nearest.size() == k
+                && nearest.back().distance <= (uint32_t) ((r - 1) * bucket_size) * ((r - 1) * bucket_size))
+                break;
+            for (y = by - r; y <= by + r; y++) {
+                if (y < 0 || y >= rows) continue;
+                // Only the edge of the ring -- the inside was covered already.
+                for (x = bx - r; x <= bx + r; x += (y == by - r || y == by + r) ? 1 : 2 * r) {
+                    if (x >= 0 && x < cols) {
+                        for (int j : buckets[y * cols + x]) {
+                            if (j == i) continue;
+                            dx = centers[i].x - centers[j].x;
+                            dy = centers[i].y - centers[j].y;
+                            edge.distance = dx * dx + dy * dy;
+                            edge.a = MIN(i, j);
+                            edge.b = MAX(i, j);
+                            if ((int) nearest.size() == k && !(edge < nearest.back())) continue;
+                            if ((int) nearest.size() == k) nearest.pop_back();
+                            nearest.insert(std::upper_bound(nearest.begin(), nearest.end(), edge), edge);
+                        }
                     }
+                    if (r == 0) break;
                 }
             }
         }
+        edges.insert(edges.end(), nearest.begin(), nearest.end());
     }
-    if (!placed) throw dungeon_exception(__PRETTY_FUNCTION__, "no space available to place room");
-    return room; 
+
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+    return edges;
 }
 
 void Dungeon::connect_rooms() {
-    // Each room will connect to its nearest room until every room is marked as visited.
-    unsigned int i;
-    int visited[rooms.size()];
-    for (i = 0; i < rooms.size(); i++) visited[i] = 0;
-    visited[0] = 1;
+    // Links the rooms with a minimum spanning tree over a nearest-neighbor graph,
+    // then maybe adds a few of the leftover edges back in as loops.
+    int n = rooms.size();
+    int k = ROOM_GRAPH_NEIGHBORS;
+    std::vector<RoomEdge> edges;
+    std::vector<RoomEdge> tree;
+    std::vector<RoomEdge> loops;
     Room *a;
     Room *b;
-    Room *current;
     uint8_t ax, bx, ay, by;
-    double distance, max_distance;
-    int done = 0;
-
-    while (!done) {
-        // Pick the first un-visited room.
-        for (i = 1; i < rooms.size(); i++)
-            if (!visited[i]) {
-                a = &rooms[i];
-                visited[i] = 1;
-                break;
-            }
 
-        // Find the nearest visited room.
-        b = NULL;
-        max_distance = INFINITY;
-        for (i = 0; i < rooms.size(); i++)
-            if (&rooms[i] != a && visited[i]) {
-                current = &rooms[i];
-                // Find the center points of each room.
-                ax = (a->x0 + a->x1) / 2;
-                ay = (a->y0 + a->y1) / 2;
-                bx = (current->x0 + current->x1) / 2;
-                by = (current->y0 + current->y1) / 2;
-                distance = pow(ax - bx, 2) + pow(ay - by, 2);
-
-                if (distance < max_distance) {
-                    b = &rooms[i];
-                    max_distance = distance;
-                    visited[i] = 1;
-                }
-            }
+    // Nothing to connect.
+    if (n < 2) return;
+
+    while (true) {
+        edges = nearest_room_edges(rooms, width, height, MIN(k, n - 1));
+        DisjointSet sets(n);
+        tree.clear();
+        loops.clear();
+        for (const RoomEdge &edge : edges) {
+            if (sets.merge(edge.a, edge.b)) tree.push_back(edge);
+            else loops.push_back(edge);
+        }
+        // With every room linked to every other one, this is always connected.
+        if (sets.count() == 1) break;
+        k *= 2;
+    }
 
-        // If there's only one room, we never get a b assigned.
-        // That means there's nothing to connect and we can exit.
-        if (b == NULL) return;
+    if (options)
+        for (const RoomEdge &edge : loops)
+            if (rng_rand() % 100 < options->loop_chance) tree.push_back(edge);
+
+    for (const RoomEdge &edge : tree) {
+        a = &rooms[edge.a];
+        b = &rooms[edge.b];
 
         // Connect a random point from each room.
-        ax = (a->x0 + (rand() % (a->x1 - a->x0)));
-        ay = (a->y0 + (rand() % (a->y1 - a->y0)));
-        bx = (b->x0 + (rand() % (b->x1 - b->x0)));
-        by = (b->y0 + (rand() % (b->y1 - b->y0)));
+        ax = (a->x0 + (rng_rand() % (a->x1 - a->x0)));
+        ay = (a->y0 + (rng_rand() % (a->y1 - a->y0)));
+        bx = (b->x0 + (rng_rand() % (b->x1 - b->x0)));
+        by = (b->y0 + (rng_rand() % (b->y1 - b->y0)));
 
         connect_points(ax, ay, bx, by);
-        done = 1;
-        for (i = 0; i < rooms.size(); i++)
-            if (!visited[i]) {
-                done = 0;
-                break;
-            }
     }
 }
 
@@ -335,7 +536,7 @@ void Dungeon::connect_points(uint8_t x0, uint8_t y0, uint8_t x1, uint8_t y1) {
     uint8_t x_poss, y_poss;
 
     while (x != x1 || y != y1) {
-        direction = rand() % 2;
+        direction = rng_rand() % 2;
 
         // We cannot place outside the map.
         x_poss = x + x_direction >= 0 && x + x_direction < width;
@@ -384,14 +585,14 @@ void Dungeon::place_staircases() {
         // We want to place these on the rightmost side of any room.
         // The spot must have stone above and below.
         // The spots to the right of it must not be out of bounds.
-        ro = rand();
+        ro = rng_rand();
         done = false;
         for (i = 0; !done && i < rooms.size(); i++) {
             room = &rooms[(i + ro) % rooms.size()];
             // Now, iterate over the entire right side to check for an open space.
             if (room->x1 + 2 >= width) continue;
             x = room->x1 + 1;
-            yo = rand();
+            yo = rng_rand();
             for (yi = 0; yi < (unsigned int) (room->y1 - room->y0 - 2); yi++) {
                 y = 1 + room->y0 + (yo + yi) % (room->y1 - room->y0);
                 // Screw it
@@ -409,12 +610,12 @@ void Dungeon::place_staircases() {
 
     // And again for down...
     if (options->down_staircase.length() > 0) {
-        ro = rand();
+        ro = rng_rand();
         for (i = 0; i < rooms.size(); i++) {
             room = &rooms[(i + ro) % rooms.size()];
             if ((int) room->x0 - 2 < 0) continue;
             x = room->x0 - 1;
-            yo = rand();
+            yo = rng_rand();
             for (yi = 0; yi < (unsigned int) (room->y1 - room->y0 - 2); yi++) {
                 y = 1 + room->y0 + (yo + yi) % (room->y1 - room->y0);
                 if (cells[x][y - 1].type == CELL_TYPE_STONE && cells[x][y].type == CELL_TYPE_STONE && cells[x][y + 1].type == CELL_TYPE_STONE &&
@@ -430,383 +631,405 @@ void Dungeon::place_staircases() {
 }
 
 IntPair Dungeon::place_in_room(Room *room, cell_type_t material) {
-    IntPair coords = random_location_in_room(room);
-    cells[coords.x][coords.y].type = material;
-    cells[coords.x][coords.y].hardness = 0;
-    return coords;
-}
-
-IntPair Dungeon::random_location_in_room(Room *room) {
-    uint8_t x_offset = rand();
-    uint8_t y_offset = rand();
-    uint8_t i, j, x, y;
-    uint8_t room_width = room->x1 - room->x0;
-    uint8_t room_height = room->y1 - room->y0;
+    std::optional<IntPair> coords = random_location_in_room(room);
+    if (!coords) throw dungeon_exception(__PRETTY_FUNCTION__, "couldn't find a location to place in");
+    cells[coords->x][coords->y].type = material;
+    cells[coords->x][coords->y].hardness = 0;
+    return *coords;
+}
+
+#define OBSTRUCTION(cell_type) (cell_type == CELL_TYPE_HALL || cell_type == CELL_TYPE_UP_STAIRCASE || cell_type == CELL_TYPE_DOWN_STAIRCASE || cell_type == CELL_TYPE_DECORATION)
+
+bool Dungeon::is_free_cell(int x, int y) {
+    if (cells[x][y].type != CELL_TYPE_ROOM) return false;
+    // We will additionally check that we aren't obstructing a hallway,
+    // since that may be annoying in the future.
+    if ((x - 1 >= 0 && cells[x - 1][y].type == CELL_TYPE_HALL)
+        || (y - 1 >= 0 && cells[x][y - 1].type == CELL_TYPE_HALL)
+        || (x + 1 < width && cells[x + 1][y].type == CELL_TYPE_HALL)
+        || (y + 1 < height && cells[x][y + 1].type == CELL_TYPE_HALL))
+        return false;
+    // And, we can't place in an immutable cell.
+    return !(cells[x][y].attributes & CELL_ATTRIBUTE_IMMUTABLE);
+}
+
+bool Dungeon::is_free_edge(int x, int y) {
+    // Rooms are never on the outside of the dungeon, so these are all in bounds.
+    return cells[x][y].type == CELL_TYPE_ROOM
+        && !OBSTRUCTION(cells[x + 1][y].type)
+        && !OBSTRUCTION(cells[x + 1][y + 1].type)
+        && !OBSTRUCTION(cells[x][y + 1].type);
+}
+
+void Dungeon::index_room(Room *room) {
+    int x, y;
+    if (room->indexed) return;
+    room->indexed = true;
+
+    for (x = room->x0; x < room->x1; x++)
+        for (y = room->y0; y < room->y1; y++)
+            if (is_free_cell(x, y)) room->free_cells.push_back(IntPair{x, y});
+
+    for (x = room->x0; x <= room->x1; x++) {
+        if (is_free_edge(x, room->y0)) room->edge_cells.push_back(IntPair{x, room->y0});
+        if (is_free_edge(x, room->y1)) room->edge_cells.push_back(IntPair{x, room->y1});
+    }
+    for (y = room->y0 + 1; y < room->y1; y++) {
+        if (is_free_edge(room->x0, y)) room->edge_cells.push_back(IntPair{room->x0, y});
+        if (is_free_edge(room->x1, y)) room->edge_cells.push_back(IntPair{room->x1, y});
+    }
+}
+
+void Dungeon::unindex_room(Room *room) {
+    room->indexed = false;
+    room->free_cells.clear();
+    room->edge_cells.clear();
+}
+
+void Dungeon::start_decoration_piece(Room *room) {
+    decoration_pieces.emplace_back();
+    decoration_pieces.back().room = room - rooms.data();
+}
+
+void Dungeon::decorate(IntPair coords, const std::string &texture) {
+    Cell *cell = &cells[coords.x][coords.y];
+    if (decoration_pieces.empty()) throw dungeon_exception(__PRETTY_FUNCTION__, "no decoration piece has been started");
+    cell->type = CELL_TYPE_DECORATION;
+    if (cell->decoration_texture) delete cell->decoration_texture;
+    cell->decoration_texture = new std::string(texture);
+    decoration_pieces.back().cells.push_back(coords);
+    decoration_pieces.back().textures.push_back(texture);
+}
+
+void Dungeon::remove_decoration_piece(DecorationPiece &piece) {
+    for (const IntPair &coords : piece.cells) {
+        Cell *cell = &cells[coords.x][coords.y];
+        if (cell->type != CELL_TYPE_DECORATION) continue;
+        cell->type = CELL_TYPE_ROOM;
+        delete cell->decoration_texture;
+        cell->decoration_texture = nullptr;
+    }
+    piece.placed = false;
+    // Those cells are free again, which the room's indexes don't expect.
+    unindex_room(&rooms[piece.room]);
+}
+
+bool Dungeon::move_decoration_piece(DecorationPiece &piece) {
+    IntPair low = piece.cells[0], high = piece.cells[0];
+    std::optional<IntPair> origin;
+    unsigned int i;
+    for (const IntPair &coords : piece.cells) {
+        low = IntPair(MIN(low.x, coords.x), MIN(low.y, coords.y));
+        high = IntPair(MAX(high.x, coords.x), MAX(high.y, coords.y));
+    }
+    origin = random_area_in_room(&rooms[piece.room], high.x - low.x + 1, high.y - low.y + 1);
+    if (!origin) return false;
+
+    for (i = 0; i < piece.cells.size(); i++) {
+        piece.cells[i] = IntPair(origin->x + piece.cells[i].x - low.x, origin->y + piece.cells[i].y - low.y);
+        Cell *cell = &cells[piece.cells[i].x][piece.cells[i].y];
+        cell->type = CELL_TYPE_DECORATION;
+        if (cell->decoration_texture) delete cell->decoration_texture;
+        cell->decoration_texture = new std::string(piece.textures[i]);
+    }
+    piece.placed = true;
+    return true;
+}
+
+std::optional<IntPair> Dungeon::pick_from_index(std::vector<IntPair> &index, bool (Dungeon::*check)(int, int)) {
+    unsigned int i;
     IntPair coords;
-    for (i = 0; i < room_width; i++) {
-        x = room->x0 + (x_offset + i) % room_width;
-        for (j = 0; j < room_height; j++) {
-            y = room->y0 + (y_offset + j) % room_height;
-
-            if (cells[x][y].type == CELL_TYPE_ROOM) {
-                // We will additionally check that we aren't obstructing a hallway,
-                // since that may be annoying in the future.
-                if ((x - 1 >= 0 && cells[x - 1][y].type == CELL_TYPE_HALL) \
-                    || (y - 1 >= 0 && cells[x][y - 1].type == CELL_TYPE_HALL) \
-                    || (x + 1 < width && cells[x + 1][y].type == CELL_TYPE_HALL) \
-                    || (y + 1 < height && cells[x][y + 1].type == CELL_TYPE_HALL)) {
-                        continue;
-                    }
+    // Nothing that's been placed is taken back out without re-indexing the room (see
+    // remove_decoration_piece), so a cell that fails the check once will never pass it
+    // again. Those get swapped out to the end and dropped.
+    while (!index.empty()) {
+        i = rng_rand() % index.size();
+        coords = index[i];
+        if ((this->*check)(coords.x, coords.y)) return coords;
+        index[i] = index.back();
+        index.pop_back();
+    }
+    return std::nullopt;
+}
+
+int Dungeon::room_at(IntPair coords) {
+    int i;
+    for (i = 0; i < (int) rooms.size(); i++) {
+        if (coords.x >= rooms[i].x0 && coords.x <= rooms[i].x1 && coords.y >= rooms[i].y0 && coords.y <= rooms[i].y1) return i;
+    }
+    return -1;
+}
 
-                // And, we can't place in an immutable cell.
-                if (cells[x][y].attributes & CELL_ATTRIBUTE_IMMUTABLE) continue;
+std::vector<std::vector<int>> Dungeon::room_graph() {
+    std::vector<std::vector<int>> graph(rooms.size());
+    std::vector<int> room(width * height, -1);
+    std::map<int, std::vector<int>> by_hallway;
+    DisjointSet hallways(width * height);
+    int x, y, x1, y1, i, j, a, b;
 
-                coords.x = x;
-                coords.y = y;
-                return coords;
+    for (i = 0; i < (int) rooms.size(); i++) {
+        for (x = rooms[i].x0; x <= rooms[i].x1; x++)
+            for (y = rooms[i].y0; y <= rooms[i].y1; y++) room[x * height + y] = i;
+    }
+
+    // Hallways get joined up into runs the same way label_components does it, just without the rooms.
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            if (!IS_PASSABLE(cells[x][y]) || room[x * height + y] != -1) continue;
+            if (x > 0 && IS_PASSABLE(cells[x - 1][y]) && room[(x - 1) * height + y] == -1) hallways.merge(x * height + y, (x - 1) * height + y);
+            if (y > 0 && IS_PASSABLE(cells[x][y - 1]) && room[x * height + y - 1] == -1) hallways.merge(x * height + y, x * height + y - 1);
+        }
+    }
+
+    // Then each room is linked to every run it opens onto, and to any room right up against it.
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            a = room[x * height + y];
+            if (a == -1 || !IS_PASSABLE(cells[x][y])) continue;
+            for (const IntPair &n : REPAIR_NEIGHBORS) {
+                x1 = x + n.x;
+                y1 = y + n.y;
+                if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height || !IS_PASSABLE(cells[x1][y1])) continue;
+                b = room[x1 * height + y1];
+                if (b == -1) {
+                    by_hallway[hallways.find(x1 * height + y1)].push_back(a);
+                } else if (b != a) {
+                    graph[a].push_back(b);
+                    graph[b].push_back(a);
+                }
             }
         }
     }
+    for (auto &hallway : by_hallway) {
+        std::vector<int> &ends = hallway.second;
+        std::sort(ends.begin(), ends.end());
+        ends.erase(std::unique(ends.begin(), ends.end()), ends.end());
+        for (i = 0; i < (int) ends.size(); i++) {
+            for (j = 0; j < (int) ends.size(); j++) {
+                if (i != j) graph[ends[i]].push_back(ends[j]);
+            }
+        }
+    }
+    for (std::vector<int> &neighbours : graph) {
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    }
+    return graph;
+}
 
-    throw dungeon_exception(__PRETTY_FUNCTION__, "couldn't find a location to place in");
+std::optional<IntPair> Dungeon::random_location_in_room(Room *room) {
+    index_room(room);
+    return pick_from_index(room->free_cells, &Dungeon::is_free_cell);
 }
 
-IntPair Dungeon::random_location() {
-    int room_offset = rand();
+std::optional<IntPair> Dungeon::random_location() {
+    int room_offset = rng_rand();
     unsigned int i;
-    Room *room;
+    std::optional<IntPair> coords;
 
     for (i = 0; i < rooms.size(); i++) {
-        room = &rooms[(i + room_offset) % rooms.size()];
-        try {
-            return random_location_in_room(room);
-        } catch (dungeon_exception &e) {}
+        coords = random_location_in_room(&rooms[(i + room_offset) % rooms.size()]);
+        if (coords) return coords;
     }
-    throw dungeon_exception(__PRETTY_FUNCTION__, "no available space in dungeon");
+    return std::nullopt;
 }
 
-
-IntPair Dungeon::random_area_in_room(Room *room, int width, int height) {
-    // Same algorithm as usual -- we'll iterate over the room's area from a random starting point,
-    // but now check that the entire area is clear.
-    // This could be made more efficient, but world gen happens only once, so I'm not too worried.
-    unsigned int x, y, xi, yi, xj, yj, xo, yo;
-    xo = rand();
-    yo = rand();
+std::optional<IntPair> Dungeon::random_area_in_room(Room *room, int width, int height) {
+    // The top left corner of a clear area is always a free cell, so we only have to
+    // check those, starting from a random one.
+    unsigned int i, o, x, y, xj, yj;
     unsigned int room_width = room->x1 - room->x0;
     unsigned int room_height = room->y1 - room->y0;
     bool valid;
 
-    for (xi = 0; xi < room_width - width; xi++) {
-        x = room->x0 + (xo + xi) % (room_width - width);
-        for (yi = 0; yi < room_height - height; yi++) {
-            y = room->y0 + (yo + yi) % (room_height - height);
-
-            valid = true;
-            for (xj = x - 1; valid && xj < x + width + 1; xj++) {
-                for (yj = y - 1; yj < y + height + 1; yj++) {
-                    // If this area's within the room, we just want to make sure it's empty.
-                    // Outside, we can't have any hallways.
-                    if (xj < x || xj > x + width || yj < y || yj > y + height) {
-                        // We don't care about corners, we'd never be able to obstruct that way.
-                        if (xj == x - 1 && (yj == y - 1 || yj == y + height)) {
-                            continue;
-                        }
-                        if (yj == y - 1 && (xj == x - 1 || xj == x + width)) {
-                            continue;
-                        }
-                        if (cells[xj][yj].type == CELL_TYPE_HALL) {
-                            valid = false;
-                            break;
-                        }
-                    } else {
-                        // Inside room -- needs to be CELL_TYPE_ROOM
-                        if (cells[xj][yj].type != CELL_TYPE_ROOM) {
-                            valid = false;
-                            break;
-                        }
+    if ((unsigned int) width >= room_width || (unsigned int) height >= room_height) return std::nullopt;
+    index_room(room);
+    o = rng_rand();
+
+    for (i = 0; i < room->free_cells.size(); i++) {
+        x = room->free_cells[(o + i) % room->free_cells.size()].x;
+        y = room->free_cells[(o + i) % room->free_cells.size()].y;
+        if (x - room->x0 >= room_width - width || y - room->y0 >= room_height - height) continue;
+
+        valid = true;
+        for (xj = x - 1; valid && xj < x + width + 1; xj++) {
+            for (yj = y - 1; yj < y + height + 1; yj++) {
+                // If this area's within the room, we just want to make sure it's empty.
+                // Outside, we can't have any hallways.
+                if (xj < x || xj > x + width || yj < y || yj > y + height) {
+                    // We don't care about corners, we'd never be able to obstruct that way.
+                    if (xj == x - 1 && (yj == y - 1 || yj == y + height)) {
+                        continue;
+                    }
+                    if (yj == y - 1 && (xj == x - 1 || xj == x + width)) {
+                        continue;
+                    }
+                    if (cells[xj][yj].type == CELL_TYPE_HALL) {
+                        valid = false;
+                        break;
+                    }
+                } else {
+                    // Inside room -- needs to be CELL_TYPE_ROOM
+                    if (cells[xj][yj].type != CELL_TYPE_ROOM) {
+                        valid = false;
+                        break;
                     }
                 }
             }
-            if (valid) return IntPair{(int) x, (int) y};
         }
+        if (valid) return IntPair{(int) x, (int) y};
     }
-    throw dungeon_exception(__PRETTY_FUNCTION__, "no suitable area in room for " + std::to_string(width) + "x" + std::to_string(height) + " area");
+    return std::nullopt;
 }
 
-#define OBSTRUCTION(cell_type) (cell_type == CELL_TYPE_HALL || cell_type == CELL_TYPE_UP_STAIRCASE || cell_type == CELL_TYPE_DOWN_STAIRCASE || cell_type == CELL_TYPE_DECORATION)
-
-IntPair Dungeon::random_location_along_edge(Room *room) {
-    unsigned int x, y;
+std::optional<IntPair> Dungeon::random_location_along_edge(Room *room) {
+    index_room(room);
+    return pick_from_index(room->edge_cells, &Dungeon::is_free_edge);
+}
 
-    // I don't love pushing all these to a vector, but I'm not sure of a good way
-    // to check everything while starting randomly without this becoming a mess otherwise.
-    std::vector<IntPair> edge;
-    for (x = room->x0; x <= room->x1; x++) {
-        if (cells[x][room->y0].type == CELL_TYPE_ROOM)
-            edge.push_back(IntPair{(int) x, (int) room->y0});
-        if (cells[x][room->y1].type == CELL_TYPE_ROOM)
-            edge.push_back(IntPair{(int) x, (int) room->y1});
-    }
-    for (y = room->y0 + 1; y <= (unsigned int) (room->y1 - 1); y++) {
-        if (cells[room->x0][y].type == CELL_TYPE_ROOM)
-            edge.push_back(IntPair{(int) room->x0, (int) y});
-        if (cells[room->x1][y].type == CELL_TYPE_ROOM)
-            edge.push_back(IntPair{(int) room->x1, (int) y});
-    }
-
-    int o = rand();
-    unsigned int i, j;
-    for (i = 0; i < edge.size(); i++) {
-        j = (i + o) % edge.size();
-        x = edge[j].x;
-        y = edge[j].y;
-        
-        if (OBSTRUCTION(cells[x + 1][y].type)) continue;
-        if (OBSTRUCTION(cells[x + 1][y + 1].type)) continue;
-        if (OBSTRUCTION(cells[x][y].type)) continue;
-        if (OBSTRUCTION(cells[x][y + 1].type)) continue;
-        return edge[j];
-    }
-
-    throw dungeon_exception(__PRETTY_FUNCTION__, "no suitable locations along edge of room");
-}
-
-const std::vector<WallTileIdentifier> WALL_TILES = {
-    WallTileIdentifier(WALL_TYPE_SINGLE, {{1, 0}, {-1, 0}, {0, -1}, {0, 1}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_QUAD, {}, {{0, -1}, {0, 1}, {1, 0}, {-1, 0}}, {}),
-    WallTileIdentifier(WALL_TYPE_ENDL, {{0, -1}, {1, 0}, {0, 1}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_ENDR, {{0, -1}, {-1, 0}, {0, 1}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_ENDB, {{-1, 0}, {0, -1}, {1, 0}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_ENDT, {{-1, 0}, {0, 1}, {1, 0}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_T_L_L, {}, {{0, -1}, {-1, 0}, {0, 1}},    {}), // {{1, -1}}),
-    WallTileIdentifier(WALL_TYPE_T_L_R, {}, {{0, -1}, {1, 0}, {0, 1}},  {}), // {{-1, -1}}),
-    WallTileIdentifier(WALL_TYPE_T_B_T, {}, {{-1, 0}, {0, -1}, {1, 0}},  {}), // {{1, -1}}),
-    WallTileIdentifier(WALL_TYPE_T_B_B, {}, {{-1, 0}, {0, 1}, {1, 0}},   {}), // {{1, 1}}),
-    WallTileIdentifier(WALL_TYPE_TL, {{-1, 0}, {0, -1}}, {{0, 1}, {1, 0}}, {}),
-    WallTileIdentifier(WALL_TYPE_TR, {{0, -1}, {1, 0}}, {{-1, 0}, {0, 1}}, {}),
-    WallTileIdentifier(WALL_TYPE_BL, {{-1, 0}, {0, 1}}, {{0, -1}, {1, 0}}, {}),
-    WallTileIdentifier(WALL_TYPE_BR, {{0, 1}, {1, 0}}, {{-1, 0}, {0, -1}}, {}),
-    WallTileIdentifier(WALL_TYPE_TL, {}, {{1, 0}, {0, 1}}, {}),
-    WallTileIdentifier(WALL_TYPE_TR, {}, {{-1, 0}, {0, 1}}, {}),
-    WallTileIdentifier(WALL_TYPE_BL, {}, {{1, 0}, {0, -1}}, {}),
-    WallTileIdentifier(WALL_TYPE_BR, {}, {{-1, 0}, {0, -1}}, {}),
-    WallTileIdentifier(WALL_TYPE_L, {{1, 0}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_R, {{-1, 0}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_T, {{0, 1}}, {}, {}),
-    WallTileIdentifier(WALL_TYPE_B, {{0, -1}}, {}, {})
+#define N (1 << WALL_SIDE_N)
+#define E (1 << WALL_SIDE_E)
+#define S (1 << WALL_SIDE_S)
+#define W (1 << WALL_SIDE_W)
+constexpr WallTileIdentifier WALL_TILES[] = {
+    {WALL_TYPE_SINGLE, E | W | N | S, 0},
+    {WALL_TYPE_QUAD, 0, N | S | E | W},
+    {WALL_TYPE_ENDL, N | E | S, 0},
+    {WALL_TYPE_ENDR, N | W | S, 0},
+    {WALL_TYPE_ENDB, W | N | E, 0},
+    {WALL_TYPE_ENDT, W | S | E, 0},
+    {WALL_TYPE_T_L_L, 0, N | W | S},
+    {WALL_TYPE_T_L_R, 0, N | E | S},
+    {WALL_TYPE_T_B_T, 0, W | N | E},
+    {WALL_TYPE_T_B_B, 0, W | S | E},
+    {WALL_TYPE_TL, W | N, S | E},
+    {WALL_TYPE_TR, N | E, W | S},
+    {WALL_TYPE_BL, W | S, N | E},
+    {WALL_TYPE_BR, S | E, W | N},
+    {WALL_TYPE_TL, 0, E | S},
+    {WALL_TYPE_TR, 0, W | S},
+    {WALL_TYPE_BL, 0, E | N},
+    {WALL_TYPE_BR, 0, W | N},
+    {WALL_TYPE_L, E, 0},
+    {WALL_TYPE_R, W, 0},
+    {WALL_TYPE_T, S, 0},
+    {WALL_TYPE_B, N, 0}
 };
-
-void Dungeon::apply_walls() {
-    // This could be made more efficient, but it's rarely called and I'm running out of time to
-    // finish this game. :)
-    unsigned int x, y;
-    int x1, y1;
-    bool set;
-    for (x = 0; x < width; x++) {
-        for (y = 0; y < height; y++) {
-            // If there's a non-stone cell within 1 cell of here, this is going to be a wall.
-            // We need to know that to identify T-type walls.
-            cells[x][y].attributes &= ~CELL_ATTRIBUTE_WALL;
-            cells[x][y].wall_type = WALL_TYPE_NONE;
-            if (IS_FLOOR(cells[x][y].type)) {
-                continue;
-            }
-            set = false;
-            for (x1 = x - 1; !set && x1 <= (int) x + 1; x1++) {
-                for (y1 = y - 1; y1 <= (int) y + 1; y1++) {
-                    if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height) continue;
-                    if (IS_FLOOR(cells[x1][y1].type)) {
-                        cells[x][y].attributes |= CELL_ATTRIBUTE_WALL;
-                        set = true;
+#undef N
+#undef E
+#undef S
+#undef W
+
+class WallTileTable {
+    public:
+        wall_type_t types[WALL_SIGNATURES];
+
+        // Runs every signature through WALL_TILES once, so the first matching
+        // identifier is baked in and the priority order above is kept.
+        constexpr WallTileTable() : types() {
+            for (int signature = 0; signature < WALL_SIGNATURES; signature++) {
+                types[signature] = WALL_TYPE_NONE;
+                for (const WallTileIdentifier &ident : WALL_TILES) {
+                    if (ident.applies(signature)) {
+                        types[signature] = ident.type;
                         break;
                     }
                 }
             }
         }
-    }
+};
 
-    for (x = 0; x < width; x++) {
-        for (y = 0; y < height; y++) {
-            if (cells[x][y].type == CELL_TYPE_STONE && cells[x][y].attributes & CELL_ATTRIBUTE_WALL) {
-                // Candidate!
-                for (const WallTileIdentifier &ident : WALL_TILES) {
-                    if (ident.applies(this, IntPair(x, y))) {
-                        cells[x][y].wall_type = ident.type;
-                        break;
-                    }
-                }
+constexpr WallTileTable WALL_TILE_TABLE;
+
+void Dungeon::update_wall_attribute(int x, int y) {
+    // If there's a non-stone cell within 1 cell of here, this is going to be a wall.
+    // We need to know that to identify T-type walls.
+    int x1, y1;
+    cells[x][y].attributes &= ~CELL_ATTRIBUTE_WALL;
+    if (IS_FLOOR(cells[x][y].type)) return;
+    for (x1 = x - 1; x1 <= x + 1; x1++) {
+        for (y1 = y - 1; y1 <= y + 1; y1++) {
+            if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height) continue;
+            if (IS_FLOOR(cells[x1][y1].type)) {
+                cells[x][y].attributes |= CELL_ATTRIBUTE_WALL;
+                return;
             }
         }
     }
 }
 
+wall_neighbor_t Dungeon::wall_neighbor(int x, int y) {
+    if (x < 0 || x >= width || y < 0 || y >= height) return WALL_NEIGHBOR_OTHER;
+    if (IS_FLOOR(cells[x][y].type)) return WALL_NEIGHBOR_FLOOR;
+    if (cells[x][y].attributes & CELL_ATTRIBUTE_WALL) return WALL_NEIGHBOR_WALL;
+    return WALL_NEIGHBOR_OTHER;
+}
 
-/**
- * The current file format can't work with this new dungeon format.
- * We use dynamic sizing -- the dungeons have arbitrary dimensions, and this file format requires 80x21.
- * To re-implement, we'll need to make a new format.
- */
-// void Dungeon::fill_from_file(FILE *f, int debug, IntPair *pc_coords) {
-//     size_t size;
-//     uint32_t version, file_size;
-//     uint8_t hardness, x, y, x0, y0;
-//     uint16_t down_staircase_count, up_staircase_count;
-//     int i;
-//     int header_size = strlen(FILE_HEADER);
-//     char header[header_size + 1];
-
-//     size = fread(header, sizeof (*header), header_size, f);
-//     if (size != strlen(FILE_HEADER)) throw dungeon_exception(__PRETTY_FUNCTION__, "the specified file is not an RLG327 file (file ended too early)");
-//     header[header_size] = 0; // ensures null byte to terminate
-//     Logger::debug(__FILE__, "file header: " + std::string(header));
-//     if (strcmp(FILE_HEADER, header)) throw dungeon_exception(__PRETTY_FUNCTION__, "the specified file is not an RLG327 file (header mismatch)");
-
-//     READ_UINT32(version, "version", f, debug);
-//     if (version != 0) throw dungeon_exception(__PRETTY_FUNCTION__, "this program is incompatible with the provided file's version");
-
-//     READ_UINT32(file_size, "file size", f, debug);
-
-//     READ_UINT8(pc_coords->x, "pc x", f, debug);
-//     READ_UINT8(pc_coords->y, "pc y", f, debug);
-
-//     // An unfortunate consequence of the room count being stored after this is
-//     // that we need the room count to initialize the dungeon. This isn't ideal,
-//     // but will work.
-//     if (fseek(f, FILE_ROOM_COUNT_OFFSET, SEEK_SET)) dungeon_exception(__PRETTY_FUNCTION__, "unexpected error while reading file (could not seek to room count)");
-
-//     uint16_t room_count;
-//     READ_UINT16(room_count, "room count", f, debug);
-
-//     if (fseek(f, FILE_MATRIX_OFFSET, SEEK_SET)) throw dungeon_exception(__PRETTY_FUNCTION__, "unexpected error while reading file (could not seek to dungeon matrix)");
-//     for (y = 0; y < DUNGEON_HEIGHT; y++) {
-//         for (x = 0; x < DUNGEON_WIDTH; x++) {
-//             READ_UINT8(hardness, "cell matrix", f, debug);
-//             cells[x][y].hardness = hardness;
-//             cells[x][y].type = hardness == 0 ? CELL_TYPE_HALL : CELL_TYPE_STONE;
-//         }
-//     }
-//     if (fseek(f, FILE_ROOM_COUNT_OFFSET + sizeof (room_count), SEEK_SET)) throw dungeon_exception(__PRETTY_FUNCTION__, "unexpected error while reading file (could not seek past room count)");
-
-//     for (i = 0; i < room_count; i++) {
-//         Logger::debug(__FILE__, "reading room " + std::to_string(i));
-//         READ_UINT8(x0, "room x0", f, debug);
-//         READ_UINT8(y0, "room y0", f, debug);
-//         READ_UINT8(width, "room width", f, debug);
-//         READ_UINT8(height, "room height", f, debug);
-
-//         Room room;
-//         room.x0 = x0;
-//         room.y0 = y0;
-//         room.x1 = x0 + width - 1;
-//         room.y1 = y0 + height - 1;
-
-//         for (x = room.x0; x <= room.x1; x++)
-//             for (y = room.y0; y<= room.y1; y++)
-//                 cells[x][y].type = CELL_TYPE_ROOM;
-
-//         rooms.push_back(room);
-//     }
-
-//     READ_UINT16(up_staircase_count, "up staircase count", f, debug);
-//     for (i = 0; i < up_staircase_count; i++) {
-//         Logger::debug(__FILE__, "reading up staircase " + std::to_string(i));
-//         READ_UINT8(x, "up staircase x", f, debug);
-//         READ_UINT8(y, "up staircase y", f, debug);
-
-//         cells[x][y].type = CELL_TYPE_UP_STAIRCASE;
-//     }
-//     READ_UINT16(down_staircase_count, "down staircase count", f, debug);
-//     for (i = 0; i < down_staircase_count; i++) {
-//         Logger::debug(__FILE__, "reading down staircase " + std::to_string(i));
-//         READ_UINT8(x, "down staircase x", f, debug);
-//         READ_UINT8(y, "down staircase y", f, debug);
-//         cells[x][y].type = CELL_TYPE_DOWN_STAIRCASE;
-//     }
-
-//     is_initalized = true;
-// }
-// void Dungeon::save_to_file(FILE *f, int debug, IntPair *pc_coords) {
-//     ENSURE_INITIALIZED;
-//     uint32_t version, file_size;
-//     uint8_t width, height;
-//     int up_count, down_count, x, y;
-//     IntPair *up, *down;
-//     char header[] = FILE_HEADER;
-//     int header_size = strlen(header);
-//     size_t size = fwrite(header, sizeof (*header), header_size, f);
-
-//     if (size != (size_t) header_size) throw dungeon_exception(__PRETTY_FUNCTION__, "could not write to file");
-//     Logger::debug(__FILE__, "header = " + std::string(header) + ", wrote " + std::to_string(sizeof (*header) * header_size) + " bytes");
-
-//     version = FILE_VERSION;
-//     WRITE_UINT32(version, "version", f, debug);
-
-//     // File size calculation:
-//     // 1708 + r * 4 + u * 2 + d * 2
-//     up_count = 0;
-//     down_count = 0;
-//     up = NULL;
-//     down = NULL;
-//     for (x = 0; x < DUNGEON_WIDTH; x++) {
-//         for (y = 0; y < DUNGEON_HEIGHT; y++) {
-//             if (cells[x][y].type == CELL_TYPE_UP_STAIRCASE) {
-//                 up_count++;
-//                 if (up == NULL)
-//                     up = (IntPair *) malloc(sizeof (*up));
-//                 else
-//                     up = (IntPair *) realloc(up, up_count * sizeof (*up));
-//                 up[up_count - 1].x = x;
-//                 up[up_count - 1].y = y;
-//             }
-//             else if (cells[x][y].type == CELL_TYPE_DOWN_STAIRCASE) {
-//                 down_count++;
-//                 if (down == NULL)
-//                     down = (IntPair *) malloc(sizeof (*down));
-//                 else
-//                     down = (IntPair *) realloc(down, down_count * sizeof (*down));
-//                 down[down_count - 1].x = x;
-//                 down[down_count - 1].y = y;
-//             }
-//         }
-//     }
-//     file_size = 1708 + rooms.size() * 4 + up_count * 2 + down_count * 2;
-//     WRITE_UINT32(file_size, "file size", f, debug);
-
-//     WRITE_UINT8(pc_coords->x, "pc x", f, debug);
-//     WRITE_UINT8(pc_coords->y, "pc y", f, debug);
-
-//     for (y = 0; y < DUNGEON_HEIGHT; y++) {
-//         for (x = 0; x < DUNGEON_WIDTH; x++) {
-//             WRITE_UINT8((cells[x][y].hardness), "cell matrix", f, debug);
-//         }
-//     }
-
-//     WRITE_UINT16(rooms.size(), "room count", f, debug);
-//     int i;
-//     for (i = 0; i < (int) rooms.size(); i++) {
-//         Logger::debug(__FILE__, "writing room " + std::to_string(i));
-//         WRITE_UINT8((rooms[i].x0), "room x0", f, debug);
-//         WRITE_UINT8((rooms[i].y0), "room y0", f, debug);
-//         width = rooms[i].x1 - rooms[i].x0 + 1;
-//         height = rooms[i].y1 - rooms[i].y0 + 1;
-//         WRITE_UINT8(width, "room width", f, debug);
-//         WRITE_UINT8(height, "room height", f, debug);
-//     }
-
-//     WRITE_UINT16(up_count, "up staircase count", f, debug);
-//     for (i = 0; i < up_count; i++) {
-//         Logger::debug(__FILE__, "writing up staircase " + std::to_string(i));
-//         WRITE_UINT8((up[i].x), "up staircase x", f, debug);
-//         WRITE_UINT8((up[i].y), "up staircase y", f, debug);
-//     }
-//     WRITE_UINT16(down_count, "down staircase count", f, debug);
-//     for (i = 0; i < down_count; i++) {
-//         Logger::debug(__FILE__, "writing down staircase " + std::to_string(i));
-//         WRITE_UINT8((down[i].x), "down staircase x", f, debug);
-//         WRITE_UINT8((down[i].y), "down staircase y", f, debug);
-//     }
-
-//     free(up);
-//     free(down);
-// }
+void Dungeon::update_wall_type(int x, int y) {
+    uint8_t signature;
+    cells[x][y].wall_type = WALL_TYPE_NONE;
+    if (cells[x][y].type == CELL_TYPE_STONE && cells[x][y].attributes & CELL_ATTRIBUTE_WALL) {
+        // Candidate!
+        signature = wall_neighbor(x, y - 1) << (2 * WALL_SIDE_N)
+            | wall_neighbor(x + 1, y) << (2 * WALL_SIDE_E)
+            | wall_neighbor(x, y + 1) << (2 * WALL_SIDE_S)
+            | wall_neighbor(x - 1, y) << (2 * WALL_SIDE_W);
+        cells[x][y].wall_type = WALL_TILE_TABLE.types[signature];
+    }
+}
+
+void Dungeon::apply_walls() {
+    int x, y;
+    for (x = 0; x < width; x++)
+        for (y = 0; y < height; y++)
+            update_wall_attribute(x, y);
+
+    for (x = 0; x < width; x++)
+        for (y = 0; y < height; y++)
+            update_wall_type(x, y);
+
+    wall_edits.clear();
+}
+
+void Dungeon::mark_wall_edit(IntPair coords) {
+    wall_edits.push_back(coords);
+}
+
+void Dungeon::log_terrain_edit(IntPair coords) {
+    terrain_log[terrain_edit_count % TERRAIN_LOG_SIZE] = coords;
+    terrain_edit_count++;
+}
+
+uint32_t Dungeon::terrain_edits() {
+    return terrain_edit_count;
+}
+
+IntPair Dungeon::terrain_edit(uint32_t i) {
+    if (i >= terrain_edit_count || terrain_edit_count - i > TERRAIN_LOG_SIZE)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "terrain edit " + std::to_string(i) + " isn't in the log");
+    return terrain_log[i % TERRAIN_LOG_SIZE];
+}
+
+void Dungeon::reset_terrain_log(uint32_t count) {
+    terrain_edit_count = count;
+}
+
+void Dungeon::apply_wall_edits() {
+    // An edit can flip the wall attribute of anything within 1 cell of it, and a tile
+    // is picked from the attributes 1 cell out from there. So attributes get redone in
+    // a 3x3 area first, then tiles in a 5x5 area once every attribute is settled.
+    // Overlapping edits just redo a few cells, which is still far cheaper than a full pass.
+    int x, y;
+    if (wall_edits.empty()) return;
+    for (const IntPair &edit : wall_edits)
+        for (x = MAX(edit.x - 1, 0); x <= MIN(edit.x + 1, width - 1); x++)
+            for (y = MAX(edit.y - 1, 0); y <= MIN(edit.y + 1, height - 1); y++)
+                update_wall_attribute(x, y);
+
+    for (const IntPair &edit : wall_edits)
+        for (x = MAX(edit.x - 2, 0); x <= MIN(edit.x + 2, width - 1); x++)
+            for (y = MAX(edit.y - 2, 0); y <= MIN(edit.y + 2, height - 1); y++)
+                update_wall_type(x, y);
+
+    wall_edits.clear();
+}
@@ -9,11 +9,17 @@
 
 #include <cstdint>
 #include <cstdio>
+#include <optional>
 
 #include "heap.h"
+#include "noise.h"
+#include "random.h"
 
 
 #define CELL_TYPES 8
+// How many of the most recent terrain edits a floor remembers. Anything planned before
+// the oldest one it still has is just assumed to be out of date.
+#define TERRAIN_LOG_SIZE 64
 typedef enum { // if modified, sync with CELL_TYPES_TO_FLOOR_TEXTURES, game_loop.cpp
     CELL_TYPE_STONE,
     CELL_TYPE_ROOM,
@@ -49,6 +55,43 @@ typedef enum {
     WALL_TYPE_NONE
 } wall_type_t;
 
+// Wall tiles only depend on the 4 cells directly beside them. Each side's state is
+// packed into 2 bits of a signature (in wall_side_t order), which indexes straight
+// into a table of tiles.
+typedef enum {
+    WALL_SIDE_N,
+    WALL_SIDE_E,
+    WALL_SIDE_S,
+    WALL_SIDE_W
+} wall_side_t;
+
+typedef enum {
+    WALL_NEIGHBOR_OTHER, // stone, out of bounds, etc.
+    WALL_NEIGHBOR_FLOOR,
+    WALL_NEIGHBOR_WALL
+} wall_neighbor_t;
+
+class IntPair {
+    public:
+        int x;
+        int y;
+        IntPair(int x, int y) {
+            this->x = x;
+            this->y = y;
+        }
+        IntPair() {
+            this->x = 0;
+            this->y = 0;
+        }
+        std::string str() const {
+            return "(" + std::to_string(x) + ", " + std::to_string(y) + ")";
+        }
+
+        friend std::ostream &operator<<(std::ostream &o, const IntPair &ip) {
+            return o << ip.str();
+        }
+        bool operator==(const IntPair &o) const;
+};
 class Room {
     public:
         uint8_t x0;
@@ -56,6 +99,13 @@ class Room {
         uint8_t x1;
         uint8_t y1;
 
+        // Cells that could still be picked for placement, filled the first time they're
+        // needed. Cells are only ever dropped (once they're taken or obstructed), so
+        // these are checked again on the way out rather than kept exact. Anything that
+        // frees a cell back up has to clear indexed so they're filled again.
+        bool indexed = false;
+        std::vector<IntPair> free_cells;
+        std::vector<IntPair> edge_cells;
 
         std::string str() const {
             return "(" + std::to_string(x0) + ", " + std::to_string(y0) + ") to (" + std::to_string(x1) + ", " + std::to_string(y1) + ")";
@@ -86,35 +136,6 @@ typedef enum {
     CELL_ATTRIBUTE_WALL = 0x04
 } cell_attributes_t;
 
-class QueueNode {
-    public:
-        int x;
-        int y;
-        QueueNode *next;
-
-};
-
-class IntPair {
-    public:
-        int x;
-        int y;
-        IntPair(int x, int y) {
-            this->x = x;
-            this->y = y;
-        }
-        IntPair() {
-            this->x = 0;
-            this->y = 0;
-        }
-        std::string str() const {
-            return "(" + std::to_string(x) + ", " + std::to_string(y) + ")";
-        }
-
-        friend std::ostream &operator<<(std::ostream &o, const IntPair &ip) {
-            return o << ip.str();
-        }
-        bool operator==(const IntPair &o) const;
-};
 class DungeonOptions {
     public:
         std::string name;
@@ -130,6 +151,10 @@ class DungeonOptions {
         std::string boss = "";
         std::string key = "";
         bool is_default = false;
+        std::string noise = "diffuse";
+        int noise_scale = NOISE_DEFAULT_SCALE;
+        int noise_octaves = NOISE_DEFAULT_OCTAVES;
+        int loop_chance = 0;
 };
 
 #define IS_FLOOR(cell_type) (cell_type == CELL_TYPE_ROOM || cell_type == CELL_TYPE_HALL || cell_type == CELL_TYPE_UP_STAIRCASE || cell_type == CELL_TYPE_DOWN_STAIRCASE || cell_type == CELL_TYPE_DECORATION)
@@ -140,6 +165,26 @@ typedef enum {
     GAME_RESULT_LOSE = 2
 } game_result_t;
 
+// One piece of furniture placed while decorating, which might cover a few cells.
+class DecorationPiece {
+    public:
+        // Index of the room it's in.
+        int room;
+        // Whether it's on the floor right now, or was taken up to unblock something.
+        bool placed = true;
+        // Every cell it covers, and the texture that goes there.
+        std::vector<IntPair> cells;
+        std::vector<std::string> textures;
+};
+
+class ConnectivityReport {
+    public:
+        // Number of separate patches of walkable floor (1 if it's all connected).
+        int components = 0;
+        // Walkable cells that can't be reached from the largest patch.
+        std::vector<IntPair> unreachable;
+};
+
 class Dungeon {
     private:
         bool is_initalized;
@@ -150,6 +195,11 @@ class Dungeon {
         uint8_t height;
         std::vector<Room> rooms;
         std::vector<std::vector<Cell>> cells;
+        // Stream for everything that happens on this floor once it's generated, like placing monsters and items.
+        Rng rng;
+        // Every piece of furniture decorate() has placed, so repair_connectivity can move
+        // one as a whole. Empty for floors loaded from a file.
+        std::vector<DecorationPiece> decoration_pieces;
 
         /**
          * Allocates memory for a dungeon. It still must be filled after creation
@@ -162,6 +212,26 @@ class Dungeon {
          */
         Dungeon(uint8_t width, uint8_t height, int max_rooms);
         Dungeon(DungeonOptions &options);
+
+        /**
+         * Loads a dungeon saved in the binary floor format (see floor_file.h). The
+         * cell planes are copied straight over, so this skips generation entirely.
+         *
+         * Params:
+         * - options: Map options for the floor
+         * - data: The saved floor
+         * - size: Size of the saved floor, in bytes
+         */
+        Dungeon(DungeonOptions &options, const uint8_t *data, size_t size);
+
+        /**
+         * Loads a dungeon from a floor file, which is mapped into memory rather than read.
+         *
+         * Params:
+         * - options: Map options for the floor
+         * - path: Path to the floor file
+         */
+        Dungeon(DungeonOptions &options, const char *path);
         ~Dungeon();
 
         /**
@@ -176,65 +246,288 @@ class Dungeon {
          */
         void fill();
 
+        /**
+         * Starts a new piece of furniture. Every decorate() after this is part of it,
+         * until the next one's started.
+         *
+         * Params:
+         * - room: Room the piece is going in
+         */
+        void start_decoration_piece(Room *room);
+
+        /**
+         * Puts a decoration in a cell, as part of the piece started last.
+         *
+         * Params:
+         * - coords: Coordinates of the cell
+         * - texture: Texture to draw there
+         */
+        void decorate(IntPair coords, const std::string &texture);
+
+        /**
+         * Makes sure every floor cell can be walked to from every other one without
+         * tunneling. Furniture that splits the floor up is moved somewhere else in its
+         * room (or taken out, if it doesn't fit or it's already been moved once), then
+         * halls are dug between whatever is still separate. Run after decorating.
+         *
+         * Returns: Number of repairs made (0 if it was already connected)
+         */
+        int repair_connectivity();
+
+        /**
+         * Checks whether every walkable cell can reach every other one without tunneling,
+         * using the same rules as the non-tunneling pathfinding map.
+         *
+         * Returns: The number of separate patches, and every cell outside the largest one
+         */
+        ConnectivityReport check_connectivity();
+
+        /**
+         * Finds the room a cell is in.
+         *
+         * Params:
+         * - coords: Coordinates of the cell
+         * Returns: Index of the room in rooms, or -1 if the cell isn't in one
+         */
+        int room_at(IntPair coords);
+
+        /**
+         * Works out which rooms lead straight into each other, either through a hallway
+         * or by sharing a wall opening.
+         *
+         * Returns: For each room (by index in rooms), the indexes of its neighbours
+         */
+        std::vector<std::vector<int>> room_graph();
+
         /**
          * Picks a random, unobstructred location in a room within a dungeon.
          *
          * Parameters:
          * - room: Room to find an open space in
-         * Returns: The picked coordinates
+         * Returns: The picked coordinates, or nothing if the room is full
          */
-        IntPair random_location_in_room(Room *room);
+        std::optional<IntPair> random_location_in_room(Room *room);
 
         /**
          * Picks a random, unobstructred location in any room within a dungeon.
          *
-         * Returns: The picked coordinates
+         * Returns: The picked coordinates, or nothing if every room is full
          */
-        IntPair random_location();
+        std::optional<IntPair> random_location();
 
         /**
          * Picks a random, unobstructed location within a room of a given size.
          * Guaranteed to not block off hallways.
          * 
-         * Returns: The top left corner of the area.
+         * Returns: The top left corner of the area, or nothing if it doesn't fit
          */
-        IntPair random_area_in_room(Room *room, int width, int height);
+        std::optional<IntPair> random_area_in_room(Room *room, int width, int height);
 
         /**
          * Picks a random, unobstructed location along the edge of a room.
          * Guaranteed to not block off hallways.
          * 
-         * Returns: The selected area.
+         * Returns: The selected area, or nothing if the edge is full
          */
-        IntPair random_location_along_edge(Room *room);
+        std::optional<IntPair> random_location_along_edge(Room *room);
 
         /**
-         * Fills this dungeon with the data read from an RLG327 file.
+         * Saves this dungeon in the binary floor format (see floor_file.h).
          *
          * Params:
-         * - f: File pointer to read
-         * - debug: If true, debug messages will be printed
-         * - pc_coords: A pointer to coordinates that contain the PC's location
+         * - out: Buffer the floor is appended to
          */
-        // void fill_from_file(FILE *f, int debug, IntPair *pc_coords);
+        void write_floor(std::vector<uint8_t> &out);
 
         /**
-         * Saves this dungeon to an RLG327 file.
+         * Saves this dungeon to a floor file.
          *
          * Params:
-         * - f: File pointer to write
-         * - debug: If true, debug messages will be printed
-         * - pc_coords: A pointer to coordinates that will be updated with
-         *      the PC's location
+         * - path: Path to the file to write
          */
-        // void save_to_file(FILE *f, int debug, IntPair *pc_coords);
+        void save_floor(const char *path);
 
+        /**
+         * Classifies every wall in the dungeon from scratch.
+         * Also drops any edits queued with mark_wall_edit, since they're covered.
+         */
         void apply_walls();
 
+        /**
+         * Queues a cell whose type changed (ie, stone dug into a hallway) so the walls
+         * around it are re-classified on the next apply_wall_edits().
+         *
+         * Params:
+         * - coords: Coordinates of the edited cell
+         */
+        void mark_wall_edit(IntPair coords);
+
+        /**
+         * Re-classifies walls around every cell queued with mark_wall_edit since the
+         * last call. Only the 5x5 area around each edit can change, so that's all
+         * that gets touched.
+         */
+        void apply_wall_edits();
+
+        /**
+         * Records a cell whose type or hardness changed after the floor was built (ie,
+         * a monster digging), so anything planned around the old terrain can tell.
+         *
+         * Params:
+         * - coords: Coordinates of the edited cell
+         */
+        void log_terrain_edit(IntPair coords);
+
+        /**
+         * Returns: How many terrain edits have ever been logged on this floor, which
+         *  doubles as a timestamp for checking against later
+         */
+        uint32_t terrain_edits();
+
+        /**
+         * Params:
+         * - i: Which edit (counting from the first one ever), which has to be one of the
+         *   last TERRAIN_LOG_SIZE
+         * Returns: The cell that edit touched
+         */
+        IntPair terrain_edit(uint32_t i);
+
+        /**
+         * Clears the terrain log and starts its count over, for loading a saved game.
+         *
+         * Params:
+         * - count: Number of edits logged so far
+         */
+        void reset_terrain_log(uint32_t count);
+
     private:
+        std::vector<IntPair> wall_edits;
+        // A ring of the last TERRAIN_LOG_SIZE terrain edits, and how many there have been.
+        IntPair terrain_log[TERRAIN_LOG_SIZE];
+        uint32_t terrain_edit_count = 0;
+
+        /**
+         * Replaces this dungeon's size, cells, and rooms with a saved floor.
+         *
+         * Params:
+         * - data: The saved floor
+         * - size: Size of the saved floor, in bytes
+         */
+        void load_floor(const uint8_t *data, size_t size);
+
+        /**
+         * Labels each 4-connected patch of walkable floor with a union-find pass.
+         *
+         * Params:
+         * - component: Set to the patch of each cell, indexed [x * height + y], or -1 for
+         *      cells that can't be walked on
+         * - sizes: Set to the number of cells in each patch
+         */
+        void label_components(std::vector<int> &component, std::vector<int> &sizes);
+
+        /**
+         * Fills a room's free cell and edge indexes, if they haven't been already.
+         */
+        void index_room(Room *room);
+
+        /**
+         * Drops a room's indexes so they're filled again next time, for when cells in
+         * it are freed back up.
+         *
+         * Params:
+         * - room: Room to drop the indexes of
+         */
+        void unindex_room(Room *room);
+
         /**
-         * Fills the dungeon with randomly-generated stone. Overwrites everything
-         * while doing so -- only run on a blank dungeon.
+         * Takes a piece of furniture up off the floor, leaving plain room floor.
+         *
+         * Params:
+         * - piece: Piece to take up
+         */
+        void remove_decoration_piece(DecorationPiece &piece);
+
+        /**
+         * Puts a piece of furniture that was taken up back down somewhere else in its
+         * room, without blocking any hallways.
+         *
+         * Params:
+         * - piece: Piece to put down
+         * Returns: Whether there was anywhere to put it
+         */
+        bool move_decoration_piece(DecorationPiece &piece);
+
+        /**
+         * Checks if a cell can have something placed in it: it's empty room floor,
+         * and it isn't next to a hallway.
+         */
+        bool is_free_cell(int x, int y);
+
+        /**
+         * Checks if a cell along the edge of a room can have something placed in it
+         * without blocking anything off.
+         */
+        bool is_free_edge(int x, int y);
+
+        /**
+         * Picks a random cell from an index, dropping any that no longer pass the check
+         * along the way.
+         *
+         * Params:
+         * - index: Cells to pick from
+         * - check: Member function that a cell must pass
+         * Returns: The picked cell, or nothing if none are left
+         */
+        std::optional<IntPair> pick_from_index(std::vector<IntPair> &index, bool (Dungeon::*check)(int, int));
+        // Summed-area table of cells rooms can't be placed over, (width + 1) x (height + 1),
+        // indexed [x * (height + 1) + y]. Only kept up to date while rooms are being created.
+        std::vector<uint32_t> blocked_area;
+
+        /**
+         * Rebuilds the blocked area table from scratch.
+         */
+        void build_blocked_area();
+
+        /**
+         * Marks a rectangle of previously-open cells as blocked in the blocked area table.
+         *
+         * Params:
+         * - x0/y0: Top left corner (inclusive)
+         * - x1/y1: Bottom right corner (inclusive)
+         */
+        void block_area(int x0, int y0, int x1, int y1);
+
+        /**
+         * Counts the blocked cells in a rectangle. The rectangle must be in bounds.
+         *
+         * Params:
+         * - x0/y0: Top left corner (inclusive)
+         * - x1/y1: Bottom right corner (inclusive)
+         * Returns: Number of blocked cells
+         */
+        uint32_t blocked_in(int x0, int y0, int x1, int y1);
+
+        /**
+         * Sets or clears the wall attribute on a cell based on whether any floor
+         * is within 1 cell of it.
+         */
+        void update_wall_attribute(int x, int y);
+
+        /**
+         * Gets the state of a cell beside a wall, for building its tile signature.
+         * Out-of-bounds coordinates are allowed.
+         */
+        wall_neighbor_t wall_neighbor(int x, int y);
+
+        /**
+         * Picks the wall tile for a cell. Wall attributes around it must be up to date.
+         */
+        void update_wall_type(int x, int y);
+
+        /**
+         * Fills the dungeon with randomly-generated stone, using the noise generator
+         * picked by the map. Overwrites everything while doing so -- only run on a
+         * blank dungeon.
          */
         void fill_stone();
 
@@ -256,8 +549,9 @@ class Dungeon {
 
         /**
          * Places a single room of a particular width and height somewhere in the dungeon.
-         * This will attempt every possible location, returning a non-zero status code if
-         * placement fails.
+         * The spot is picked uniformly from every location where it fits, and a
+         * dungeon_exception is thrown if there are none. The blocked area table must
+         * be up to date.
          *
          * Parameters:
          * - room: Room struct to update with coordinates
@@ -267,7 +561,9 @@ class Dungeon {
         Room create_room(uint8_t room_width, uint8_t room_height);
 
         /**
-         * Connects every room in the dungeon.
+         * Connects every room in the dungeon along a minimum spanning tree of each
+         * room's nearest neighbors. Each leftover neighbor link is also dug out with
+         * the map's loop chance, making some loops.
          */
         void connect_rooms();
 
@@ -306,45 +602,21 @@ class Dungeon {
 };
 
 
-// Texture direction to coordinates that must be set to coordinates that must be unset
-// In order of priority
+#define WALL_SIGNATURES 256
+
+// Texture direction to the sides that must be floor and the sides that must be wall
+// (bitmasks of 1 << wall_side_t). In order of priority
 class WallTileIdentifier {
     public:
-        std::vector<IntPair> floor;
-        std::vector<IntPair> wall;
-        std::vector<IntPair> stone;
         wall_type_t type;
-
-        WallTileIdentifier(wall_type_t type, std::vector<IntPair> floor, std::vector<IntPair> wall, std::vector<IntPair> stone) {
-            this->type = type;
-            this->floor = floor;
-            this->wall = wall;
-            this->stone = stone;
-        }
-
-        bool applies(Dungeon *dungeon, IntPair coords) const {
-            int x, y;
-            Cell *cell;
-            for (auto &offset : floor) {
-                x = coords.x + offset.x;
-                y = coords.y + offset.y;
-                if (x < 0 || x >= dungeon->width || y < 0 || y >= dungeon->height) return false;
-                cell = &dungeon->cells[x][y];
-                if (!IS_FLOOR(cell->type)) return false;
-            }
-            for (auto &offset : wall) {
-                x = coords.x + offset.x;
-                y = coords.y + offset.y;
-                if (x < 0 || x >= dungeon->width || y < 0 || y >= dungeon->height) return false;
-                cell = &dungeon->cells[x][y];
-                if (!(cell->attributes & CELL_ATTRIBUTE_WALL)) return false;
-            }
-            for (auto &offset : stone) {
-                x = coords.x + offset.x;
-                y = coords.y + offset.y;
-                if (x < 0 || x >= dungeon->width || y < 0 || y >= dungeon->height) continue;
-                cell = &dungeon->cells[x][y];
-                if (IS_FLOOR(cell->type)) return false;
+        uint8_t floor;
+        uint8_t wall;
+
+        constexpr bool applies(uint8_t signature) const {
+            for (int side = WALL_SIDE_N; side <= WALL_SIDE_W; side++) {
+                uint8_t state = (signature >> (2 * side)) & 0x3;
+                if ((floor & (1 << side)) && state != WALL_NEIGHBOR_FLOOR) return false;
+                if ((wall & (1 << side)) && state != WALL_NEIGHBOR_WALL) return false;
             }
             return true;
         }
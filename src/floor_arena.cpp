@@ -0,0 +1,74 @@
+#include <new>
+
+#include "floor_arena.h"
+#include "macros.h"
+
+static_assert(sizeof (FloorArena *) <= FloorArena::HEADER_SIZE, "arena headers are too small");
+
+FloorArena::~FloorArena() {
+    for (void *chunk : chunks) ::operator delete(chunk);
+}
+
+FloorArena::size_class_t &FloorArena::size_class(size_t size) {
+    for (size_class_t &current : classes) {
+        if (current.size == size) return current;
+    }
+    classes.push_back({size, nullptr});
+    return classes.back();
+}
+
+void *FloorArena::allocate(size_t size) {
+    size_class_t &blocks = size_class(size);
+    size_t stride = HEADER_SIZE + ((size + HEADER_SIZE - 1) / HEADER_SIZE) * HEADER_SIZE;
+    char *chunk, *block;
+    size_t i;
+
+    if (!blocks.free) {
+        // Threaded onto the free list back to front, so blocks get handed out in address order.
+        chunk = (char *) ::operator new(stride * FLOOR_ARENA_CHUNK_BLOCKS);
+        chunks.push_back(chunk);
+        for (i = FLOOR_ARENA_CHUNK_BLOCKS; i > 0; i--) {
+            block = chunk + (i - 1) * stride;
+            *(void **) (block + HEADER_SIZE) = blocks.free;
+            blocks.free = block;
+        }
+    }
+    block = (char *) blocks.free;
+    blocks.free = *(void **) (block + HEADER_SIZE);
+    *(FloorArena **) block = this;
+    live++;
+    return block + HEADER_SIZE;
+}
+
+void FloorArena::release(void *block, size_t size) {
+    size_class_t &blocks = size_class(size);
+    *(void **) ((char *) block + HEADER_SIZE) = blocks.free;
+    blocks.free = block;
+    live--;
+    if (retired && live == 0) delete this;
+}
+
+void FloorArena::retire() {
+    retired = true;
+    if (live == 0) delete this;
+}
+
+void *FloorArena::allocate_block(size_t size) {
+    char *block;
+    if (arena_active) return arena_active->allocate(size);
+    block = (char *) ::operator new(HEADER_SIZE + size);
+    *(FloorArena **) block = nullptr;
+    return block + HEADER_SIZE;
+}
+
+void FloorArena::release_block(void *object, size_t size) {
+    char *block;
+    if (!object) return;
+    block = (char *) object - HEADER_SIZE;
+    if (*(FloorArena **) block) (*(FloorArena **) block)->release(block, size);
+    else ::operator delete(block);
+}
+
+FloorArena *FloorArena::of(const void *object) {
+    return *(FloorArena * const *) ((const char *) object - HEADER_SIZE);
+}
@@ -0,0 +1,113 @@
+/**
+ * Memory for the monsters and items made on one floor. Blocks are cut out of
+ * a few big chunks instead of being allocated one at a time, and every chunk
+ * goes back in one go once the floor's gone. Anything carried off the floor
+ * (an item in the PC's pocket, say) keeps the arena around until it's deleted
+ * too, so nothing ever points into freed memory.
+ *
+ * Monster and Item allocate from whichever arena is active on the calling
+ * thread (see ArenaScope), or from the regular heap if there isn't one. Every
+ * block starts with a header naming the arena it came from, so deleting one
+ * works the same either way.
+ *
+ * Arenas aren't thread safe. A floor's monsters and items are only ever made
+ * and deleted on the game thread.
+ */
+
+#ifndef FLOOR_ARENA_H
+#define FLOOR_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+class FloorArena {
+    private:
+        // One free list per block size, and there are only ever a couple of sizes.
+        typedef struct {
+            size_t size;
+            void *free;
+        } size_class_t;
+
+        std::vector<size_class_t> classes;
+        std::vector<void *> chunks;
+        size_t live = 0;
+        bool retired = false;
+
+        ~FloorArena();
+        size_class_t &size_class(size_t size);
+        void *allocate(size_t size);
+        void release(void *block, size_t size);
+
+    public:
+        // Room in front of every block for the arena it belongs to, keeping the object aligned.
+        static constexpr size_t HEADER_SIZE = alignof(std::max_align_t);
+
+        FloorArena() = default;
+        FloorArena(const FloorArena &) = delete;
+        FloorArena &operator=(const FloorArena &) = delete;
+
+        /**
+         * Lets the arena go once nothing in it is still alive, which could be right away.
+         * It mustn't be used to allocate again after this.
+         */
+        void retire();
+
+        /**
+         * Returns: How many blocks are handed out right now
+         */
+        size_t live_blocks() const { return live; }
+
+        /**
+         * Returns: How many chunks have been allocated
+         */
+        size_t chunk_count() const { return chunks.size(); }
+
+        /**
+         * Allocates an object from the active arena, or the heap if there isn't one.
+         *  For use by operator new.
+         *
+         * Params:
+         * - size: Size of the object
+         * Returns: Memory for the object
+         */
+        static void *allocate_block(size_t size);
+
+        /**
+         * Gives an object's memory back to wherever it came from. For use by operator delete.
+         *
+         * Params:
+         * - object: What allocate_block returned
+         * - size: Size of the object
+         */
+        static void release_block(void *object, size_t size);
+
+        /**
+         * Params:
+         * - object: Something allocate_block returned
+         * Returns: The arena it came from, or null if it came from the heap
+         */
+        static FloorArena *of(const void *object);
+};
+
+inline thread_local FloorArena *arena_active = nullptr;
+
+/**
+ * Makes an arena the calling thread's active one until this goes out of scope.
+ * A null arena means the heap.
+ */
+class ArenaScope {
+    private:
+        FloorArena *previous;
+
+    public:
+        ArenaScope(FloorArena *arena) {
+            previous = arena_active;
+            arena_active = arena;
+        }
+
+        ~ArenaScope() {
+            arena_active = previous;
+        }
+};
+
+#endif
@@ -0,0 +1,280 @@
+#include <cstring>
+#include <map>
+#include <endian.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dungeon.h"
+#include "floor_file.h"
+#include "macros.h"
+#include "logger.h"
+
+MappedFile::MappedFile(const char *path) {
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to open " + std::string(path));
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        throw dungeon_exception(__PRETTY_FUNCTION__, "failed to stat " + std::string(path));
+    }
+    size = info.st_size;
+    if (size == 0) {
+        close(fd);
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " is empty");
+    }
+    address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file.
+    close(fd);
+    if (address == MAP_FAILED) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to map " + std::string(path));
+    data = (const uint8_t *) address;
+}
+
+MappedFile::~MappedFile() {
+    munmap(address, size);
+}
+
+static uint16_t get_u16(const uint8_t *data, size_t offset) {
+    uint16_t value;
+    memcpy(&value, data + offset, sizeof (value));
+    return le16toh(value);
+}
+
+static uint32_t get_u32(const uint8_t *data, size_t offset) {
+    uint32_t value;
+    memcpy(&value, data + offset, sizeof (value));
+    return le32toh(value);
+}
+
+static void put_u16(std::vector<uint8_t> &out, size_t offset, uint16_t value) {
+    value = htole16(value);
+    memcpy(out.data() + offset, &value, sizeof (value));
+}
+
+static void put_u32(std::vector<uint8_t> &out, size_t offset, uint32_t value) {
+    value = htole32(value);
+    memcpy(out.data() + offset, &value, sizeof (value));
+}
+
+Dungeon::Dungeon(DungeonOptions &options, const uint8_t *data, size_t size) {
+    this->options = &options;
+    load_floor(data, size);
+}
+
+Dungeon::Dungeon(DungeonOptions &options, const char *path) {
+    MappedFile file(path);
+    this->options = &options;
+    try {
+        load_floor(file.data, file.size);
+    } catch (dungeon_exception &e) {
+        throw dungeon_exception(__PRETTY_FUNCTION__, e, "failed to load floor from " + std::string(path));
+    }
+}
+
+void Dungeon::load_floor(const uint8_t *data, size_t size) {
+    uint16_t version, header_size, room_count, staircase_count, decoration_count, length;
+    uint32_t string_count, rooms_offset, staircases_offset, planes_offset, decorations_offset, strings_offset, offset;
+    const uint8_t *plane, *entry;
+    std::vector<std::pair<uint32_t, uint16_t>> strings;
+    size_t cell_count;
+    int x, y, i;
+
+    if (size < FLOOR_FILE_HEADER_SIZE || memcmp(data, FLOOR_FILE_MAGIC, FLOOR_FILE_MAGIC_SIZE) != 0)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "not a floor file");
+    version = get_u16(data, FLOOR_FILE_VERSION_OFFSET);
+    if (version == 0 || version > FLOOR_FILE_VERSION)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "unsupported floor file version " + std::to_string(version));
+    header_size = get_u16(data, FLOOR_FILE_HEADER_SIZE_OFFSET);
+    if (header_size < FLOOR_FILE_HEADER_SIZE || get_u32(data, FLOOR_FILE_SIZE_OFFSET) != size)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "floor file is truncated or corrupt");
+
+    width = data[FLOOR_FILE_WIDTH_OFFSET];
+    height = data[FLOOR_FILE_HEIGHT_OFFSET];
+    room_count = get_u16(data, FLOOR_FILE_ROOM_COUNT_OFFSET);
+    staircase_count = get_u16(data, FLOOR_FILE_STAIRCASE_COUNT_OFFSET);
+    decoration_count = get_u16(data, FLOOR_FILE_DECORATION_COUNT_OFFSET);
+    string_count = get_u32(data, FLOOR_FILE_STRING_COUNT_OFFSET);
+    rooms_offset = get_u32(data, FLOOR_FILE_ROOMS_OFFSET);
+    staircases_offset = get_u32(data, FLOOR_FILE_STAIRCASES_OFFSET);
+    planes_offset = get_u32(data, FLOOR_FILE_PLANES_OFFSET);
+    decorations_offset = get_u32(data, FLOOR_FILE_DECORATIONS_OFFSET);
+    strings_offset = get_u32(data, FLOOR_FILE_STRINGS_OFFSET);
+    cell_count = (size_t) width * height;
+
+    // Make sure every section actually fits before touching any of it.
+    if (width == 0 || height == 0
+        || (size_t) rooms_offset + (size_t) room_count * FLOOR_FILE_ROOM_SIZE > size
+        || (size_t) staircases_offset + (size_t) staircase_count * FLOOR_FILE_STAIRCASE_SIZE > size
+        || (size_t) planes_offset + cell_count * FLOOR_FILE_PLANES > size
+        || (size_t) decorations_offset + (size_t) decoration_count * FLOOR_FILE_DECORATION_SIZE > size
+        || strings_offset > size)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "floor file is truncated or corrupt");
+
+    offset = strings_offset;
+    for (i = 0; i < (int) string_count; i++) {
+        if ((size_t) offset + 2 > size) throw dungeon_exception(__PRETTY_FUNCTION__, "floor file string table is truncated");
+        length = get_u16(data, offset);
+        if ((size_t) offset + 2 + length > size) throw dungeon_exception(__PRETTY_FUNCTION__, "floor file string table is truncated");
+        strings.push_back({offset + 2, length});
+        offset += 2 + length;
+    }
+
+    // The planes are laid out the same way as the cells, so these are straight copies,
+    // done in a single pass so each cell is only touched once.
+    cells.assign(width, std::vector<Cell>(height));
+    plane = data + planes_offset;
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            i = x * height + y;
+            if (plane[i] > CELL_TYPE_HIDDEN || plane[3 * cell_count + i] > WALL_TYPE_NONE)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "floor file has an invalid cell or wall type");
+            Cell &cell = cells[x][y];
+            cell.type = (cell_type_t) plane[i];
+            cell.hardness = plane[cell_count + i];
+            cell.attributes = plane[2 * cell_count + i];
+            cell.wall_type = (wall_type_t) plane[3 * cell_count + i];
+        }
+    }
+
+    for (i = 0; i < decoration_count; i++) {
+        entry = data + decorations_offset + i * FLOOR_FILE_DECORATION_SIZE;
+        if (entry[0] >= width || entry[1] >= height || get_u16(entry, 2) >= strings.size())
+            throw dungeon_exception(__PRETTY_FUNCTION__, "floor file has an invalid decoration");
+        Cell &cell = cells[entry[0]][entry[1]];
+        delete cell.decoration_texture;
+        cell.decoration_texture = new std::string((const char *) data + strings[get_u16(entry, 2)].first, strings[get_u16(entry, 2)].second);
+    }
+
+    rooms.clear();
+    for (i = 0; i < room_count; i++) {
+        entry = data + rooms_offset + i * FLOOR_FILE_ROOM_SIZE;
+        if (entry[0] > entry[2] || entry[1] > entry[3] || entry[2] >= width || entry[3] >= height)
+            throw dungeon_exception(__PRETTY_FUNCTION__, "floor file has an invalid room");
+        Room room;
+        room.x0 = entry[0];
+        room.y0 = entry[1];
+        room.x1 = entry[2];
+        room.y1 = entry[3];
+        rooms.push_back(room);
+    }
+
+    // Staircases are already in the cell planes. The list is only there so tools can find
+    // them without a scan, but it still has to agree with the cells.
+    for (i = 0; i < staircase_count; i++) {
+        entry = data + staircases_offset + i * FLOOR_FILE_STAIRCASE_SIZE;
+        if (entry[0] >= width || entry[1] >= height || cells[entry[0]][entry[1]].type != entry[2])
+            throw dungeon_exception(__PRETTY_FUNCTION__, "floor file has a staircase that doesn't match its cells");
+    }
+
+    Logger::debug(__FILE__, "loaded " + std::to_string(width) + "x" + std::to_string(height) + " floor (version "
+        + std::to_string(version) + ", " + std::to_string(room_count) + " rooms)");
+    is_initalized = true;
+}
+
+void Dungeon::write_floor(std::vector<uint8_t> &out) {
+    if (!is_initalized) throw dungeon_exception(__PRETTY_FUNCTION__, "dungeon is not initialized");
+    std::vector<IntPair> staircases;
+    std::vector<IntPair> decorations;
+    std::vector<std::string *> strings;
+    std::map<std::string, uint16_t> string_index;
+    size_t start = out.size(), cell_count = (size_t) width * height, offset;
+    uint32_t rooms_offset, staircases_offset, planes_offset, decorations_offset, strings_offset;
+    uint16_t length;
+    uint8_t *plane;
+    int x, y, i;
+
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            if (cells[x][y].type == CELL_TYPE_UP_STAIRCASE || cells[x][y].type == CELL_TYPE_DOWN_STAIRCASE)
+                staircases.push_back(IntPair(x, y));
+            if (cells[x][y].decoration_texture) {
+                decorations.push_back(IntPair(x, y));
+                if (string_index.count(*cells[x][y].decoration_texture) == 0) {
+                    string_index[*cells[x][y].decoration_texture] = strings.size();
+                    strings.push_back(cells[x][y].decoration_texture);
+                }
+            }
+        }
+    }
+    if (rooms.size() > UINT16_MAX || decorations.size() > UINT16_MAX)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "too many rooms or decorations to save");
+
+    rooms_offset = FLOOR_FILE_HEADER_SIZE;
+    staircases_offset = rooms_offset + rooms.size() * FLOOR_FILE_ROOM_SIZE;
+    planes_offset = staircases_offset + staircases.size() * FLOOR_FILE_STAIRCASE_SIZE;
+    decorations_offset = planes_offset + cell_count * FLOOR_FILE_PLANES;
+    strings_offset = decorations_offset + decorations.size() * FLOOR_FILE_DECORATION_SIZE;
+    offset = strings_offset;
+    for (std::string *string : strings) offset += 2 + MIN(string->length(), (size_t) UINT16_MAX);
+
+    // Everything's sized up front, so the whole floor is one allocation.
+    out.resize(start + offset, 0);
+    memcpy(out.data() + start, FLOOR_FILE_MAGIC, FLOOR_FILE_MAGIC_SIZE);
+    put_u16(out, start + FLOOR_FILE_VERSION_OFFSET, FLOOR_FILE_VERSION);
+    put_u16(out, start + FLOOR_FILE_HEADER_SIZE_OFFSET, FLOOR_FILE_HEADER_SIZE);
+    out[start + FLOOR_FILE_WIDTH_OFFSET] = width;
+    out[start + FLOOR_FILE_HEIGHT_OFFSET] = height;
+    put_u16(out, start + FLOOR_FILE_ROOM_COUNT_OFFSET, rooms.size());
+    put_u16(out, start + FLOOR_FILE_STAIRCASE_COUNT_OFFSET, staircases.size());
+    put_u16(out, start + FLOOR_FILE_DECORATION_COUNT_OFFSET, decorations.size());
+    put_u32(out, start + FLOOR_FILE_STRING_COUNT_OFFSET, strings.size());
+    put_u32(out, start + FLOOR_FILE_ROOMS_OFFSET, rooms_offset);
+    put_u32(out, start + FLOOR_FILE_STAIRCASES_OFFSET, staircases_offset);
+    put_u32(out, start + FLOOR_FILE_PLANES_OFFSET, planes_offset);
+    put_u32(out, start + FLOOR_FILE_DECORATIONS_OFFSET, decorations_offset);
+    put_u32(out, start + FLOOR_FILE_STRINGS_OFFSET, strings_offset);
+    put_u32(out, start + FLOOR_FILE_SIZE_OFFSET, offset);
+
+    for (i = 0; i < (int) rooms.size(); i++) {
+        plane = out.data() + start + rooms_offset + i * FLOOR_FILE_ROOM_SIZE;
+        plane[0] = rooms[i].x0;
+        plane[1] = rooms[i].y0;
+        plane[2] = rooms[i].x1;
+        plane[3] = rooms[i].y1;
+    }
+    for (i = 0; i < (int) staircases.size(); i++) {
+        plane = out.data() + start + staircases_offset + i * FLOOR_FILE_STAIRCASE_SIZE;
+        plane[0] = staircases[i].x;
+        plane[1] = staircases[i].y;
+        plane[2] = cells[staircases[i].x][staircases[i].y].type;
+    }
+
+    plane = out.data() + start + planes_offset;
+    for (x = 0; x < width; x++) {
+        for (y = 0; y < height; y++) {
+            plane[x * height + y] = cells[x][y].type;
+            plane[cell_count + x * height + y] = cells[x][y].hardness;
+            plane[2 * cell_count + x * height + y] = cells[x][y].attributes;
+            plane[3 * cell_count + x * height + y] = cells[x][y].wall_type;
+        }
+    }
+
+    for (i = 0; i < (int) decorations.size(); i++) {
+        offset = start + decorations_offset + i * FLOOR_FILE_DECORATION_SIZE;
+        out[offset] = decorations[i].x;
+        out[offset + 1] = decorations[i].y;
+        put_u16(out, offset + 2, string_index[*cells[decorations[i].x][decorations[i].y].decoration_texture]);
+    }
+
+    offset = start + strings_offset;
+    for (std::string *string : strings) {
+        length = MIN(string->length(), (size_t) UINT16_MAX);
+        put_u16(out, offset, length);
+        memcpy(out.data() + offset + 2, string->data(), length);
+        offset += 2 + length;
+    }
+}
+
+void Dungeon::save_floor(const char *path) {
+    std::vector<uint8_t> out;
+    FILE *f;
+    write_floor(out);
+    f = fopen(path, "wb");
+    if (!f) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to open " + std::string(path) + " for writing");
+    if (fwrite(out.data(), 1, out.size(), f) != out.size()) {
+        fclose(f);
+        throw dungeon_exception(__PRETTY_FUNCTION__, "failed to write " + std::string(path));
+    }
+    fclose(f);
+}
@@ -0,0 +1,77 @@
+/**
+ * A versioned binary format for generated floors, replacing RLG327 (which only
+ * handled 80x21 dungeons). Everything is little-endian, and the cell data is
+ * stored as flat planes in the same x * height + y order as the rest of the
+ * generator, so loading a floor is just mapping the file and copying planes
+ * over with no parsing.
+ *
+ * Layout, with every section offset stored in the header:
+ * - Header: FLOOR_FILE_HEADER_SIZE bytes, see the offsets below
+ * - Rooms: room_count entries of x0, y0, x1, y1 (1 byte each)
+ * - Staircases: staircase_count entries of x, y, cell type (1 byte each)
+ * - Cell planes: width * height bytes each of cell type, hardness, attributes,
+ *   and wall type
+ * - Decorations: decoration_count entries of x, y (1 byte each), then a uint16
+ *   index into the string table
+ * - String table: string_count entries of a uint16 length, then the characters
+ */
+
+#ifndef FLOOR_FILE_H
+#define FLOOR_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define FLOOR_FILE_MAGIC "KB3FLOOR"
+#define FLOOR_FILE_MAGIC_SIZE 8
+// Bump whenever the layout changes. Older versions can still be read as long as
+// every field they have means the same thing.
+#define FLOOR_FILE_VERSION 1
+#define FLOOR_FILE_HEADER_SIZE 48
+
+// Header field offsets
+#define FLOOR_FILE_VERSION_OFFSET 8
+#define FLOOR_FILE_HEADER_SIZE_OFFSET 10
+#define FLOOR_FILE_WIDTH_OFFSET 12
+#define FLOOR_FILE_HEIGHT_OFFSET 13
+#define FLOOR_FILE_ROOM_COUNT_OFFSET 14
+#define FLOOR_FILE_STAIRCASE_COUNT_OFFSET 16
+#define FLOOR_FILE_DECORATION_COUNT_OFFSET 18
+#define FLOOR_FILE_STRING_COUNT_OFFSET 20
+#define FLOOR_FILE_ROOMS_OFFSET 24
+#define FLOOR_FILE_STAIRCASES_OFFSET 28
+#define FLOOR_FILE_PLANES_OFFSET 32
+#define FLOOR_FILE_DECORATIONS_OFFSET 36
+#define FLOOR_FILE_STRINGS_OFFSET 40
+#define FLOOR_FILE_SIZE_OFFSET 44
+
+#define FLOOR_FILE_PLANES 4
+#define FLOOR_FILE_ROOM_SIZE 4
+#define FLOOR_FILE_STAIRCASE_SIZE 3
+#define FLOOR_FILE_DECORATION_SIZE 4
+
+/**
+ * A read-only memory mapping of a whole file, unmapped when this goes out of scope.
+ */
+class MappedFile {
+    private:
+        void *address;
+
+    public:
+        const uint8_t *data;
+        size_t size;
+
+        /**
+         * Maps a file into memory.
+         *
+         * Params:
+         * - path: Path to the file
+         */
+        MappedFile(const char *path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include <cstring>
+#include <endian.h>
+
+#include "floor_pack.h"
+#include "macros.h"
+#include "logger.h"
+
+static uint16_t get_u16(const uint8_t *data, size_t offset) {
+    uint16_t value;
+    memcpy(&value, data + offset, sizeof (value));
+    return le16toh(value);
+}
+
+static uint32_t get_u32(const uint8_t *data, size_t offset) {
+    uint32_t value;
+    memcpy(&value, data + offset, sizeof (value));
+    return le32toh(value);
+}
+
+static uint64_t get_u64(const uint8_t *data, size_t offset) {
+    uint64_t value;
+    memcpy(&value, data + offset, sizeof (value));
+    return le64toh(value);
+}
+
+static void put_u16(uint8_t *data, uint16_t value) {
+    value = htole16(value);
+    memcpy(data, &value, sizeof (value));
+}
+
+static void put_u32(uint8_t *data, uint32_t value) {
+    value = htole32(value);
+    memcpy(data, &value, sizeof (value));
+}
+
+static void put_u64(uint8_t *data, uint64_t value) {
+    value = htole64(value);
+    memcpy(data, &value, sizeof (value));
+}
+
+// FNV-1a, which is plenty for telling a handful of map entries apart.
+static void mix(uint64_t &hash, const void *data, size_t size) {
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= ((const uint8_t *) data)[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+static void mix(uint64_t &hash, int32_t value) {
+    value = htole32(value);
+    mix(hash, &value, sizeof (value));
+}
+
+static void mix(uint64_t &hash, const std::string &value) {
+    mix(hash, (int32_t) value.length());
+    mix(hash, value.data(), value.length());
+}
+
+uint64_t floor_fingerprint(const DungeonOptions &options) {
+    uint64_t hash = 14695981039346656037ULL;
+    // A floor made by an older generator could be laid out differently, so the format version counts too.
+    mix(hash, FLOOR_FILE_VERSION);
+    mix(hash, options.size.x);
+    mix(hash, options.size.y);
+    mix(hash, options.rooms.x);
+    mix(hash, options.rooms.y);
+    // Only whether there's a staircase matters for the layout, not where it goes.
+    mix(hash, options.up_staircase.length() > 0);
+    mix(hash, options.down_staircase.length() > 0);
+    mix(hash, options.noise);
+    mix(hash, options.noise_scale);
+    mix(hash, options.noise_octaves);
+    mix(hash, options.loop_chance);
+    mix(hash, (int32_t) options.decorations.size());
+    for (const std::string &decoration : options.decorations) mix(hash, decoration);
+    return hash;
+}
+
+FloorPack::FloorPack(const char *path) : file(path) {
+    uint64_t table;
+    uint32_t i;
+    const uint8_t *entry;
+
+    if (file.size < FLOOR_PACK_HEADER_SIZE || memcmp(file.data, FLOOR_PACK_MAGIC, FLOOR_PACK_MAGIC_SIZE) != 0)
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " is not a floor pack");
+    if (get_u16(file.data, FLOOR_PACK_VERSION_OFFSET) == 0 || get_u16(file.data, FLOOR_PACK_VERSION_OFFSET) > FLOOR_PACK_VERSION)
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " has an unsupported floor pack version");
+    if (get_u64(file.data, FLOOR_PACK_SIZE_OFFSET) != file.size)
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " is truncated or corrupt");
+
+    entry_count = get_u32(file.data, FLOOR_PACK_ENTRY_COUNT_OFFSET);
+    if (get_u64(file.data, FLOOR_PACK_INDEX_OFFSET) + (uint64_t) entry_count * FLOOR_PACK_ENTRY_SIZE > file.size)
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " has a truncated index");
+    index = file.data + get_u64(file.data, FLOOR_PACK_INDEX_OFFSET);
+
+    // The floors themselves are checked as they're loaded, but the tables are checked
+    // up front so sampling never has to.
+    for (i = 0; i < entry_count; i++) {
+        entry = index + i * FLOOR_PACK_ENTRY_SIZE;
+        table = get_u64(entry, FLOOR_PACK_ENTRY_TABLE_OFFSET);
+        if (get_u32(entry, FLOOR_PACK_ENTRY_FLOORS_OFFSET) == 0 || table + (uint64_t) get_u32(entry, FLOOR_PACK_ENTRY_FLOORS_OFFSET) * sizeof (uint64_t) > file.size)
+            throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " has a truncated floor table");
+        if (i > 0 && get_u64(entry, 0) <= get_u64(entry - FLOOR_PACK_ENTRY_SIZE, 0))
+            throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " has an unsorted index");
+    }
+    Logger::info(__FILE__, "opened floor pack " + std::string(path) + " with " + std::to_string(entry_count) + " entries");
+}
+
+const uint8_t *FloorPack::find(uint64_t fingerprint) const {
+    uint32_t low = 0, high = entry_count, middle;
+    uint64_t found;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        found = get_u64(index + middle * FLOOR_PACK_ENTRY_SIZE, 0);
+        if (found == fingerprint) return index + middle * FLOOR_PACK_ENTRY_SIZE;
+        if (found < fingerprint) low = middle + 1;
+        else high = middle;
+    }
+    return nullptr;
+}
+
+uint32_t FloorPack::count(const DungeonOptions &options) const {
+    const uint8_t *entry = find(floor_fingerprint(options));
+    return entry ? get_u32(entry, FLOOR_PACK_ENTRY_FLOORS_OFFSET) : 0;
+}
+
+Dungeon *FloorPack::sample(DungeonOptions &options, Rng rng) const {
+    const uint8_t *entry = find(floor_fingerprint(options));
+    uint64_t offset;
+    uint32_t size;
+    if (!entry) return nullptr;
+
+    offset = get_u64(file.data, get_u64(entry, FLOOR_PACK_ENTRY_TABLE_OFFSET) + (rng.next() % get_u32(entry, FLOOR_PACK_ENTRY_FLOORS_OFFSET)) * sizeof (uint64_t));
+    // Each floor knows its own size, which load_floor checks again.
+    if (offset + FLOOR_FILE_HEADER_SIZE > file.size)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "floor pack has a floor past the end of the file");
+    size = get_u32(file.data, offset + FLOOR_FILE_SIZE_OFFSET);
+    if (offset + size > file.size)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "floor pack has a floor past the end of the file");
+    return new Dungeon(options, file.data + offset, size);
+}
+
+FloorPackWriter::FloorPackWriter(const char *path) {
+    uint8_t header[FLOOR_PACK_HEADER_SIZE] = {0};
+    out = fopen(path, "wb");
+    if (!out) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to open " + std::string(path) + " for writing");
+    // The header's filled in by finish(), once the index has somewhere to go.
+    position = 0;
+    write(header, sizeof (header));
+}
+
+FloorPackWriter::~FloorPackWriter() {
+    if (out) fclose(out);
+}
+
+void FloorPackWriter::write(const uint8_t *data, size_t size) {
+    if (fwrite(data, 1, size, out) != size) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to write floor pack");
+    position += size;
+}
+
+void FloorPackWriter::add(uint64_t fingerprint, Dungeon &dungeon) {
+    if (!out) throw dungeon_exception(__PRETTY_FUNCTION__, "floor pack is already finished");
+    buffer.clear();
+    dungeon.write_floor(buffer);
+    entries[fingerprint].push_back(position);
+    write(buffer.data(), buffer.size());
+}
+
+uint64_t FloorPackWriter::finish() {
+    uint8_t header[FLOOR_PACK_HEADER_SIZE] = {0};
+    uint64_t index_offset = position, table_offset;
+    size_t i;
+    if (!out) throw dungeon_exception(__PRETTY_FUNCTION__, "floor pack is already finished");
+
+    // std::map is already sorted by fingerprint, which is what lookups expect.
+    buffer.assign(entries.size() * FLOOR_PACK_ENTRY_SIZE, 0);
+    table_offset = index_offset + buffer.size();
+    i = 0;
+    for (const auto &entry : entries) {
+        put_u64(buffer.data() + i * FLOOR_PACK_ENTRY_SIZE, entry.first);
+        put_u32(buffer.data() + i * FLOOR_PACK_ENTRY_SIZE + FLOOR_PACK_ENTRY_FLOORS_OFFSET, entry.second.size());
+        put_u64(buffer.data() + i * FLOOR_PACK_ENTRY_SIZE + FLOOR_PACK_ENTRY_TABLE_OFFSET, table_offset);
+        table_offset += entry.second.size() * sizeof (uint64_t);
+        i++;
+    }
+    write(buffer.data(), buffer.size());
+    for (const auto &entry : entries) {
+        buffer.assign(entry.second.size() * sizeof (uint64_t), 0);
+        for (i = 0; i < entry.second.size(); i++) put_u64(buffer.data() + i * sizeof (uint64_t), entry.second[i]);
+        write(buffer.data(), buffer.size());
+    }
+
+    memcpy(header, FLOOR_PACK_MAGIC, FLOOR_PACK_MAGIC_SIZE);
+    put_u16(header + FLOOR_PACK_VERSION_OFFSET, FLOOR_PACK_VERSION);
+    put_u16(header + FLOOR_PACK_HEADER_SIZE_OFFSET, FLOOR_PACK_HEADER_SIZE);
+    put_u32(header + FLOOR_PACK_ENTRY_COUNT_OFFSET, entries.size());
+    put_u64(header + FLOOR_PACK_INDEX_OFFSET, index_offset);
+    put_u64(header + FLOOR_PACK_SIZE_OFFSET, position);
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof (header), out) != sizeof (header) || fclose(out) != 0) {
+        out = nullptr;
+        throw dungeon_exception(__PRETTY_FUNCTION__, "failed to write floor pack header");
+    }
+    out = nullptr;
+    return position;
+}
@@ -0,0 +1,151 @@
+/**
+ * Packs of pre-generated floors, so a game can pick its floors out of a file
+ * instead of generating (and retrying) them at startup. Floors are grouped by
+ * a fingerprint of the options that shape them, so maps that share a floor
+ * layout share its entry, and a map file that's been edited since the pack was
+ * built just doesn't match anything and falls back to generating.
+ *
+ * Everything is little-endian. Each floor is stored as-is in the floor file
+ * format (see floor_file.h), so sampling one is a lookup plus a load_floor.
+ *
+ * Layout:
+ * - Header: FLOOR_PACK_HEADER_SIZE bytes, see the offsets below
+ * - Floors: every floor file, back to back
+ * - Index: entry_count entries of a uint64 fingerprint, a uint32 floor count,
+ *   4 bytes of padding, and a uint64 offset to that entry's floor table,
+ *   sorted by fingerprint
+ * - Floor tables: one uint64 offset per floor
+ */
+
+#ifndef FLOOR_PACK_H
+#define FLOOR_PACK_H
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include "dungeon.h"
+#include "floor_file.h"
+#include "random.h"
+
+#define FLOOR_PACK_MAGIC "KB3PACK"
+#define FLOOR_PACK_MAGIC_SIZE 8
+// Bump whenever the layout changes.
+#define FLOOR_PACK_VERSION 1
+#define FLOOR_PACK_HEADER_SIZE 32
+
+// Header field offsets
+#define FLOOR_PACK_VERSION_OFFSET 8
+#define FLOOR_PACK_HEADER_SIZE_OFFSET 10
+#define FLOOR_PACK_ENTRY_COUNT_OFFSET 12
+#define FLOOR_PACK_INDEX_OFFSET 16
+#define FLOOR_PACK_SIZE_OFFSET 24
+
+// Index entry field offsets
+#define FLOOR_PACK_ENTRY_FLOORS_OFFSET 8
+#define FLOOR_PACK_ENTRY_TABLE_OFFSET 16
+#define FLOOR_PACK_ENTRY_SIZE 24
+
+/**
+ * Hashes everything in a set of map options that changes how its floors are
+ * laid out or decorated. Monsters, items, and names aren't included, since
+ * those are placed after the floor's built.
+ *
+ * Params:
+ * - options: Options to hash
+ * Returns: The fingerprint
+ */
+uint64_t floor_fingerprint(const DungeonOptions &options);
+
+/**
+ * A floor pack opened for reading. The file stays mapped for as long as this
+ * exists, and it's never written to, so any number of threads can sample from
+ * it at once.
+ */
+class FloorPack {
+    private:
+        MappedFile file;
+        uint32_t entry_count;
+        const uint8_t *index;
+
+        /**
+         * Finds the index entry for a fingerprint.
+         *
+         * Params:
+         * - fingerprint: Fingerprint to look up
+         * Returns: The entry, or null if the pack has none
+         */
+        const uint8_t *find(uint64_t fingerprint) const;
+
+    public:
+        /**
+         * Opens and validates a pack.
+         *
+         * Params:
+         * - path: Path to the pack
+         */
+        FloorPack(const char *path);
+
+        /**
+         * Params:
+         * - options: Map options to look up
+         * Returns: How many floors the pack has for those options
+         */
+        uint32_t count(const DungeonOptions &options) const;
+
+        /**
+         * Loads a random floor for some map options out of the pack.
+         *
+         * Params:
+         * - options: Map options for the floor
+         * - rng: Stream to pick the floor with
+         * Returns: The new dungeon, or null if the pack has nothing for these options
+         */
+        Dungeon *sample(DungeonOptions &options, Rng rng) const;
+};
+
+/**
+ * Writes a floor pack. Floors go straight to the file as they're added, so
+ * only the index is kept in memory.
+ */
+class FloorPackWriter {
+    private:
+        FILE *out;
+        uint64_t position;
+        std::map<uint64_t, std::vector<uint64_t>> entries;
+        std::vector<uint8_t> buffer;
+
+        void write(const uint8_t *data, size_t size);
+
+    public:
+        /**
+         * Starts a new pack, replacing anything already at the path.
+         *
+         * Params:
+         * - path: Path to write to
+         */
+        FloorPackWriter(const char *path);
+        ~FloorPackWriter();
+
+        FloorPackWriter(const FloorPackWriter &) = delete;
+        FloorPackWriter &operator=(const FloorPackWriter &) = delete;
+
+        /**
+         * Adds a floor to the pack.
+         *
+         * Params:
+         * - fingerprint: Fingerprint of the options the floor was generated with
+         * - dungeon: The floor
+         */
+        void add(uint64_t fingerprint, Dungeon &dungeon);
+
+        /**
+         * Writes the index and closes the file. Nothing can be added after this.
+         *
+         * Returns: Size of the finished pack, in bytes
+         */
+        uint64_t finish();
+};
+
+#endif
@@ -12,6 +12,8 @@
 #include "logger.h"
 #include "decorations.h"
 #include "resource_manager.h"
+#include "thread_pool.h"
+#include "floor_pack.h"
 
 parser_definition_t MONSTER_PARSE_RULES[] {
     {.name = "NAME", .offset = offsetof(MonsterDefinition, name), .type = PARSE_TYPE_STRING, .required = true},
@@ -58,7 +60,11 @@ parser_definition_t DUNGEON_OPTIONS_PARSE_RULES[] {
     {.name = "BOSS", .offset = offsetof(DungeonOptions, boss), .type = PARSE_TYPE_STRING, .required = false},
     {.name = "DEFAULT", .offset = offsetof(DungeonOptions, is_default), .type = PARSE_TYPE_BOOL, .required = false},
     {.name = "KEY", .offset = offsetof(DungeonOptions, key), .type = PARSE_TYPE_STRING, .required = false},
-    {.name = "DECORATIONS", .offset = offsetof(DungeonOptions, decorations), .type = PARSE_TYPE_VECTOR_STRINGS, .required = true}
+    {.name = "DECORATIONS", .offset = offsetof(DungeonOptions, decorations), .type = PARSE_TYPE_VECTOR_STRINGS, .required = true},
+    {.name = "NOISE", .offset = offsetof(DungeonOptions, noise), .type = PARSE_TYPE_STRING, .required = false},
+    {.name = "NOISESCALE", .offset = offsetof(DungeonOptions, noise_scale), .type = PARSE_TYPE_INT, .required = false},
+    {.name = "NOISEOCTAVES", .offset = offsetof(DungeonOptions, noise_octaves), .type = PARSE_TYPE_INT, .required = false},
+    {.name = "LOOPS", .offset = offsetof(DungeonOptions, loop_chance), .type = PARSE_TYPE_INT, .required = false}
 };
 
 parser_definition_t VOICE_LINES_PARSE_RULES[] {
@@ -90,6 +96,16 @@ Game::Game(int debug) {
 }
 
 Game::~Game() {
+    // Floors still generating in the background use the map definitions, so they have to finish first.
+    delete generation_pool;
+    delete turn_pool;
+    for (auto &e : pending_floors) {
+        if (!e.second.dungeon.valid()) continue;
+        try {
+            delete e.second.dungeon.get();
+        } catch (dungeon_exception &ex) {}
+    }
+    delete floor_pack;
     for (const auto &e : monster_defs) {
         delete e.second->speed;
         delete e.second->damage;
@@ -130,6 +146,7 @@ void Game::init_monster_defs(const char *path) {
         throw dungeon_exception(__PRETTY_FUNCTION__, "failed to open file");
 
     monst_parser->parse(monster_defs, file);
+    for (const auto &e : monster_defs) e.second->id = e.first;
 }
 
 void Game::init_item_defs(const char *path) {
@@ -138,6 +155,7 @@ void Game::init_item_defs(const char *path) {
         throw dungeon_exception(__PRETTY_FUNCTION__, "failed to open file");
 
     item_parser->parse(item_defs, file);
+    for (const auto &e : item_defs) e.second->id = e.first;
 }
 
 void Game::init_maps(const char *path) {
@@ -154,6 +172,12 @@ void Game::init_maps(const char *path) {
     }
 }
 
+std::vector<std::string> Game::map_names() {
+    std::vector<std::string> names;
+    for (const auto &pair : map_defs) names.push_back(pair.first);
+    return names;
+}
+
 void Game::init_voice_lines(const char *path) {
     for (const auto &entry : std::filesystem::directory_iterator(path)) {
         if (entry.is_regular_file()) {
@@ -168,36 +192,6 @@ void Game::init_voice_lines(const char *path) {
     }
 }
 
-
-// void Game::init_from_file(const char *path) {
-//     IntPair pc_coords;
-//     FILE *f;
-//     f = fopen(path, "rb");
-//     if (f == NULL) {
-//         throw dungeon_exception(__PRETTY_FUNCTION__, "could not open the specified file");
-//     }
-//     try {
-//         this->dungeon->fill_from_file(f, debug, &pc_coords);
-//     }
-//     catch (dungeon_exception &e) {
-//         fclose(f);
-//         throw dungeon_exception(__PRETTY_FUNCTION__, e);
-//     }
-//     fclose(f);
-
-//     // Place the PC now
-//     pc.move_to(pc_coords, character_map);
-//     pc.dead = false;
-//     pc.display = '@';
-//     pc.speed = PC_SPEED;
-//     character_map[pc.x][pc.y] = &pc;
-
-//     update_pathfinding(dungeon, pathfinding_no_tunnel, pathfinding_tunnel, &pc);
-
-//     turn_queue.insert(&pc, 0);
-//     is_initialized = true;
-// }
-
 void Game::apply_dungeon(DungeonFloor &floor, IntPair pc_coords) {
     // If there's a dungeon active now, we need to clean it up.
     Character *ch;
@@ -214,128 +208,250 @@ void Game::apply_dungeon(DungeonFloor &floor, IntPair pc_coords) {
         if (character_map[pc.x][pc.y] == &pc) {
             character_map[pc.x][pc.y] = nullptr;
         }
+        characters->remove(&pc);
+        // The floor being left starts counting how long the PC's been away...
+        for (DungeonFloor *other : dungeons) {
+            if (other->dungeon == dungeon) other->left_at = turns;
+        }
     }
+    // ...and the one being entered catches up on its own.
+    if (floor.dungeon != dungeon) simulate_floor(floor, pc_coords);
         
     // Update the dungeon feature references
     dungeon = floor.dungeon;
     character_map = floor.character_map;
+    characters = &floor.characters;
     item_map = floor.item_map;
     pathfinding_tunnel = floor.pathfinding_tunnel;
     pathfinding_no_tunnel = floor.pathfinding_no_tunnel;
+    if (crowd_movement) congestion.rebuild(dungeon, *characters);
 
     // Toss everyone back in the turn queue
-    unsigned int x, y;
-    for (x = 0; x < dungeon->width; x++) {
-        for (y = 0; y < dungeon->height; y++) {
-            if (character_map[x][y]) {
-                turn_queue.insert(character_map[x][y], 1000 / character_map[x][y]->speed);
-            }
-        }
-    }
+    uint32_t i;
+    for (i = 0; i < characters->size(); i++) turn_queue.insert(characters->owner(i), 1000 / characters->speed(i));
     turn_queue.insert(&pc, 0);
     
-    // Move the PC to its new location
+    // Move the PC to its new location (which also takes it off the floor it was on)
     pc.location_initialized = false;
     pc.move_to(pc_coords, character_map);
+    characters->add(&pc);
 
     // And update pathfinding
-    update_pathfinding(dungeon, pathfinding_no_tunnel, pathfinding_tunnel, IntPair{(int) pc.x, (int) pc.y});
+    refresh_pathfinding();
+    // Room indexes are per floor, so this gets worked out again on the next turn.
+    pc_room = -1;
+    Logger::debug(__FILE__, "monster turns so far: " + std::to_string(monster_turns) + " taken, " + std::to_string(dormant_turns_skipped)
+        + " skipped while dormant, " + std::to_string(monsters_woken) + " wake-ups, " + std::to_string(pathfinding_updates)
+        + " pathfinding rebuilds");
+
+    prefetch_neighbours();
 }
 
-#define MUST_BE_PATHABLE(cell_type) (cell_type == CELL_TYPE_ROOM || cell_type == CELL_TYPE_HALL || cell_type == CELL_TYPE_UP_STAIRCASE || cell_type == CELL_TYPE_DOWN_STAIRCASE)
+Dungeon *Game::generate_floor(const std::string &id, DungeonOptions *options, Rng rng, unsigned int &retries, const FloorPack *pack) {
+    Dungeon *new_dungeon = nullptr;
+    unsigned int i, dec_i, dec_a, dec_c;
+    int repairs;
+    // Layout and decorations draw from separate streams, so changing a decoration scheme
+    // doesn't move the rooms around. Retries keep going from where the last attempt left off.
+    Rng layout_rng = rng.split("layout");
+    Rng decoration_rng = rng.split("decorations");
+
+    retries = 0;
+
+    // A packed floor was already generated and checked when the pack was built, so it
+    // only needs its own population stream like any other floor.
+    if (pack && (new_dungeon = pack->sample(*options, rng.split("pack")))) {
+        new_dungeon->rng = rng.split("population");
+        Logger::debug(__FILE__, "picked " + id + " out of the floor pack");
+        return new_dungeon;
+    }
+
+    // This is pretty bad, but the dungeons are randomly generated.
+    // There's always a possibility that we get really unlucky, and some
+    // placement is impossible, so this will get retried if so rather
+    // than crashing.
+    for (i = 0; i < MAX_DUNGEON_GENERATION_ATTEMPTS; i++) {
+        try {
+            new_dungeon = new Dungeon(*options);
+            new_dungeon->rng = rng.split("population");
+            {
+                RngScope scope(layout_rng);
+                new_dungeon->fill();
+            }
+            RngScope scope(decoration_rng);
+            dec_c = new_dungeon->options->decorations.size();
+
+            dec_i = 0;
+            for (Room &room : new_dungeon->rooms) {
+                dec_a = 0;
+                while (dec_a < MAX_DUNGEON_GENERATION_ATTEMPTS && !apply_scheme(parse_scheme(new_dungeon->options->decorations[dec_i]), new_dungeon, &room)) {
+                    dec_a++;   
+                    dec_i = (dec_i + 1) % dec_c;
+                }
+                // A plain room is still a perfectly good room, so this isn't worth a whole new floor.
+                if (dec_a == MAX_DUNGEON_GENERATION_ATTEMPTS) Logger::debug(__FILE__, "failed to apply any decoration scheme to room " + room.str() + ", leaving it plain");
+                dec_i = (dec_i + 1) % dec_c;
+            }
+
+            // I've tried to design every algorithm to be resilient to this, but if they were strict enough to completely avoid it
+            // the rooms would be sparse. It's possible that there are areas of the map that are inaccessible, so those get
+            // patched up here rather than tossing the whole floor.
+            repairs = new_dungeon->repair_connectivity();
+            if (repairs) Logger::debug(__FILE__, "made " + std::to_string(repairs) + " connectivity repairs to " + id);
+
+            // The repairs should have covered everything, but we'll double check.
+            ConnectivityReport report = new_dungeon->check_connectivity();
+            if (report.components > 1)
+                throw dungeon_exception(__PRETTY_FUNCTION__, "map generated with unreachable areas (" + std::to_string(report.components)
+                    + " patches, first stray cell at " + report.unreachable[0].str() + ")");
+
+            return new_dungeon;
+        } catch (dungeon_exception &e) {
+            delete new_dungeon;
+            new_dungeon = nullptr;
+            retries++;
+            Logger::debug(__FILE__, "failed to generate dungeon (attempt " + std::to_string(i) + "): " + std::string(e.what()));
+        }
+    }
+    throw dungeon_exception(__PRETTY_FUNCTION__, "failed to generate dungeon " + id + " after " STRING(MAX_DUNGEON_GENERATION_ATTEMPTS) " attempts");
+}
 
 void Game::init_from_map(std::string map_name) {
     std::map<std::string, DungeonOptions *> map = map_defs[map_name];
-    IntPair pc_coords;
+    std::vector<std::future<Dungeon *>> futures;
+    std::vector<Dungeon *> floors(map.size(), nullptr);
+    std::vector<unsigned int> retries(map.size(), 0);
+    std::exception_ptr failure = nullptr;
     DungeonFloor *dungeon_floor;
-    Dungeon *new_dungeon;
-    bool default_found = false;
-    unsigned int i, dec_i, dec_a, dec_c, x, y;
-    cell_type_t type;
+    std::string default_id;
+    unsigned int i;
+    // Anything drawn here directly, like where the PC starts, comes from the map's own stream.
+    Rng map_rng = rng.split("map:" + map_name);
+    RngScope scope(map_rng);
+    current_map = map_name;
+    play_rng = rng.split("play");
+    ambiance_rng = rng.split("ambiance");
 
     pc.dead = false;
     pc.display = '@';
     pc.speed = PC_SPEED;
 
     for (const auto &pair : map) {
-        // This is pretty bad, but the dungeons are randomly generated.
-        // There's always a possibility that we get really unlucky, and some
-        // placement is impossible, so this will get retried if so rather
-        // than crashing.
-        for (i = 0; i < MAX_DUNGEON_GENERATION_ATTEMPTS; i++) {
-            try {
-                new_dungeon = new Dungeon(*(pair.second));
-                new_dungeon->fill();
-                dec_c = new_dungeon->options->decorations.size();
-
-                dec_i = 0;
-                for (Room &room : new_dungeon->rooms) {
-                    dec_a = 0;
-                    while (dec_a < MAX_DUNGEON_GENERATION_ATTEMPTS && !apply_scheme(parse_scheme(new_dungeon->options->decorations[dec_i]), new_dungeon, &room)) {
-                        dec_a++;   
-                        dec_i = (dec_i + 1) % dec_c;
-                    }
-                    if (dec_a == MAX_DUNGEON_GENERATION_ATTEMPTS) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to apply any decoration scheme to room");
-                    dec_i = (dec_i + 1) % dec_c;
-                }
+        if (!pair.second->is_default) continue;
+        if (default_id.length() > 0) throw dungeon_exception(__PRETTY_FUNCTION__, "multiple default dungeons found");
+        default_id = pair.first;
+    }
+    if (default_id.length() == 0) throw dungeon_exception(__PRETTY_FUNCTION__, "no default dungeon found");
+
+    if (lazy_floors) {
+        // Each floor's stream only depends on its name, so it comes out the same as it
+        // would've if everything was built at once.
+        if (!generation_pool) generation_pool = new ThreadPool(generation_threads);
+        for (const auto &pair : map) {
+            pending_floors[pair.first].options = pair.second;
+            pending_floors[pair.first].rng = map_rng.split(pair.first);
+        }
+        dungeon_floor = get_floor(default_id);
+        apply_dungeon(*dungeon_floor, random_location_no_kill(dungeon_floor->dungeon, dungeon_floor->character_map));
+        return;
+    }
 
-                dungeon_floor = new DungeonFloor(pair.first, new_dungeon);
-
-                // I've tried to design every algorithm to be resilient to this, but if they were strict enough to completely avoid it
-                // the rooms would be sparse. It's possible that there are areas of the map that are inaccessible. If so, we need to
-                // toss it out. We can test that with a pathfinding run.
-                update_pathfinding(new_dungeon, dungeon_floor->pathfinding_no_tunnel, dungeon_floor->pathfinding_tunnel, new_dungeon->random_location());
-                for (x = 0; x < new_dungeon->width; x++) {
-                    for (y = 0; y < new_dungeon->height; y++) {
-                        type = new_dungeon->cells[x][y].type;
-                        if (MUST_BE_PATHABLE(type) && dungeon_floor->pathfinding_no_tunnel[x][y] == UINT32_MAX) {
-                            throw dungeon_exception(__PRETTY_FUNCTION__, "map generated with unreachable areas");
-                        }
-                    }
-                }
+    // Floors are built side by side, each from its own named stream, so the thread
+    // count doesn't change what comes out.
+    {
+        ThreadPool pool(generation_threads);
+        i = 0;
+        for (const auto &pair : map) {
+            const std::string &id = pair.first;
+            DungeonOptions *options = pair.second;
+            Rng floor_rng = map_rng.split(id);
+            unsigned int &floor_retries = retries[i++];
+            const FloorPack *pack = floor_pack;
+            futures.push_back(pool.submit([&id, options, floor_rng, &floor_retries, pack] {
+                return generate_floor(id, options, floor_rng, floor_retries, pack);
+            }));
+        }
 
-                break;
-            } catch (dungeon_exception &e) {
-                delete new_dungeon;
-                new_dungeon = nullptr;
-                Logger::debug(__FILE__, "failed to generate dungeon (attempt " + std::to_string(i) + "): " + std::string(e.what()));
+        // Everything gets waited on, even after a failure, so nothing's left running or leaked.
+        for (i = 0; i < futures.size(); i++) {
+            try {
+                floors[i] = futures[i].get();
+            } catch (...) {
+                if (!failure) failure = std::current_exception();
             }
         }
-        if (!new_dungeon) {
-            throw dungeon_exception(__PRETTY_FUNCTION__, "failed to generate dungeon after " STRING(MAX_DUNGEON_GENERATION_ATTEMPTS) " attempts");
-        }
-        random_monsters(new_dungeon, dungeon_floor->character_map);
-        random_items(new_dungeon, dungeon_floor->item_map);
+    }
+    for (i = 0; i < floors.size(); i++) generation_retries += retries[i];
+    if (failure) {
+        for (Dungeon *floor : floors) delete floor;
+        std::rethrow_exception(failure);
+    }
 
-        if (pair.second->is_default) {
-            if (default_found) throw dungeon_exception(__PRETTY_FUNCTION__, "multiple default dungeons found");
-            default_found = true;
-            apply_dungeon(*dungeon_floor, random_location_no_kill(new_dungeon, dungeon_floor->character_map));
-        }
+    // Monsters and items share definitions (uniques, artifacts), so they're still placed
+    // one floor at a time, in map order.
+    i = 0;
+    for (const auto &pair : map) {
+        dungeon_floor = add_floor(pair.first, floors[i++]);
+        if (pair.first == default_id)
+            apply_dungeon(*dungeon_floor, random_location_no_kill(dungeon_floor->dungeon, dungeon_floor->character_map));
+    }
+}
+
+DungeonFloor *Game::add_floor(const std::string &id, Dungeon *new_dungeon) {
+    DungeonFloor *dungeon_floor = new DungeonFloor(id, new_dungeon);
+    dungeons.push_back(dungeon_floor);
+    floors_generated++;
+    RngScope scope(new_dungeon->rng);
+    ArenaScope arena_scope(dungeon_floor->arena);
+    random_monsters(dungeon_floor->dungeon, dungeon_floor->character_map, dungeon_floor->characters);
+    random_items(dungeon_floor->dungeon, dungeon_floor->item_map);
+    return dungeon_floor;
+}
+
+void Game::prefetch_floor(const std::string &id) {
+    auto pending = pending_floors.find(id);
+    if (pending == pending_floors.end() || pending->second.dungeon.valid()) return;
+
+    // The entry stays put in the map until the result's been collected, so the worker can write its retries there.
+    DungeonOptions *options = pending->second.options;
+    Rng floor_rng = pending->second.rng;
+    unsigned int &retries = pending->second.retries;
+    const FloorPack *pack = floor_pack;
+    pending->second.dungeon = generation_pool->submit([id, options, floor_rng, &retries, pack] {
+        return generate_floor(id, options, floor_rng, retries, pack);
+    });
+}
 
-        dungeons.push_back(dungeon_floor);
+void Game::prefetch_neighbours() {
+    // If floors are being built lazily, get the neighbours going while the PC walks over to the stairs.
+    if (!generation_pool) return;
+    if (dungeon->options->up_staircase.length() > 0) prefetch_floor(dungeon->options->up_staircase);
+    if (dungeon->options->down_staircase.length() > 0) prefetch_floor(dungeon->options->down_staircase);
+}
+
+DungeonFloor *Game::get_floor(const std::string &id) {
+    Dungeon *new_dungeon;
+    for (DungeonFloor *dungeon_floor : dungeons) {
+        if (dungeon_floor->id == id) return dungeon_floor;
+    }
+
+    auto pending = pending_floors.find(id);
+    if (pending == pending_floors.end()) throw dungeon_exception(__PRETTY_FUNCTION__, "no floor with ID " + id);
+    // Normally this was started back when the PC got to a neighbouring floor, and it's long done.
+    prefetch_floor(id);
+    try {
+        new_dungeon = pending->second.dungeon.get();
+    } catch (dungeon_exception &e) {
+        generation_retries += pending->second.retries;
+        pending_floors.erase(pending);
+        throw dungeon_exception(__PRETTY_FUNCTION__, e, "failed to generate floor " + id);
     }
-    if (!default_found) throw dungeon_exception(__PRETTY_FUNCTION__, "no default dungeon found");
+    generation_retries += pending->second.retries;
+    pending_floors.erase(pending);
+    return add_floor(id, new_dungeon);
 }
 
-// void Game::write_to_file(const char *path) {
-//     if (!is_initialized) throw dungeon_exception(__PRETTY_FUNCTION__, "game is not yet initialized");
-//     FILE *f;
-//     IntPair pc_coords;
-//     f = fopen(path, "wb");
-//     if (f == NULL) throw dungeon_exception(__PRETTY_FUNCTION__, "couldn't open file for writing");
-//     pc_coords.x = pc.x;
-//     pc_coords.y = pc.y;
-//     try {
-//         dungeon->save_to_file(f, debug, &pc_coords);
-//     } catch (dungeon_exception &e) {
-//         fclose(f);
-//         throw dungeon_exception(__PRETTY_FUNCTION__, e);
-//     }
-//     fclose(f);
-// }
-
-void Game::random_monsters(Dungeon *t_dungeon, Character ***t_cmap) {
+void Game::random_monsters(Dungeon *t_dungeon, Character ***t_cmap, CharacterStore &t_characters) {
     if (monster_defs.size() == 0) throw dungeon_exception(__PRETTY_FUNCTION__, "no monster definitions are set");
 
     // Pick how many we want to generate.
@@ -351,7 +467,7 @@ void Game::random_monsters(Dungeon *t_dungeon, Character ***t_cmap) {
     for (i = 0; i < count; i++) {
         attempts = 0;
         while (attempts++ < MAX_GENERATION_ATTEMPTS) {
-            monster_i = rand() % t_dungeon->options->monsters.size();
+            monster_i = rng_rand() % t_dungeon->options->monsters.size();
             mid = t_dungeon->options->monsters[monster_i];
             if (monster_defs[mid]->abilities & MONSTER_ATTRIBUTE_UNIQUE) {
                 if (monster_defs[mid]->unique_slain) continue; // If we've already killed this type of unique monster
@@ -367,7 +483,7 @@ void Game::random_monsters(Dungeon *t_dungeon, Character ***t_cmap) {
                 }
                 if (!allowed) continue;
             }
-            if (rand() % 100 >= monster_defs[mid]->rarity) continue;
+            if (rng_rand() % 100 >= monster_defs[mid]->rarity) continue;
 
             break;
         }
@@ -376,6 +492,7 @@ void Game::random_monsters(Dungeon *t_dungeon, Character ***t_cmap) {
 
         // Now we can make a monster from this definition.
         monst = new Monster(monster_defs[mid], t_dungeon->options->key.length() == 0 ? nullptr : item_defs[t_dungeon->options->key]);
+        monst->rng = t_dungeon->rng.split(i);
         // Pick a location...
         try {
             loc = random_location_no_kill(t_dungeon, t_cmap);
@@ -384,21 +501,24 @@ void Game::random_monsters(Dungeon *t_dungeon, Character ***t_cmap) {
             throw dungeon_exception(__PRETTY_FUNCTION__, e, "no available space in dungeon for monster placement");
         }
         monst->move_to(loc, t_cmap);
+        t_characters.add(monst);
     }
 
     // Insert boss, if one is chosen
     if (t_dungeon->options->boss.length() > 0) {
         monst = new Monster(monster_defs[t_dungeon->options->boss], nullptr);
+        monst->rng = t_dungeon->rng.split(count);
         try {
             loc = random_location_no_kill(t_dungeon, t_cmap);
         } catch (dungeon_exception &e) {
             throw dungeon_exception(__PRETTY_FUNCTION__, e, "no available space in dungeon for monster placement");
         }
         monst->move_to(loc, t_cmap);
+        t_characters.add(monst);
     }
 }
 
-void Game::random_items(Dungeon *t_dungeon, Item ***t_imap) {
+void Game::random_items(Dungeon *t_dungeon, ItemMapStack **t_imap) {
     if (item_defs.size() == 0) throw dungeon_exception(__PRETTY_FUNCTION__, "no item definitions are set");
     // Ripped for the most part from random_monsters().
     // Pick how many we want to generate.
@@ -411,10 +531,10 @@ void Game::random_items(Dungeon *t_dungeon, Item ***t_imap) {
     for (int i = 0; i < count; i++) {
         attempts = 0;
         while (attempts++ < MAX_GENERATION_ATTEMPTS) {
-            item_i = rand() % t_dungeon->options->items.size();
+            item_i = rng_rand() % t_dungeon->options->items.size();
             iid = t_dungeon->options->items[item_i];
             if (item_defs[iid]->artifact && item_defs[iid]->artifact_created) continue;
-            if (rand() % 100 >= item_defs[iid]->rarity) continue;
+            if (rng_rand() % 100 >= item_defs[iid]->rarity) continue;
 
             break;
         }
@@ -424,17 +544,13 @@ void Game::random_items(Dungeon *t_dungeon, Item ***t_imap) {
         // Now we can make a monster from this definition.
         item = new Item(item_defs[iid]);
         // Pick a location...
-        try {
-            loc = t_dungeon->random_location();
-        } catch (dungeon_exception &e) {
+        std::optional<IntPair> free = t_dungeon->random_location();
+        if (!free) {
             delete item; // The rest of the ones in the queue already will be cleared out by the game destructor.
-            throw dungeon_exception(__PRETTY_FUNCTION__, e, "no available space in dungeon for item placement");
-        }
-        if (t_imap[loc.x][loc.y]) {
-            t_imap[loc.x][loc.y]->add_to_stack(item);
-        } else {
-            t_imap[loc.x][loc.y] = item;
+            throw dungeon_exception(__PRETTY_FUNCTION__, "no available space in dungeon for item placement");
         }
+        loc = *free;
+        t_imap[loc.x][loc.y].push(item);
     }
 }
 
@@ -456,6 +572,7 @@ void Game::try_move(int x_offset, int y_offset) {
     int i;
     unsigned int x, y;
     IntPair loc;
+    DungeonFloor *new_dungeon;
     int new_x = pc.x + x_offset;
     int new_y = pc.y + y_offset;
     if (new_x < 0) new_x = 0;
@@ -475,7 +592,10 @@ void Game::try_move(int x_offset, int y_offset) {
             // Attack the monster there
             damage = pc.damage_bonus();
             monst = (Monster *) (character_map[new_x][new_y]);
+            // Getting hit wakes it up, and so does the noise for anything else close by.
+            make_noise(IntPair{new_x, new_y}, DORMANCY_NOISE_RADIUS);
             monst->damage(damage, result, dungeon, item_map, character_map);
+            track_congestion(monst, IntPair{new_x, new_y});
             MessageQueue::get()->add(
                 "You hit &" +
                 std::to_string(monst->current_color()) +
@@ -500,43 +620,32 @@ void Game::try_move(int x_offset, int y_offset) {
             dungeon->cells[new_x][new_y].attributes |= CELL_ATTRIBUTE_UNLOCKED;
         }
         // Find the target dungeon floor
-        for (const auto &new_dungeon : dungeons) {
-            if (new_dungeon->id == dungeon->options->up_staircase) {
-                loc = random_location_no_kill(new_dungeon->dungeon, new_dungeon->character_map);
-                for (x = 0; x < new_dungeon->dungeon->width; x++) {
-                    for (y = 0; y < new_dungeon->dungeon->height; y++) {
-                        if (new_dungeon->dungeon->cells[x][y].type == CELL_TYPE_DOWN_STAIRCASE) {
-                            loc = IntPair{(int) (x + 1), (int) y};
-                        }
-                    }
+        new_dungeon = get_floor(dungeon->options->up_staircase);
+        loc = random_location_no_kill(new_dungeon->dungeon, new_dungeon->character_map);
+        for (x = 0; x < new_dungeon->dungeon->width; x++) {
+            for (y = 0; y < new_dungeon->dungeon->height; y++) {
+                if (new_dungeon->dungeon->cells[x][y].type == CELL_TYPE_DOWN_STAIRCASE) {
+                    loc = IntPair{(int) (x + 1), (int) y};
                 }
-                apply_dungeon(*new_dungeon, loc);
-                MessageQueue::get()->clear();
-                MessageQueue::get()->add("You go up the stairs to &b" + new_dungeon->dungeon->options->name + "&r.");
-                return;
-
             }
         }
-        throw dungeon_exception(__PRETTY_FUNCTION__, "no target floor with ID " + dungeon->options->up_staircase);
+        apply_dungeon(*new_dungeon, loc);
+        MessageQueue::get()->clear();
+        MessageQueue::get()->add("You go up the stairs to &b" + new_dungeon->dungeon->options->name + "&r.");
     } else if (dungeon->cells[new_x][new_y].type == CELL_TYPE_DOWN_STAIRCASE) {
         // Find the target dungeon floor
-        for (const auto &new_dungeon : dungeons) {
-            if (new_dungeon->id == dungeon->options->down_staircase) {
-                loc = random_location_no_kill(new_dungeon->dungeon, new_dungeon->character_map);
-                for (x = 0; x < new_dungeon->dungeon->width; x++) {
-                    for (y = 0; y < new_dungeon->dungeon->height; y++) {
-                        if (new_dungeon->dungeon->cells[x][y].type == CELL_TYPE_UP_STAIRCASE) {
-                            loc = IntPair{(int) (x) - 1, (int) y};
-                        }
-                    }
+        new_dungeon = get_floor(dungeon->options->down_staircase);
+        loc = random_location_no_kill(new_dungeon->dungeon, new_dungeon->character_map);
+        for (x = 0; x < new_dungeon->dungeon->width; x++) {
+            for (y = 0; y < new_dungeon->dungeon->height; y++) {
+                if (new_dungeon->dungeon->cells[x][y].type == CELL_TYPE_UP_STAIRCASE) {
+                    loc = IntPair{(int) (x) - 1, (int) y};
                 }
-                apply_dungeon(*new_dungeon, loc);
-                MessageQueue::get()->clear();
-                MessageQueue::get()->add("You go down the stairs to &b" + new_dungeon->dungeon->options->name + "&r.");
-                return;
             }
         }
-        throw dungeon_exception(__PRETTY_FUNCTION__, "no target floor with ID " + dungeon->options->up_staircase);
+        apply_dungeon(*new_dungeon, loc);
+        MessageQueue::get()->clear();
+        MessageQueue::get()->add("You go down the stairs to &b" + new_dungeon->dungeon->options->name + "&r.");
     } else {
         ResourceManager::get()->play_music("effects_step");
         pc.move_to((IntPair) {(uint8_t) new_x, (uint8_t) new_y}, character_map);
@@ -554,6 +663,7 @@ void Game::force_move(IntPair dest) {
             escape_col(monst->definition->name) +
             "&r, killing it instantly. Poor thing.");
         monst->die(result, dungeon, character_map, item_map);
+        track_congestion(monst, dest);
     }
     pc.move_to(dest, character_map);
 }
@@ -5,9 +5,12 @@
 #include "character.h"
 #include "parser.h"
 #include "item.h"
+#include <future>
+#include <new>
 #include <ncpp/NotCurses.hh>
 #include <notcurses/nckeys.h>
 #include "plane_manager.h"
+#include "pathfinding.h"
 
 extern char CHARACTERS_BY_CELL_TYPE[CELL_TYPES];
 extern int COLORS_BY_CELL_TYPE[CELL_TYPES];
@@ -26,12 +29,18 @@ class DungeonFloor {
   public:
     Dungeon *dungeon;
     Character ***character_map;
-    Item ***item_map;
+    ItemMapStack **item_map;
     std::string id;
     // It is completely unnecessary to have one for each dungeon, but they have arbitrary sizes now,
     // so to take the easy way out that's what I'm doing.
     uint32_t **pathfinding_tunnel;
     uint32_t **pathfinding_no_tunnel;
+    // Game::turns when the PC last left, so the floor can catch up when it comes back.
+    unsigned int left_at = 0;
+    // Everyone on character_map, for sweeps that don't care about the cells in between.
+    CharacterStore characters;
+    // Where this floor's monsters and items are allocated (see floor_arena.h).
+    FloorArena *arena;
 
     DungeonFloor(std::string id, Dungeon *dungeon) {
       this->id = id;
@@ -50,17 +59,16 @@ class DungeonFloor {
           for (j = 0; j < dungeon->height; j++) character_map[i][j] = NULL;
       }
 
-      item_map = (Item ***) malloc(dungeon->width * sizeof (Item**));
+      item_map = (ItemMapStack **) malloc(dungeon->width * sizeof (ItemMapStack*));
       if (item_map == NULL) {
           goto init_free_all_character_map;
       }
       for (i = 0; i < dungeon->width; i++) {
-          item_map[i] = (Item **) malloc(dungeon->height * sizeof (Item*));
+          item_map[i] = new (std::nothrow) ItemMapStack[dungeon->height];
           if (item_map[i] == NULL) {
-              for (j = 0; j < i; j++) free(item_map[j]);
+              for (j = 0; j < i; j++) delete[] item_map[j];
               goto init_free_item_map;
           }
-          for (j = 0; j < dungeon->height; j++) item_map[i][j] = NULL;
       }
 
       pathfinding_no_tunnel = (uint32_t **) malloc(dungeon->width * sizeof (uint32_t*));
@@ -87,6 +95,7 @@ class DungeonFloor {
           }
       }
 
+      arena = new FloorArena();
       return;
       init_free_pathfinding_tunnel:
       free(pathfinding_tunnel);
@@ -95,7 +104,7 @@ class DungeonFloor {
       init_free_pathfinding_no_tunnel:
       free(pathfinding_no_tunnel);
       init_free_all_item_map:
-      for (j = 0; j < dungeon->width; j++) free(item_map[j]);
+      for (j = 0; j < dungeon->width; j++) delete[] item_map[j];
       init_free_item_map:
       free(item_map);
       init_free_all_character_map:
@@ -113,30 +122,36 @@ class DungeonFloor {
         for (j = 0; j < dungeon->width; j++) free(pathfinding_no_tunnel[j]);
         free(pathfinding_no_tunnel);
 
-        Character *character;
-        unsigned int x, y;
-        for (x = 0; x < dungeon->width; x++) {
-            for (y = 0; y < dungeon->height; y++) {
-                character = character_map[x][y];
-                if (!character) continue;
-                if (character->type() == CHARACTER_TYPE_PC) continue;
-                destroy_character(character_map, character);
-            }
+        unsigned int x;
+        // Going backwards, whatever gets moved into a removed entity's place has already been seen.
+        for (x = characters.size(); x > 0; x--) {
+            if (characters.kind(x - 1) == CHARACTER_TYPE_PC) continue;
+            destroy_character(character_map, characters.owner(x - 1));
         }
-        for (x = 0; x < dungeon->width; x++) {
-            for (y = 0; y < dungeon->height; y++) {
-                if (item_map[x][y])
-                    delete item_map[x][y];
-            }
-        }
-        for (j = 0; j < dungeon->width; j++) free(item_map[j]);
+        // Each stack deletes whatever's still in it.
+        for (j = 0; j < dungeon->width; j++) delete[] item_map[j];
         free(item_map);
         for (j = 0; j < dungeon->width; j++) free(character_map[j]);
         free(character_map);
         delete dungeon;
+        // Anything that's left the floor keeps the arena alive until it's deleted too.
+        arena->retire();
     }
 };
 
+class ThreadPool;
+class FloorPack;
+
+// A floor that's had its seed drawn but hasn't been generated yet. Used when
+// floors are built lazily.
+typedef struct {
+    DungeonOptions *options;
+    Rng rng;
+    unsigned int retries;
+    // Only valid once generation has been started.
+    std::future<Dungeon *> dungeon;
+} PendingFloor;
+
 // To split up the dungeon from the game controls and such, this class
 // stores all of the critical info for the game.
 class Game {
@@ -146,7 +161,8 @@ class Game {
         uint32_t **pathfinding_no_tunnel;
         uint32_t **pathfinding_tunnel;
         Character ***character_map;
-        Item ***item_map;
+        CharacterStore *characters = nullptr;
+        ItemMapStack **item_map;
         int debug;
         Parser<MonsterDefinition> *monst_parser;
         Parser<ItemDefinition> *item_parser;
@@ -157,6 +173,19 @@ class Game {
         std::map<std::string, std::map<std::string, DungeonOptions *>> map_defs;
         std::map<std::string, std::map<std::string, VoiceLines *>> vl_defs;
         std::vector<DungeonFloor *> dungeons;
+        std::map<std::string, PendingFloor> pending_floors;
+        ThreadPool *generation_pool = nullptr;
+        // Started the first time enough monsters are due at once to be worth splitting up.
+        ThreadPool *turn_pool = nullptr;
+        // How crowded the current floor is, kept up to date when crowd_movement is on.
+        CongestionMap congestion;
+        // Whether the PC's moved since the pathfinding maps were last built.
+        bool pathfinding_stale = false;
+        // Reused every turn, for the monsters due in the current time slice and what they've decided.
+        std::vector<Monster *> due_monsters;
+        std::vector<MonsterIntent> intents;
+        // Pre-generated floors to sample from instead of generating, if one's been opened.
+        FloorPack *floor_pack = nullptr;
 
         ncpp::NotCurses *nc = nullptr;
         PlaneManager *planes = nullptr;
@@ -173,10 +202,43 @@ class Game {
         bool antidmg = false;
         IntPair pointer;
         game_result_t result = GAME_RESULT_RUNNING;
+        // Sounds and loading bars shouldn't change what happens in the game, so they get their own stream.
+        Rng ambiance_rng;
+        // The PC's actions, and anything else drawn while the game's running.
+        Rng play_rng;
+        std::string current_map;
+        // PC turns taken so far, which is also the clock floors the PC isn't on catch up to.
+        unsigned int turns = 0;
+        // Room the PC was in as of the last turn, or -1 for a hallway.
+        int pc_room = -1;
+        // Kept between saves so autosaving doesn't have to allocate every time.
+        std::vector<uint8_t> save_buffer;
 
 
     public:
         Dungeon *dungeon = nullptr;
+        // Every other stream in the game is split off of this one. Seed it before init_from_map to replay a run.
+        Rng rng;
+        // Counted by init_from_map, for reporting how often floors still get thrown out.
+        unsigned int floors_generated = 0;
+        unsigned int generation_retries = 0;
+        // Worker threads for floor generation and monster turns (0 for one per hardware thread).
+        unsigned int generation_threads = 0;
+        // Counted by run_until_pc, for seeing how many monster turns dormancy saves.
+        unsigned long monster_turns = 0;
+        unsigned long dormant_turns_skipped = 0;
+        unsigned long monsters_woken = 0;
+        // How many times the pathfinding maps actually got rebuilt, since most monster turns get by without.
+        unsigned long pathfinding_updates = 0;
+        // Have smart monsters spread out over side routes when they crowd, instead of all taking the shortest path.
+        bool crowd_movement = false;
+        // Only build the default floor up front, and build the rest in the background as the PC gets close.
+        bool lazy_floors = false;
+        // Where the game is saved, how often to save it (in PC turns, 0 for never), and
+        // whether to pick up from that save instead of starting a new game.
+        std::string save_path = "killbill3.sav";
+        unsigned int autosave_turns = 0;
+        bool resume = false;
 
         Game(int debug);
         ~Game();
@@ -203,26 +265,57 @@ class Game {
         void init_maps(const char *path);
         void init_voice_lines(const char *path);
 
+        /**
+         * Returns: The name of every map that's been read in
+         */
+        std::vector<std::string> map_names();
+
+
+        void init_from_map(std::string map_name);
+
+        void apply_dungeon(DungeonFloor &floor, IntPair pc_coords);
 
         /**
-         * Initializes the game's dungeon from an RLG327 file.
+         * Opens a floor pack. From then on, any floor the pack has entries for is
+         * picked out of it instead of being generated, and everything else is
+         * generated like usual.
          *
          * Params:
-         * - path: The path to the file to read.
+         * - path: The path to the pack
          */
-        //void init_from_file(const char *path);
+        void use_floor_pack(const char *path);
 
-        void init_from_map(std::string map_name);
+        /**
+         * Generates floors for every distinct set of map options across all of the
+         * maps that have been read in, and writes them to a floor pack. The floors
+         * and retries are added to floors_generated and generation_retries.
+         *
+         * Params:
+         * - path: The path to write the pack to
+         * - floors: Number of floors to generate for each set of options
+         * - seed: Seed for the first floor; the rest follow from it
+         * Returns: Size of the pack, in bytes
+         */
+        uint64_t build_floor_pack(const char *path, unsigned int floors, uint64_t seed);
 
-        void apply_dungeon(DungeonFloor &floor, IntPair pc_coords);
+        /**
+         * Saves the whole game to a file: every floor and everything on it, the PC and
+         * its inventory, and the turn queue. Floors that haven't been generated yet are
+         * saved as just their seeds.
+         *
+         * Params:
+         * - path: The path to the file to write
+         */
+        void save_game(const char *path);
 
         /**
-         * Writes the game's dungeon to an RLG327 file.
+         * Restores a game written by save_game, in place of init_from_map. Definitions
+         * and maps must already be read in.
          *
          * Params:
-         * - path: The path to the file to write.
+         * - path: The path to the file to read
          */
-        //void write_to_file(const char *path);
+        void load_game(const char *path);
 
         /**
          * Runs the game.
@@ -235,14 +328,159 @@ class Game {
          *  initialization and cleanup.
          */
         std::string run_menu(bool skip_intro);
+
+        /**
+         * Generates, decorates, and validates a single floor, retrying until it works,
+         * or picks one out of a floor pack if the pack has any for these options.
+         * Only touches its own floor, so it's safe to run on a worker thread.
+         *
+         * Params:
+         * - id: ID of the floor, for logging
+         * - options: Map options for the floor
+         * - rng: Stream for this floor
+         * - retries: Set to the number of attempts that were thrown out
+         * - pack: Floor pack to sample from, or null to always generate
+         * Returns: The new dungeon
+         */
+        static Dungeon *generate_floor(const std::string &id, DungeonOptions *options, Rng rng, unsigned int &retries, const FloorPack *pack);
+
+        /**
+         * Wraps a generated dungeon in a floor, fills it with monsters and items,
+         * and adds it to this game.
+         *
+         * Params:
+         * - id: ID of the floor
+         * - new_dungeon: The generated dungeon, which the floor takes ownership of
+         * Returns: The new floor
+         */
+        DungeonFloor *add_floor(const std::string &id, Dungeon *new_dungeon);
+
+        /**
+         * Catches a floor up on the time since the PC left it. Rather than taking real
+         *  turns, monsters wander between connected rooms or regroup with others, a
+         *  COARSE_SIM_TURNS chunk at a time. Monsters in hallways and bosses stay put.
+         *
+         * Params:
+         * - floor: The floor, which must not be the active one
+         * - keep_clear: Cell nothing should move into (where the PC's about to arrive)
+         */
+        void simulate_floor(DungeonFloor &floor, IntPair keep_clear);
+
+        /**
+         * Starts generating a pending floor in the background. Does nothing if it's
+         * already been started or built.
+         *
+         * Params:
+         * - id: ID of the floor
+         */
+        void prefetch_floor(const std::string &id);
+
+        /**
+         * Starts generating the floors the current floor's staircases lead to, if floors
+         * are being built lazily.
+         */
+        void prefetch_neighbours();
+
+        /**
+         * Finds a floor by its ID, building it first if it's still pending. This only
+         * blocks if the floor's generation hasn't finished yet.
+         *
+         * Params:
+         * - id: ID of the floor
+         * Returns: The floor
+         */
+        DungeonFloor *get_floor(const std::string &id);
+
+        /**
+         * Writes a stack of items to a save.
+         *
+         * Params:
+         * - out: Save to write to
+         * - items: The items, top first
+         * - count: How many there are
+         */
+        void save_item_stack(SaveWriter &out, Item *const *items, int count);
+
+        /**
+         * Reads back a stack written by save_item_stack.
+         *
+         * Params:
+         * - in: Save to read from
+         * - stack: Stack to put the items on the bottom of
+         */
+        void load_item_stack(SaveReader &in, ItemStack &stack);
+
+        /**
+         * Reads the PC's state, inventory and equipment from a save.
+         *
+         * Params:
+         * - in: Save to read from
+         * - target: PC to read them into
+         */
+        void load_pc(SaveReader &in, PC &target);
         void run_game();
 
         /**
           * Takes the turns of everything in the turn queue until the PC's turn (or
-          *  until it dies).
+          *  until it dies). Monsters due at the same time decide together, then move
+          *  one at a time in queue order.
           */
         void run_until_pc();
 
+        /**
+         * Fills in intents for every monster in due_monsters, spreading them over the
+         *  turn pool if there are enough of them.
+         */
+        void decide_turns();
+
+        /**
+         * Rebuilds the current floor's pathfinding maps around the PC.
+         */
+        void refresh_pathfinding();
+
+        /**
+         * Updates the congestion map for a character that might have moved or died,
+         *  if crowd movement is on.
+         *
+         * Params:
+         * - ch: Character to check
+         * - from: Where it was before
+         */
+        void track_congestion(Character *ch, IntPair from);
+
+        /**
+         * Checks whether the PC is close enough for a monster to notice it, without a
+         *  full line of sight check.
+         *
+         * Params:
+         * - monster: Monster to check
+         * Returns: True if the PC's within DORMANCY_RADIUS or in the monster's room
+         */
+        bool pc_nearby(Monster *monster);
+
+        /**
+         * Wakes a dormant monster up and moves its next turn up to now.
+         *
+         * Params:
+         * - monster: Monster to wake
+         */
+        void wake_monster(Monster *monster);
+
+        /**
+         * Wakes up every dormant monster within earshot of something.
+         *
+         * Params:
+         * - at: Where the noise came from
+         * - radius: How far it carries, in cells
+         */
+        void make_noise(IntPair at, int radius);
+
+        /**
+         * Keeps track of which room the PC's in, waking everything in a room as soon
+         *  as the PC walks into it.
+         */
+        void update_pc_room();
+
         /**
           * Displays the monster menu.
           */
@@ -280,12 +518,12 @@ class Game {
          * Adds randomized monsters, the count is the value of nummon (or random
          *  if that hasn't been set).
          */
-        void random_monsters(Dungeon *t_dungeon, Character ***t_cmap);
+        void random_monsters(Dungeon *t_dungeon, Character ***t_cmap, CharacterStore &t_characters);
 
         /**
          * Adds randomized items.
          */
-        void random_items(Dungeon *t_dungeon, Item ***t_imap);
+        void random_items(Dungeon *t_dungeon, ItemMapStack **t_imap);
 
         void render_inventory_box(std::string title, std::string labels, std::string input_tip, unsigned int x0, unsigned int y0);
         void render_inventory_item(Item *item, int i, bool selected, unsigned int x0, unsigned int y0);
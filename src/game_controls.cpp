@@ -43,8 +43,8 @@ void Game::ctrl_quit() {
 
 void Game::ctrl_grab_item() {
     if (teleport_mode || look_mode) return;
-    Item *target_item = item_map[pc.x][pc.y];
-    if (target_item == NULL) {
+    Item *target_item;
+    if (item_map[pc.x][pc.y].empty()) {
         MessageQueue::get()->clear();
         MessageQueue::get()->add("&0&bThere's no item here!");
         return;
@@ -54,11 +54,7 @@ void Game::ctrl_grab_item() {
         MessageQueue::get()->add("&0&bYour carry slots are full!");
         return;
     }
-    if (target_item->is_stacked()) {
-        item_map[pc.x][pc.y] = target_item->detach_stack();
-    } else {
-        item_map[pc.x][pc.y] = NULL;
-    }
+    target_item = item_map[pc.x][pc.y].remove(0);
     pc.add_to_inventory(target_item);
     MessageQueue::get()->add("You picked up &" + std::to_string(
         target_item->current_color()) + escape_col(target_item->definition->name) + "&r.");
@@ -13,6 +13,7 @@
 #include "message_queue.h"
 #include "resource_manager.h"
 #include "logger.h"
+#include "thread_pool.h"
 #include <bits/this_thread_sleep.h>
 
 const std::string CELL_TYPES_TO_FLOOR_TEXTURES[] = {
@@ -68,18 +69,20 @@ void Game::run_game() {
     unsigned int x, i, io, ii;
     timespec ts;
     Monster *monst;
+    // The PC's actions draw from their own stream, so a run can be replayed from its seed.
+    RngScope scope(play_rng);
     render_frame(true);
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    ts.tv_sec += rand() % 3 + 1;
+    ts.tv_sec += ambiance_rng.rand() % 3 + 1;
     while (true) {
         render_frame(false);
         while (!nc->get(&ts, &inp)) {
             // Pick a random monster to play some ambiance for :)
-            io = rand();
-            for (ii = 0; ii < (unsigned int) turn_queue.size(); ii++) {
-                i = (io + ii) % turn_queue.size();
-                if (turn_queue.at(i)->type() == CHARACTER_TYPE_MONSTER) {
-                    monst = (Monster *) turn_queue.at(i);
+            io = ambiance_rng.rand();
+            for (ii = 0; ii < characters->size(); ii++) {
+                i = (io + ii) % characters->size();
+                if (characters->kind(i) == CHARACTER_TYPE_MONSTER) {
+                    monst = (Monster *) characters->owner(i);
                     if (monst->definition->ambiance.length() > 0) {
                         ResourceManager::get()->play_music(monst->definition->ambiance);
                         break;
@@ -87,7 +90,7 @@ void Game::run_game() {
                 }
             }
             clock_gettime(CLOCK_MONOTONIC, &ts);
-            ts.tv_sec += rand() % 7 + 2;
+            ts.tv_sec += ambiance_rng.rand() % 7 + 2;
         }
 
         if (result != GAME_RESULT_RUNNING) {
@@ -133,10 +136,10 @@ void Game::run_game() {
             bsod_plane->printf(y_start + frown_size + 8 + qr_size - 1, 6 + qr_size * 2, "%s", stop.c_str());
             x = 0;
             while (x <= 100) {
-                x += rand() % 31;
+                x += ambiance_rng.rand() % 31;
                 bsod_plane->printf(y_start + frown_size + 5, 5, "%d%% complete", x > 100 ? 100 : x);
                 nc->render();
-                std::this_thread::sleep_for(std::chrono::milliseconds(500 + rand() % 1501));
+                std::this_thread::sleep_for(std::chrono::milliseconds(500 + ambiance_rng.rand() % 1501));
             }
 
             std::this_thread::sleep_for(std::chrono::milliseconds(2000));
@@ -151,9 +154,21 @@ void Game::run_game() {
         if (game_exit) return;
 
         if (result == GAME_RESULT_RUNNING && next_turn_ready) {
-            update_pathfinding(dungeon, pathfinding_no_tunnel, pathfinding_tunnel, IntPair{pc.x, pc.y});
+            // The PC's probably moved, but the maps only get rebuilt if a monster actually needs them.
+            pathfinding_stale = true;
             // Run the game until the PC's turn comes up again (or it dies)
             run_until_pc();
+            dungeon->apply_wall_edits();
+            turns++;
+            if (autosave_turns && result == GAME_RESULT_RUNNING && turns % autosave_turns == 0) {
+                // A save that didn't go through isn't worth losing the game over.
+                try {
+                    save_game(save_path.c_str());
+                } catch (dungeon_exception &e) {
+                    Logger::error(__FILE__, "autosave failed: " + std::string(e.what()));
+                    MessageQueue::get()->add("&0&bAutosave failed!");
+                }
+            }
         }
         if (result != GAME_RESULT_RUNNING) {
             MessageQueue::get()->clear();
@@ -165,10 +180,14 @@ void Game::run_game() {
 }
 
 void Game::run_until_pc() {
-    Character *ch = NULL;
+    Character *ch = NULL, *occupant;
     Monster *monster;
+    IntPair from, occupant_from;
     uint32_t priority;
+    size_t i;
 
+    update_pc_room();
+    due_monsters.clear();
     while (true) {
         ch = NULL;
         while (turn_queue.size() > 0 && ch == NULL) {
@@ -195,15 +214,163 @@ void Game::run_until_pc() {
         }
 
         monster = (Monster *) ch;
-        result = GAME_RESULT_RUNNING;
-        monster->take_turn(dungeon, &pc, turn_queue, character_map, item_map, pathfinding_tunnel, pathfinding_no_tunnel, priority, result);
+        if (monster->can_go_dormant() && !pc_nearby(monster)) {
+            // Nothing out here can notice the PC, so instead of a full turn it checks back in a few turns
+            // from now. It doesn't use up the PC's step either, since it isn't doing anything.
+            monster->dormant = true;
+            turn_queue.insert(monster, priority + monster->speed * DORMANCY_INTERVAL);
+            dormant_turns_skipped += DORMANCY_INTERVAL;
+            continue;
+        }
+        due_monsters.push_back(monster);
+        break;
+    }
+
+    // Everything else due at the same time goes with it, up to the PC, which has to see
+    // what they did before it moves.
+    while (turn_queue.size() > 0 && turn_queue.top_priority() == priority && turn_queue.top() != &pc) {
+        ch = turn_queue.remove();
+        if (ch->dead) {
+            destroy_character(character_map, ch);
+            continue;
+        }
+        monster = (Monster *) ch;
+        if (monster->can_go_dormant() && !pc_nearby(monster)) {
+            monster->dormant = true;
+            turn_queue.insert(monster, priority + monster->speed * DORMANCY_INTERVAL);
+            dormant_turns_skipped += DORMANCY_INTERVAL;
+            continue;
+        }
+        due_monsters.push_back(monster);
+    }
+
+    if (pathfinding_stale) {
+        for (Monster *due : due_monsters) {
+            if (due->needs_pathfinding(dungeon, &pc, crowd_movement)) {
+                refresh_pathfinding();
+                break;
+            }
+        }
+    }
+
+    // Deciding only reads the floor, so it can happen all at once...
+    decide_turns();
+
+    // ...but moving and fighting happen one at a time, in the order the queue handed them out.
+    result = GAME_RESULT_RUNNING;
+    for (i = 0; i < due_monsters.size(); i++) {
+        monster = due_monsters[i];
+        if (pc.dead) {
+            // The rest never got to go.
+            turn_queue.insert(monster, priority);
+            continue;
+        }
+        if (monster->dormant) {
+            monster->dormant = false;
+            monsters_woken++;
+        }
+        monster_turns++;
+        // Something earlier in the slice pushed it aside, so its plan's from the wrong cell.
+        if (intents[i].from.x != monster->x || intents[i].from.y != monster->y) {
+            if (pathfinding_stale && monster->needs_pathfinding(dungeon, &pc, crowd_movement)) refresh_pathfinding();
+            intents[i] = monster->decide_turn(dungeon, &pc, pathfinding_tunnel, pathfinding_no_tunnel, crowd_movement ? &congestion : nullptr);
+        }
+        // Whatever's in the way might get shoved aside, so it's tracked too.
+        from = IntPair{monster->x, monster->y};
+        occupant = intents[i].can_move ? character_map[intents[i].next.x][intents[i].next.y] : NULL;
+        if (occupant) occupant_from = IntPair{occupant->x, occupant->y};
+        monster->resolve_turn(intents[i], dungeon, &pc, character_map, item_map, result);
+        track_congestion(monster, from);
+        if (occupant) track_congestion(occupant, occupant_from);
+        turn_queue.insert(monster, priority + monster->speed);
         if (antidmg) {
             pc.hp = pc.base_hp;
             pc.dead = false;
         }
         if (pc.dead) result = GAME_RESULT_LOSE;
+    }
+}
+
+void Game::decide_turns() {
+    std::vector<std::future<void>> batches;
+    size_t i;
+
+    intents.resize(due_monsters.size());
+    if (due_monsters.size() <= MONSTER_DECIDE_BATCH) {
+        for (i = 0; i < due_monsters.size(); i++)
+            intents[i] = due_monsters[i]->decide_turn(dungeon, &pc, pathfinding_tunnel, pathfinding_no_tunnel, crowd_movement ? &congestion : nullptr);
         return;
     }
+
+    // Each monster only touches its own memory and stream, and writes its own slot, so
+    // it comes out the same no matter how the batches land on the workers.
+    if (!turn_pool) turn_pool = new ThreadPool(generation_threads);
+    for (i = 0; i < due_monsters.size(); i += MONSTER_DECIDE_BATCH) {
+        size_t first = i, last = MIN(i + MONSTER_DECIDE_BATCH, due_monsters.size());
+        batches.push_back(turn_pool->submit([this, first, last] {
+            size_t j;
+            for (j = first; j < last; j++)
+                intents[j] = due_monsters[j]->decide_turn(dungeon, &pc, pathfinding_tunnel, pathfinding_no_tunnel, crowd_movement ? &congestion : nullptr);
+        }));
+    }
+    for (std::future<void> &batch : batches) batch.get();
+}
+
+void Game::refresh_pathfinding() {
+    update_pathfinding(dungeon, pathfinding_no_tunnel, pathfinding_tunnel, IntPair{pc.x, pc.y});
+    pathfinding_stale = false;
+    pathfinding_updates++;
+}
+
+void Game::track_congestion(Character *ch, IntPair from) {
+    if (!crowd_movement || ch->type() != CHARACTER_TYPE_MONSTER) return;
+    if (ch->dead) {
+        congestion.leave(from);
+    } else if (ch->x != from.x || ch->y != from.y) {
+        congestion.leave(from);
+        congestion.enter(IntPair{ch->x, ch->y});
+    }
+}
+
+bool Game::pc_nearby(Monster *monster) {
+    if (abs(monster->x - pc.x) <= DORMANCY_RADIUS && abs(monster->y - pc.y) <= DORMANCY_RADIUS) return true;
+    return pc_room >= 0 && dungeon->room_at(IntPair{monster->x, monster->y}) == pc_room;
+}
+
+void Game::wake_monster(Monster *monster) {
+    int i;
+    if (!monster->dormant) return;
+    monster->dormant = false;
+    monsters_woken++;
+    // Its next check-in could be a few turns off, so it goes next instead.
+    for (i = 0; i < turn_queue.size(); i++) {
+        if (turn_queue.at(i) != monster) continue;
+        if (turn_queue.priority_at(i) > turn_queue.top_priority()) turn_queue.decrease_priority(monster, turn_queue.top_priority());
+        break;
+    }
+}
+
+void Game::make_noise(IntPair at, int radius) {
+    int x, y;
+    for (x = MAX(at.x - radius, 0); x <= MIN(at.x + radius, dungeon->width - 1); x++) {
+        for (y = MAX(at.y - radius, 0); y <= MIN(at.y + radius, dungeon->height - 1); y++) {
+            if (character_map[x][y] && character_map[x][y]->type() == CHARACTER_TYPE_MONSTER) wake_monster((Monster *) character_map[x][y]);
+        }
+    }
+}
+
+void Game::update_pc_room() {
+    int room = dungeon->room_at(IntPair{pc.x, pc.y});
+    int x, y;
+    if (room == pc_room) return;
+    pc_room = room;
+    if (room < 0) return;
+    // The radius doesn't cover every corner of a big room, but anything in it can see the PC walk in.
+    for (x = dungeon->rooms[room].x0; x <= dungeon->rooms[room].x1; x++) {
+        for (y = dungeon->rooms[room].y0; y <= dungeon->rooms[room].y1; y++) {
+            if (character_map[x][y] && character_map[x][y]->type() == CHARACTER_TYPE_MONSTER) wake_monster((Monster *) character_map[x][y]);
+        }
+    }
 }
 
 void Game::render_frame(bool complete_redraw) {
@@ -293,8 +460,8 @@ void Game::render_frame(bool complete_redraw) {
                     }
                 }
                 // Then items.
-                else if (item_map[x][y]) {
-                    new_texture = item_map[x][y]->definition->floor_texture;
+                else if (!item_map[x][y].empty()) {
+                    new_texture = item_map[x][y].top()->definition->floor_texture;
                 }
                 // Then regular cells.
                 else {
@@ -375,9 +542,9 @@ void Game::render_frame(bool complete_redraw) {
             plane->move_top();
             render_monster_details(plane, (Monster *) character_map[pointer.x][pointer.y], 0, 0, DETAILS_WIDTH, DETAILS_HEIGHT);
         }
-        else if (item_map[pointer.x][pointer.y]) {
+        else if (!item_map[pointer.x][pointer.y].empty()) {
             plane->move_top();
-            render_inventory_details(plane, item_map[pointer.x][pointer.y], 0, 0, DETAILS_WIDTH, DETAILS_HEIGHT);
+            render_inventory_details(plane, item_map[pointer.x][pointer.y].top(), 0, 0, DETAILS_WIDTH, DETAILS_HEIGHT);
         } else {
             NC_HIDE(nc, *plane);
         }
@@ -637,7 +804,6 @@ void Game::inventory_menu() {
                     }
                     // Remove that item from the inventory...
                     target_item = pc.remove_from_inventory(menu_i);
-                    if (target_item->is_stacked()) throw dungeon_exception(__PRETTY_FUNCTION__, "invalid state: removed item is stacked");
                     // If the swap slot is empty, just add the item there.
                     if (pc.equipment[swap_slot] == NULL) {
                         MessageQueue::get()->add("You equipped &" + std::to_string(
@@ -695,11 +861,7 @@ void Game::inventory_menu() {
                 } else {
                     pc.equipment[menu_i] = nullptr;
                 }
-                if (item_map[pc.x][pc.y]) {
-                    item_map[pc.x][pc.y]->add_to_stack(target_item);
-                } else {
-                    item_map[pc.x][pc.y] = target_item;
-                }
+                item_map[pc.x][pc.y].push(target_item);
                 MessageQueue::get()->add("You dropped &" + std::to_string(
                     target_item->current_color()) + escape_col(target_item->definition->name) + "&r.");
                 break;
@@ -855,17 +1017,15 @@ void Game::cheater_menu() {
                         pointer.y = pc.y;
                         NC_HIDE(nc, *plane);
                         return;
-                    case 5:
-                        for (auto &f : dungeons) {
-                            if (dungeon->options->up_staircase == f->id) {
-                                apply_dungeon(*f, random_location_no_kill(f->dungeon, f->character_map));
-                                MessageQueue::get()->clear();
-                                MessageQueue::get()->add("You magically teleport to &b" + f->dungeon->options->name + "&r.");
-                                NC_HIDE(nc, *plane);
-                                return;
-                            }
-                        }
-                        break;
+                    case 5: {
+                        if (dungeon->options->up_staircase.length() == 0) break;
+                        DungeonFloor *f = get_floor(dungeon->options->up_staircase);
+                        apply_dungeon(*f, random_location_no_kill(f->dungeon, f->character_map));
+                        MessageQueue::get()->clear();
+                        MessageQueue::get()->add("You magically teleport to &b" + f->dungeon->options->name + "&r.");
+                        NC_HIDE(nc, *plane);
+                        return;
+                    }
                     case 6:
                         pc.hp = pc.base_hp;
                         break;
@@ -93,8 +93,12 @@ void Game::run(bool skip_intro) {
             CHEATER_MENU_WIDTH, CHEATER_MENU_HEIGHT);
         plane->move_bottom();
 
-        std::string map_name = run_menu(skip_intro);
-        init_from_map(map_name);
+        if (resume) {
+            load_game(save_path.c_str());
+        } else {
+            std::string map_name = run_menu(skip_intro);
+            init_from_map(map_name);
+        }
         run_game();
     } catch (dungeon_exception &e) {
         planes->clear();
@@ -0,0 +1,72 @@
+#include "game.h"
+#include "macros.h"
+#include "character.h"
+#include "logger.h"
+
+// Tries a few random cells in a room for one that's open, since rooms are rarely anywhere near full.
+static std::optional<IntPair> open_cell_in_room(Dungeon *dungeon, Character ***character_map, Room &room, IntPair keep_clear) {
+    int i, x, y;
+    for (i = 0; i < 10; i++) {
+        x = room.x0 + rng_rand() % (room.x1 - room.x0 + 1);
+        y = room.y0 + rng_rand() % (room.y1 - room.y0 + 1);
+        if (dungeon->cells[x][y].type != CELL_TYPE_ROOM || character_map[x][y]) continue;
+        if (x == keep_clear.x && y == keep_clear.y) continue;
+        return IntPair{x, y};
+    }
+    return std::nullopt;
+}
+
+void Game::simulate_floor(DungeonFloor &floor, IntPair keep_clear) {
+    Dungeon *t_dungeon = floor.dungeon;
+    std::vector<std::vector<int>> graph;
+    std::vector<Monster *> monsters;
+    std::vector<int> population;
+    std::optional<IntPair> to;
+    Monster *monst;
+    unsigned int steps, step, moves = 0;
+    uint32_t entity;
+    int room, target, i;
+
+    steps = turns > floor.left_at ? MIN((turns - floor.left_at) / COARSE_SIM_TURNS, (unsigned int) COARSE_SIM_MAX_STEPS) : 0;
+    floor.left_at = turns;
+    if (steps == 0 || t_dungeon->rooms.size() < 2) return;
+
+    // Everything's drawn from the floor's own stream, which is saved with it, so the same
+    // trip away always plays out the same way.
+    RngScope scope(t_dungeon->rng);
+    graph = t_dungeon->room_graph();
+    population.assign(t_dungeon->rooms.size(), 0);
+    for (entity = 0; entity < floor.characters.size(); entity++) {
+        if (floor.characters.kind(entity) != CHARACTER_TYPE_MONSTER) continue;
+        monst = (Monster *) floor.characters.owner(entity);
+        // Whatever it was chasing is long gone.
+        monst->forget_pc();
+        room = t_dungeon->room_at(floor.characters.position(entity));
+        if (room < 0 || monst->definition->abilities & MONSTER_ATTRIBUTE_BOSS) continue;
+        monsters.push_back(monst);
+        population[room]++;
+    }
+
+    for (step = 0; step < steps; step++) {
+        for (Monster *monster : monsters) {
+            room = t_dungeon->room_at(IntPair{monster->x, monster->y});
+            if (graph[room].empty() || rng_rand() % 100 >= COARSE_SIM_MOVE_CHANCE) continue;
+
+            // Either regroup in the busiest room next door, or just wander.
+            target = graph[room][rng_rand() % graph[room].size()];
+            if (rng_rand() % 100 < COARSE_SIM_REGROUP_CHANCE) {
+                for (i = 0; i < (int) graph[room].size(); i++) {
+                    if (population[graph[room][i]] > population[target]) target = graph[room][i];
+                }
+            }
+            to = open_cell_in_room(t_dungeon, floor.character_map, t_dungeon->rooms[target], keep_clear);
+            if (!to) continue;
+            monster->move_to(*to, floor.character_map);
+            population[room]--;
+            population[target]++;
+            moves++;
+        }
+    }
+    Logger::debug(__FILE__, "caught " + floor.id + " up on " + std::to_string(steps * COARSE_SIM_TURNS) + " turns ("
+        + std::to_string(monsters.size()) + " monsters, " + std::to_string(moves) + " moves)");
+}
@@ -0,0 +1,96 @@
+#include <deque>
+#include <thread>
+
+#include "game.h"
+#include "macros.h"
+#include "logger.h"
+#include "floor_pack.h"
+#include "thread_pool.h"
+
+void Game::use_floor_pack(const char *path) {
+    FloorPack *pack = new FloorPack(path);
+    unsigned int missing = 0;
+    delete floor_pack;
+    floor_pack = pack;
+    // Not an error, since those floors just get generated, but it's worth knowing the pack is stale.
+    for (const auto &map : map_defs) {
+        for (const auto &floor : map.second) {
+            if (floor_pack->count(*floor.second) == 0) {
+                Logger::info(__FILE__, "floor pack has nothing for " + map.first + "/" + floor.first + ", it'll be generated");
+                missing++;
+            }
+        }
+    }
+    if (missing) Logger::warn(__FILE__, std::to_string(missing) + " floors aren't in the floor pack, it may need rebuilding");
+}
+
+uint64_t Game::build_floor_pack(const char *path, unsigned int floors, uint64_t seed) {
+    std::map<uint64_t, DungeonOptions *> shapes;
+    std::deque<std::pair<uint64_t, std::future<std::pair<Dungeon *, unsigned int>>>> in_flight;
+    std::pair<Dungeon *, unsigned int> result;
+    FloorPackWriter writer(path);
+    Rng pack_rng(seed);
+    unsigned int i, window, failures = 0;
+
+    // Maps that share a floor layout share its floors too.
+    for (const auto &map : map_defs) {
+        for (const auto &floor : map.second) shapes.emplace(floor_fingerprint(*floor.second), floor.second);
+    }
+
+    ThreadPool pool(generation_threads);
+    // Only a few floors per worker are kept waiting, so the whole pack never has to fit in memory.
+    window = (generation_threads ? generation_threads : MAX(std::thread::hardware_concurrency(), 1u)) * 4;
+
+    try {
+        for (const auto &shape : shapes) {
+            uint64_t fingerprint = shape.first;
+            DungeonOptions *options = shape.second;
+            Rng shape_rng = pack_rng.split(fingerprint);
+            for (i = 0; i < floors; i++) {
+                Rng floor_rng = shape_rng.split(i);
+                in_flight.push_back({fingerprint, pool.submit([options, floor_rng] {
+                    unsigned int retries;
+                    Dungeon *new_dungeon = generate_floor(options->name, options, floor_rng, retries, nullptr);
+                    return std::pair<Dungeon *, unsigned int>(new_dungeon, retries);
+                })});
+
+                // Floors are written in the order they were started, so a seed always gives the same pack.
+                while (in_flight.size() >= window || (in_flight.size() > 0 && i + 1 == floors)) {
+                    uint64_t done_fingerprint = in_flight.front().first;
+                    std::future<std::pair<Dungeon *, unsigned int>> done = std::move(in_flight.front().second);
+                    in_flight.pop_front();
+                    try {
+                        result = done.get();
+                    } catch (dungeon_exception &e) {
+                        // One unlucky seed shouldn't throw away the rest of the pack.
+                        Logger::warn(__FILE__, "skipping a floor that failed to generate: " + std::string(e.what()));
+                        failures++;
+                        continue;
+                    }
+                    try {
+                        writer.add(done_fingerprint, *result.first);
+                    } catch (dungeon_exception &e) {
+                        delete result.first;
+                        throw;
+                    }
+                    delete result.first;
+                    floors_generated++;
+                    generation_retries += result.second;
+                }
+            }
+            Logger::info(__FILE__, "packed " + std::to_string(floors) + " floors like " + options->name + " ("
+                + std::to_string(options->size.x) + "x" + std::to_string(options->size.y) + ")");
+        }
+    } catch (dungeon_exception &e) {
+        // Everything still running has to be collected so nothing leaks.
+        for (auto &pending : in_flight) {
+            try {
+                delete pending.second.get().first;
+            } catch (dungeon_exception &ex) {}
+        }
+        throw dungeon_exception(__PRETTY_FUNCTION__, e, "failed to build floor pack " + std::string(path));
+    }
+
+    if (failures) Logger::warn(__FILE__, std::to_string(failures) + " floors failed to generate and were left out of the pack");
+    return writer.finish();
+}
@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "game.h"
+#include "macros.h"
+#include "character.h"
+#include "floor_file.h"
+#include "save_file.h"
+#include "pathfinding.h"
+#include "thread_pool.h"
+#include "logger.h"
+
+/**
+ * Save file layout. Everything is little-endian (see save_file.h), and strings
+ * are a uint16 length followed by the characters.
+ *
+ * - Magic, then a uint16 version and uint32 total size
+ * - Map name, the root and play random streams, and the turn count
+ * - IDs of every unique monster that's been slain and every artifact that's been made
+ * - PC: its state, inventory, and each equipment slot (as item stacks)
+ * - ID of the floor the PC is on
+ * - Each floor: ID, a length-prefixed floor (see floor_file.h), its random stream,
+ *   the turn the PC left it, its terrain edit count and the edits still in its
+ *   log as x, y, its monsters (definition, key drop, state, inventory), and its
+ *   items (x, y, stack)
+ * - Turn queue, in heap order: monster index on the current floor (or
+ *   SAVE_FILE_PC_INDEX), and priority
+ * - Each floor that hasn't been generated yet: ID and random stream
+ */
+
+void Game::save_item_stack(SaveWriter &out, Item *const *items, int count) {
+    int i;
+    out.write_u16(count);
+    for (i = 0; i < count; i++) {
+        out.write_string(items[i]->definition->id);
+        items[i]->save_state(out);
+    }
+}
+
+void Game::load_item_stack(SaveReader &in, ItemStack &stack) {
+    Item *item;
+    std::string id;
+    uint16_t count = in.read_u16();
+    while (count--) {
+        id = in.read_string();
+        auto def = item_defs.find(id);
+        if (def == item_defs.end()) throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an unknown item " + id);
+        item = new Item(def->second);
+        // Whatever's already on the stack belongs to the caller, even if this throws.
+        stack.push(item);
+        item->load_state(in);
+    }
+}
+
+void Game::save_game(const char *path) {
+    if (!dungeon) throw dungeon_exception(__PRETTY_FUNCTION__, "there's no game to save");
+    std::vector<Character *> monsters;
+    Character *ch;
+    DungeonFloor *current = nullptr;
+    Monster *monst;
+    std::string temp_path = std::string(path) + ".tmp";
+    size_t count_at;
+    uint32_t count;
+    int i, index;
+    unsigned int x, y;
+    FILE *f;
+
+    // The buffer keeps its capacity from the last save, so this usually doesn't allocate.
+    save_buffer.clear();
+    SaveWriter out(save_buffer);
+    save_buffer.insert(save_buffer.end(), SAVE_FILE_MAGIC, SAVE_FILE_MAGIC + SAVE_FILE_MAGIC_SIZE);
+    out.write_u16(SAVE_FILE_VERSION);
+    out.write_u32(0);
+
+    out.write_string(current_map);
+    out.write_rng(rng);
+    out.write_rng(play_rng);
+    out.write_u32(turns);
+
+    count_at = out.position();
+    count = 0;
+    out.write_u32(0);
+    for (const auto &e : monster_defs) {
+        if (!e.second->unique_slain) continue;
+        out.write_string(e.first);
+        count++;
+    }
+    out.patch_u32(count_at, count);
+    count_at = out.position();
+    count = 0;
+    out.write_u32(0);
+    for (const auto &e : item_defs) {
+        if (!e.second->artifact_created) continue;
+        out.write_string(e.first);
+        count++;
+    }
+    out.patch_u32(count_at, count);
+
+    pc.save_state(out);
+    save_item_stack(out, pc.get_inventory().begin(), pc.inventory_size());
+    // Equipment slots are saved as stacks of at most one.
+    for (i = 0; i < ARRAY_SIZE(pc.equipment); i++) save_item_stack(out, &pc.equipment[i], pc.equipment[i] ? 1 : 0);
+
+    for (DungeonFloor *floor : dungeons) {
+        if (floor->dungeon == dungeon) current = floor;
+    }
+    if (!current) throw dungeon_exception(__PRETTY_FUNCTION__, "the current floor isn't part of this game");
+    out.write_string(current->id);
+
+    out.write_u16(dungeons.size());
+    for (DungeonFloor *floor : dungeons) {
+        out.write_string(floor->id);
+        count_at = out.position();
+        out.write_u32(0);
+        floor->dungeon->write_floor(save_buffer);
+        out.patch_u32(count_at, out.position() - count_at - sizeof (uint32_t));
+        out.write_rng(floor->dungeon->rng);
+        out.write_u32(floor->left_at);
+        // Only what's still in the log is any use to cached paths, oldest first.
+        out.write_u32(floor->dungeon->terrain_edits());
+        for (count = floor->dungeon->terrain_edits() - MIN(floor->dungeon->terrain_edits(), TERRAIN_LOG_SIZE); count < floor->dungeon->terrain_edits(); count++) {
+            out.write_u8(floor->dungeon->terrain_edit(count).x);
+            out.write_u8(floor->dungeon->terrain_edit(count).y);
+        }
+
+        count_at = out.position();
+        count = 0;
+        out.write_u32(0);
+        // In entity order, so a loaded floor lines its store up the same way.
+        for (i = 0; i < (int) floor->characters.size(); i++) {
+            if (floor->characters.kind(i) != CHARACTER_TYPE_MONSTER) continue;
+            monst = (Monster *) floor->characters.owner(i);
+            out.write_string(monst->definition->id);
+            out.write_string(monst->get_key_drop() ? monst->get_key_drop()->id : "");
+            monst->save_state(out);
+            save_item_stack(out, monst->get_inventory().begin(), monst->inventory_size());
+            if (floor == current) monsters.push_back(monst);
+            count++;
+        }
+        out.patch_u32(count_at, count);
+
+        count_at = out.position();
+        count = 0;
+        out.write_u32(0);
+        for (x = 0; x < floor->dungeon->width; x++) {
+            for (y = 0; y < floor->dungeon->height; y++) {
+                if (floor->item_map[x][y].empty()) continue;
+                out.write_u8(x);
+                out.write_u8(y);
+                save_item_stack(out, floor->item_map[x][y].begin(), floor->item_map[x][y].size());
+                count++;
+            }
+        }
+        out.patch_u32(count_at, count);
+    }
+
+    // Dead monsters are still in the queue until their turn comes up, but they aren't saved.
+    count_at = out.position();
+    count = 0;
+    out.write_u32(0);
+    for (i = 0; i < turn_queue.size(); i++) {
+        ch = turn_queue.at(i);
+        if (ch == &pc) {
+            index = SAVE_FILE_PC_INDEX;
+        } else {
+            if (ch->dead) continue;
+            index = std::find(monsters.begin(), monsters.end(), ch) - monsters.begin();
+            if (index == (int) monsters.size()) continue;
+        }
+        out.write_u16(index);
+        out.write_u32(turn_queue.priority_at(i));
+        count++;
+    }
+    out.patch_u32(count_at, count);
+
+    out.write_u16(pending_floors.size());
+    for (const auto &e : pending_floors) {
+        out.write_string(e.first);
+        out.write_rng(e.second.rng);
+    }
+
+    out.patch_u32(SAVE_FILE_MAGIC_SIZE + sizeof (uint16_t), save_buffer.size());
+
+    // Written to the side and then moved over, so a crash mid-save doesn't take out the last good one.
+    f = fopen(temp_path.c_str(), "wb");
+    if (!f) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to open " + temp_path + " for writing");
+    if (fwrite(save_buffer.data(), 1, save_buffer.size(), f) != save_buffer.size()) {
+        fclose(f);
+        throw dungeon_exception(__PRETTY_FUNCTION__, "failed to write " + temp_path);
+    }
+    fclose(f);
+    if (rename(temp_path.c_str(), path) != 0) throw dungeon_exception(__PRETTY_FUNCTION__, "failed to replace " + std::string(path));
+    Logger::debug(__FILE__, "saved game to " + std::string(path) + " (" + std::to_string(save_buffer.size()) + " bytes)");
+}
+
+void Game::load_pc(SaveReader &in, PC &target) {
+    int i;
+    target.load_state(in);
+    load_item_stack(in, target.get_inventory());
+    for (i = 0; i < ARRAY_SIZE(target.equipment); i++) {
+        InlineItemStack<1> slot;
+        load_item_stack(in, slot);
+        delete target.equipment[i];
+        // Anything past the first item in a slot goes with the stack.
+        target.equipment[i] = slot.empty() ? nullptr : slot.remove(0);
+    }
+}
+
+void Game::load_game(const char *path) {
+    if (dungeon || dungeons.size() > 0) throw dungeon_exception(__PRETTY_FUNCTION__, "a game has already been started");
+    MappedFile file(path);
+    SaveReader in(file.data, file.size);
+    // Nothing is put in the game until the whole save has checked out, so a bad one
+    // leaves it just as it was.
+    std::vector<DungeonFloor *> floors;
+    std::map<std::string, PendingFloor> pending;
+    std::vector<std::pair<Character *, uint32_t>> queue;
+    std::vector<Character *> monsters;
+    std::vector<std::string> slain, artifacts;
+    std::string id, current_id, map_id;
+    Rng saved_rng, saved_play_rng;
+    DungeonFloor *floor, *current = nullptr;
+    DungeonOptions *options;
+    Dungeon *new_dungeon;
+    Monster *monst;
+    Character *ch;
+    const uint8_t *data;
+    uint32_t count, length, priority, saved_turns, j;
+    uint16_t floor_count, index, version;
+    size_t pc_at;
+    uint8_t x, y;
+
+    if (memcmp(in.read_block(SAVE_FILE_MAGIC_SIZE), SAVE_FILE_MAGIC, SAVE_FILE_MAGIC_SIZE) != 0)
+        throw dungeon_exception(__PRETTY_FUNCTION__, std::string(path) + " is not a save file");
+    version = in.read_u16();
+    if (version != SAVE_FILE_VERSION)
+        throw dungeon_exception(__PRETTY_FUNCTION__, "unsupported save file version " + std::to_string(version));
+    if (in.read_u32() != file.size) throw dungeon_exception(__PRETTY_FUNCTION__, "save file is truncated or corrupt");
+
+    map_id = in.read_string();
+    auto map = map_defs.find(map_id);
+    if (map == map_defs.end()) throw dungeon_exception(__PRETTY_FUNCTION__, "save file is for an unknown map " + map_id);
+    in.read_rng(saved_rng);
+    in.read_rng(saved_play_rng);
+    saved_turns = in.read_u32();
+
+    // Monsters and items roll their stats when they're made, but those get overwritten
+    // with the saved ones, so they draw from a throwaway stream.
+    Rng scratch;
+    RngScope scope(scratch);
+    PC loaded_pc;
+
+    count = in.read_u32();
+    for (j = 0; j < count; j++) slain.push_back(in.read_string());
+    count = in.read_u32();
+    for (j = 0; j < count; j++) artifacts.push_back(in.read_string());
+
+    // The PC's read into a stand-in first, and read again into the real one at the end.
+    pc_at = in.position();
+    load_pc(in, loaded_pc);
+
+    try {
+        current_id = in.read_string();
+        floor_count = in.read_u16();
+        while (floor_count--) {
+            id = in.read_string();
+            auto option = map->second.find(id);
+            if (option == map->second.end()) throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an unknown floor " + id);
+            options = option->second;
+            length = in.read_u32();
+            data = in.read_block(length);
+            new_dungeon = new Dungeon(*options, data, length);
+            try {
+                floor = new DungeonFloor(id, new_dungeon);
+            } catch (dungeon_exception &e) {
+                delete new_dungeon;
+                throw dungeon_exception(__PRETTY_FUNCTION__, e);
+            }
+            floors.push_back(floor);
+            in.read_rng(new_dungeon->rng);
+            floor->left_at = in.read_u32();
+            count = in.read_u32();
+            length = MIN(count, TERRAIN_LOG_SIZE);
+            new_dungeon->reset_terrain_log(count - length);
+            for (j = 0; j < length; j++) {
+                x = in.read_u8();
+                y = in.read_u8();
+                new_dungeon->log_terrain_edit(IntPair(x, y));
+            }
+            if (id == current_id) current = floor;
+
+            // The floor's monsters and items (and whatever they're carrying) go in its arena.
+            ArenaScope arena_scope(floor->arena);
+            count = in.read_u32();
+            for (j = 0; j < count; j++) {
+                id = in.read_string();
+                if (monster_defs.count(id) == 0) throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an unknown monster " + id);
+                std::string key = in.read_string();
+                if (key.length() > 0 && item_defs.count(key) == 0) throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an unknown item " + key);
+                monst = new Monster(monster_defs[id], key.length() > 0 ? item_defs[key] : nullptr);
+                try {
+                    monst->load_state(in);
+                    if (monst->x >= new_dungeon->width || monst->y >= new_dungeon->height || floor->character_map[monst->x][monst->y])
+                        throw dungeon_exception(__PRETTY_FUNCTION__, "save file has a monster in an invalid spot");
+                    load_item_stack(in, monst->get_inventory());
+                } catch (dungeon_exception &e) {
+                    delete monst;
+                    throw dungeon_exception(__PRETTY_FUNCTION__, e);
+                }
+                floor->character_map[monst->x][monst->y] = monst;
+                floor->characters.add(monst);
+                if (floor == current) monsters.push_back(monst);
+            }
+
+            count = in.read_u32();
+            for (j = 0; j < count; j++) {
+                x = in.read_u8();
+                y = in.read_u8();
+                if (x >= new_dungeon->width || y >= new_dungeon->height || !floor->item_map[x][y].empty())
+                    throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an item in an invalid spot");
+                load_item_stack(in, floor->item_map[x][y]);
+            }
+        }
+        if (!current) throw dungeon_exception(__PRETTY_FUNCTION__, "save file has no floor " + current_id);
+        if (loaded_pc.x >= current->dungeon->width || loaded_pc.y >= current->dungeon->height || current->character_map[loaded_pc.x][loaded_pc.y])
+            throw dungeon_exception(__PRETTY_FUNCTION__, "save file has the PC in an invalid spot");
+
+        // The queue was saved in heap order, so inserting it in the same order puts everything
+        // back exactly where it was.
+        count = in.read_u32();
+        for (j = 0; j < count; j++) {
+            index = in.read_u16();
+            priority = in.read_u32();
+            if (index == SAVE_FILE_PC_INDEX) ch = &pc;
+            else if (index < monsters.size()) ch = monsters[index];
+            else throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an invalid turn queue");
+            queue.push_back(std::make_pair(ch, priority));
+        }
+
+        floor_count = in.read_u16();
+        while (floor_count--) {
+            id = in.read_string();
+            auto option = map->second.find(id);
+            if (option == map->second.end()) throw dungeon_exception(__PRETTY_FUNCTION__, "save file has an unknown floor " + id);
+            pending[id].options = option->second;
+            in.read_rng(pending[id].rng);
+        }
+    } catch (dungeon_exception &) {
+        for (DungeonFloor *f : floors) delete f;
+        throw;
+    }
+
+    // Everything checked out, so it all goes in the game from here on.
+    current_map = map_id;
+    rng = saved_rng;
+    play_rng = saved_play_rng;
+    turns = saved_turns;
+    ambiance_rng = rng.split("ambiance");
+    SaveReader pc_in(file.data + pc_at, file.size - pc_at);
+    load_pc(pc_in, pc);
+    dungeons = floors;
+    floors_generated += floors.size();
+    for (const auto &entry : queue) turn_queue.insert(entry.first, entry.second);
+    pending_floors = std::move(pending);
+    if (pending_floors.size() > 0 && !generation_pool) generation_pool = new ThreadPool(generation_threads);
+
+    for (const auto &e : monster_defs) e.second->unique_slain = false;
+    for (const std::string &unique : slain) {
+        if (monster_defs.count(unique)) monster_defs[unique]->unique_slain = true;
+    }
+    // Making an item marks its artifact as made, so the saved flags go on last.
+    for (const auto &e : item_defs) e.second->artifact_created = false;
+    for (const std::string &artifact : artifacts) {
+        if (item_defs.count(artifact)) item_defs[artifact]->artifact_created = true;
+    }
+
+    // Same as apply_dungeon, minus rebuilding the turn queue and moving the PC.
+    dungeon = current->dungeon;
+    character_map = current->character_map;
+    characters = &current->characters;
+    item_map = current->item_map;
+    pathfinding_tunnel = current->pathfinding_tunnel;
+    pathfinding_no_tunnel = current->pathfinding_no_tunnel;
+    character_map[pc.x][pc.y] = &pc;
+    characters->add(&pc);
+    if (crowd_movement) congestion.rebuild(dungeon, *characters);
+    refresh_pathfinding();
+    pc_room = -1;
+    prefetch_neighbours();
+    result = GAME_RESULT_RUNNING;
+    Logger::debug(__FILE__, "loaded game from " + std::string(path));
+}
@@ -125,7 +125,7 @@ class BinaryHeap {
                 throw dungeon_exception(__PRETTY_FUNCTION__, "attempted to remove top of heap while empty");
             removed = items[0].item;
             items[0] = items[items.size() - 1];
-            items.erase(items.end());
+            items.pop_back();
             i = 0;
             while (1)
             {
@@ -1,6 +1,9 @@
+#include <algorithm>
+
 #include "item.h"
 #include "random.h"
 #include "macros.h"
+#include "save_file.h"
 
 Item::Item(ItemDefinition *definition) {
     if (definition->artifact) {
@@ -11,7 +14,6 @@ Item::Item(ItemDefinition *definition) {
     this->dodge_bonus = definition->dodge_bonus->roll();
     this->defense_bonus = definition->defense_bonus->roll();
     this->speed_bonus = definition->speed_bonus->roll();
-    this->next = NULL;
     color_count = 0;
     int i;
     int color_val = definition->color;
@@ -21,13 +23,6 @@ Item::Item(ItemDefinition *definition) {
     }
 }
 
-Item::~Item() {
-    // Deletes all stacked items too
-    if (next != NULL) {
-        delete next;
-    }
-}
-
 uint8_t Item::next_color() {
     color_i = (color_i + 1) % color_count;
     return current_color();
@@ -49,31 +44,51 @@ int Item::get_damage() {
     return definition->damage_bonus->roll();
 }
 
-void Item::add_to_stack(Item *item) {
-    Item *current = this;
-    while (current->next != NULL)
-        current = current->next;
-    current->next = item;
+void Item::save_state(SaveWriter &out) {
+    out.write_i32(dodge_bonus);
+    out.write_i32(defense_bonus);
+    out.write_i32(speed_bonus);
+    out.write_u8(color_i);
 }
 
-Item *Item::detach_stack() {
-    Item *removed = next;
-    next = NULL;
-    return removed;
+void Item::load_state(SaveReader &in) {
+    dodge_bonus = in.read_i32();
+    defense_bonus = in.read_i32();
+    speed_bonus = in.read_i32();
+    color_i = in.read_u8();
+    if (color_i >= color_count) color_i = 0;
 }
 
-Item *Item::remove_next_in_stack() {
-    Item *removed = next;
-    if (removed != NULL) next = removed->next;
-    else next = NULL;
-    removed->next = NULL;
+ItemStack::~ItemStack() {
+    if (capacity > inline_capacity) delete[] items;
+}
+
+void ItemStack::push(Item *item) {
+    Item **grown;
+    if (count == capacity) {
+        if (capacity > UINT16_MAX / 2) throw dungeon_exception(__PRETTY_FUNCTION__, "item stack is full");
+        grown = new Item *[capacity * 2];
+        std::copy(items, items + count, grown);
+        if (capacity > inline_capacity) delete[] items;
+        items = grown;
+        capacity *= 2;
+    }
+    items[count++] = item;
+}
+
+Item *ItemStack::remove(int i) {
+    Item *removed = at(i);
+    std::copy(items + i + 1, items + count, items + i);
+    count--;
     return removed;
 }
 
-Item *Item::next_in_stack() {
-    return next;
+void ItemStack::append(ItemStack &from) {
+    for (Item *item : from) push(item);
+    from.count = 0;
 }
 
-bool Item::is_stacked() {
-    return next != NULL;
-}
\ No newline at end of file
+void ItemStack::clear() {
+    for (Item *item : *this) delete item;
+    count = 0;
+}
@@ -5,6 +5,11 @@
 
 #include "dungeon.h"
 #include "random.h"
+#include "macros.h"
+#include "floor_arena.h"
+
+class SaveWriter;
+class SaveReader;
 
 typedef enum {
     ITEM_TYPE_WEAPON,  // Start of PC-equippable items
@@ -21,6 +26,8 @@ typedef enum {
 
 class ItemDefinition {
     public:
+        // The name it's listed under in the definition file, for save files.
+        std::string id;
         std::string name;
         std::string description;
         item_type_t type;
@@ -38,7 +45,6 @@ class ItemDefinition {
 
 class Item {
     private:
-        Item *next;
         int color_count;
         uint8_t color_i = 0;
 
@@ -47,16 +53,132 @@ class Item {
         int dodge_bonus, defense_bonus, speed_bonus;
 
         Item(ItemDefinition *definition);
-        ~Item();
+
+        // Made out of the active floor's arena, if there is one.
+        static void *operator new(size_t size) { return FloorArena::allocate_block(size); }
+        static void operator delete(void *object, size_t size) { FloorArena::release_block(object, size); }
 
         int get_damage();
-        void add_to_stack(Item *item);
-        Item *detach_stack();
-        Item *next_in_stack();
-        Item *remove_next_in_stack();
-        bool is_stacked();
         uint8_t next_color();
         uint8_t current_color();
+
+        /**
+         * Writes this item's rolled bonuses to a save. Its definition is left to
+         * the caller.
+         *
+         * Params:
+         * - out: Save to write to
+         */
+        void save_state(SaveWriter &out);
+
+        /**
+         * Reads back what save_state wrote.
+         *
+         * Params:
+         * - in: Save to read from
+         */
+        void load_state(SaveReader &in);
+};
+
+/**
+ * A stack of items, top first, kept in one array instead of being chained
+ * through the items themselves, so its size and any item in it are a single
+ * load away. Items go on at the bottom and can come out from anywhere, and
+ * whatever's still in the stack is deleted along with it.
+ *
+ * The storage for the first few items is part of the stack itself (see
+ * InlineItemStack). It only moves to the heap if the stack outgrows that.
+ */
+class ItemStack {
+    private:
+        Item **items;
+        uint16_t count = 0;
+        uint16_t capacity;
+        uint16_t inline_capacity;
+
+    protected:
+        ItemStack(Item **storage, uint16_t capacity) : items(storage), capacity(capacity), inline_capacity(capacity) {}
+        ~ItemStack();
+
+    public:
+        ItemStack(const ItemStack &) = delete;
+        ItemStack &operator=(const ItemStack &) = delete;
+
+        /**
+         * Returns: How many items are in the stack
+         */
+        int size() const { return count; }
+
+        /**
+         * Returns: Whether there's nothing in the stack
+         */
+        bool empty() const { return count == 0; }
+
+        /**
+         * Returns: The item on top (the one that's shown and picked up first), or NULL
+         */
+        Item *top() const { return count ? items[0] : NULL; }
+
+        /**
+         * Params:
+         * - i: Index into the stack, with 0 being the top
+         * Returns: The item there
+         */
+        Item *at(int i) const {
+            if (i < 0 || i >= count) throw dungeon_exception(__PRETTY_FUNCTION__, "item stack index out of bounds");
+            return items[i];
+        }
+
+        Item *const *begin() const { return items; }
+        Item *const *end() const { return items + count; }
+
+        /**
+         * Puts an item on the bottom of the stack.
+         *
+         * Params:
+         * - item: Item to add, which the stack now owns
+         */
+        void push(Item *item);
+
+        /**
+         * Takes an item out of the stack, keeping the rest in order.
+         *
+         * Params:
+         * - i: Index into the stack, with 0 being the top
+         * Returns: The item, which the caller now owns
+         */
+        Item *remove(int i);
+
+        /**
+         * Moves every item from another stack onto the bottom of this one, in order.
+         *
+         * Params:
+         * - from: Stack to empty out
+         */
+        void append(ItemStack &from);
+
+        /**
+         * Deletes everything in the stack.
+         */
+        void clear();
 };
 
+/**
+ * An ItemStack with room for INLINE items before it needs the heap.
+ */
+template <uint16_t INLINE>
+class InlineItemStack : public ItemStack {
+    static_assert(INLINE > 0, "an item stack needs room for at least one item");
+
+    private:
+        Item *storage[INLINE];
+
+    public:
+        InlineItemStack() : ItemStack(storage, INLINE) {}
+        ~InlineItemStack() { clear(); }
+};
+
+// One of these per cell, so they're kept small. Anything past the first item spills.
+typedef InlineItemStack<ITEM_MAP_INLINE_ITEMS> ItemMapStack;
+
 #endif
@@ -9,6 +9,7 @@ const char *log_level_names[] = {
 };
 
 void Logger::log(log_level_t level, const char *location, std::string log) {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     if (!levels_enabled[level]) return;
     std::ostringstream rendered_log;
     rendered_log << log_level_names[level] << " @ " << location << ": " << log;
@@ -25,12 +26,14 @@ void Logger::log(log_level_t level, const char *location, std::string log) {
 }
 
 void Logger::off() {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     if (!is_on) return;
     log(LOG_LEVEL_INFO, "logger", "logger disabled");
     is_on = false;
 }
 
 void Logger::on() {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     if (is_on) return;
     is_on = true;
     std::string backlog_log;
@@ -45,9 +48,11 @@ void Logger::on() {
 }
 
 void Logger::on(log_level_t level) {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     levels_enabled[level] = true;
 }
 
 void Logger::off(log_level_t level) {
+    std::lock_guard<std::recursive_mutex> guard(lock);
     levels_enabled[level] = false;
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <ncpp/Visual.hh>
 #include <filesystem>
 #include <deque>
+#include <mutex>
 
 typedef enum {
     LOG_LEVEL_DEBUG,
@@ -44,6 +45,9 @@ class Logger {
 
     private:
         std::deque<std::string> backlog;
+        // Floors can be generated on worker threads, which log too. Recursive since
+        // on() and off() log about themselves.
+        std::recursive_mutex lock;
         bool is_on = true;
         unsigned long max_backlog = 1000;
         bool levels_enabled[LOG_LEVEL_ERROR + 1];
@@ -9,6 +9,8 @@
 
 #include <string>
 
+#include "random.h"
+
 #define ROOM_MIN_COUNT 6
 #define ROOM_COUNT_MAX_RANDOMNESS 4
 #define ROOM_MIN_WIDTH 4
@@ -20,6 +22,8 @@
 #define RANDOM_ITEMS_MAX 15
 #define PC_SPEED 10
 #define MAX_CARRY_SLOTS 10
+// Items a cell of the item map holds before its stack goes to the heap.
+#define ITEM_MAP_INLINE_ITEMS 1
 
 #define FILE_HEADER "RLG327-S2025"
 #define FILE_VERSION 0
@@ -63,6 +67,38 @@
 
 #define MAX_DUNGEON_GENERATION_ATTEMPTS 25
 
+// Monsters further than this from the PC (in cells, either direction) and outside its room go
+// dormant, and only check in every DORMANCY_INTERVAL of their turns until something wakes them.
+#define DORMANCY_RADIUS 12
+#define DORMANCY_INTERVAL 4
+// How far the sound of a fight carries, waking anything dormant nearby.
+#define DORMANCY_NOISE_RADIUS 8
+
+// Floors the PC isn't on are caught up when it comes back, one step for every COARSE_SIM_TURNS
+// turns it was away, up to COARSE_SIM_MAX_STEPS (by then everyone's as shuffled as they'll get).
+#define COARSE_SIM_TURNS 25
+#define COARSE_SIM_MAX_STEPS 40
+// Percent chance each monster heads to another room on a step, and the percent of those moves
+// that go to the busiest neighbouring room instead of a random one.
+#define COARSE_SIM_MOVE_CHANCE 30
+#define COARSE_SIM_REGROUP_CHANCE 50
+
+// Monsters due at the same time decide their moves on worker threads, this many to a task, once
+// there's more than one task's worth. Below that, handing them off costs more than it saves.
+#define MONSTER_DECIDE_BATCH 32
+
+// With crowd movement on, every monster in or next to a cell makes it cost this many more steps,
+// so a packed route loses out to a clear one that's only a little longer.
+#define CROWD_COST 2
+
+// Monsters plan this many steps ahead (it has to fit in a uint32 at two bits a step), and stick
+// to the plan until their target's moved more than CACHED_PATH_TOLERANCE cells from where it was.
+#define CACHED_PATH_STEPS 16
+#define CACHED_PATH_TOLERANCE 2
+
+// Monsters and items are carved out of chunks this many blocks long (see floor_arena.h).
+#define FLOOR_ARENA_CHUNK_BLOCKS 128
+
 #define STRING(x) #x
 
 typedef enum {
@@ -209,7 +245,7 @@ class dungeon_exception : public std::exception {
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define CLAMP(a, low, high) ((a < low) ? low : ((a > high) ? high : a))
 
-#define RAND_BETWEEN(low, high) (low) + (rand() % ((high) - (low) + 1)) 
+#define RAND_BETWEEN(low, high) (low) + (rng_rand() % ((high) - (low) + 1)) 
 
 #define ARRAY_SIZE(x) ((int) (sizeof(x) / sizeof(x[0])))
 
@@ -0,0 +1,417 @@
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "noise.h"
+#include "macros.h"
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define STONE_SEED_COUNT 10
+#define GAUSSIAN_CONVOLUTION_COUNT 2
+
+// Separable approximation of the 5x5 Gaussian from Assignment 1.01's solution code.
+// Running it once per axis is far cheaper than the full 2D kernel and looks the same.
+#define BLUR_TAPS 5
+#define BLUR_RADIUS 2
+#define BLUR_WEIGHT 17
+const int BLUR_KERNEL[BLUR_TAPS] = { 1, 4, 7, 4, 1 };
+
+// (sum * BLUR_RECIPROCAL) >> 20 == sum / BLUR_WEIGHT for every sum a full-width pass can
+// produce (up to 255 * 17), so the SIMD paths can divide with a multiply and match
+// the scalar path bit for bit.
+#define BLUR_RECIPROCAL 61681
+#define BLUR_RECIPROCAL_SHIFT 20
+
+const char *blur_simd_name() {
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "none";
+#endif
+}
+
+/**
+ * Blurs a run of values where every tap is in bounds. Tap k of value i is at taps[k][i].
+ *
+ * Params:
+ * - taps: Pointers to the start of each tap's input
+ * - out: Where to write the blurred values
+ * - count: Number of values to blur
+ * - simd: Use the SIMD loops, or leave everything to the scalar one
+ */
+static void blur_span(const uint8_t *const taps[BLUR_TAPS], uint8_t *out, int count, bool simd) {
+    int i = 0;
+    int k, sum;
+#if defined(__SSE2__) || defined(__AVX2__)
+    // With SIMD off, everything's left to the scalar loop at the bottom.
+    int vector_count = simd ? count : 0;
+#endif
+#if defined(__AVX2__)
+    const __m256i zero256 = _mm256_setzero_si256();
+    const __m256i reciprocal256 = _mm256_set1_epi16((short) BLUR_RECIPROCAL);
+    __m256i in256, lo256, hi256, sum_lo256, sum_hi256, weight256;
+    for (; i + 32 <= vector_count; i += 32) {
+        sum_lo256 = sum_hi256 = zero256;
+        for (k = 0; k < BLUR_TAPS; k++) {
+            in256 = _mm256_loadu_si256((const __m256i *) (taps[k] + i));
+            weight256 = _mm256_set1_epi16(BLUR_KERNEL[k]);
+            // Unpacking and packing both work per 128-bit lane, so the order comes back out right.
+            lo256 = _mm256_unpacklo_epi8(in256, zero256);
+            hi256 = _mm256_unpackhi_epi8(in256, zero256);
+            sum_lo256 = _mm256_add_epi16(sum_lo256, _mm256_mullo_epi16(lo256, weight256));
+            sum_hi256 = _mm256_add_epi16(sum_hi256, _mm256_mullo_epi16(hi256, weight256));
+        }
+        sum_lo256 = _mm256_srli_epi16(_mm256_mulhi_epu16(sum_lo256, reciprocal256), BLUR_RECIPROCAL_SHIFT - 16);
+        sum_hi256 = _mm256_srli_epi16(_mm256_mulhi_epu16(sum_hi256, reciprocal256), BLUR_RECIPROCAL_SHIFT - 16);
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_packus_epi16(sum_lo256, sum_hi256));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i reciprocal = _mm_set1_epi16((short) BLUR_RECIPROCAL);
+    __m128i in, lo, hi, sum_lo, sum_hi, weight;
+    for (; i + 16 <= vector_count; i += 16) {
+        sum_lo = sum_hi = zero;
+        for (k = 0; k < BLUR_TAPS; k++) {
+            in = _mm_loadu_si128((const __m128i *) (taps[k] + i));
+            weight = _mm_set1_epi16(BLUR_KERNEL[k]);
+            lo = _mm_unpacklo_epi8(in, zero);
+            hi = _mm_unpackhi_epi8(in, zero);
+            sum_lo = _mm_add_epi16(sum_lo, _mm_mullo_epi16(lo, weight));
+            sum_hi = _mm_add_epi16(sum_hi, _mm_mullo_epi16(hi, weight));
+        }
+        sum_lo = _mm_srli_epi16(_mm_mulhi_epu16(sum_lo, reciprocal), BLUR_RECIPROCAL_SHIFT - 16);
+        sum_hi = _mm_srli_epi16(_mm_mulhi_epu16(sum_hi, reciprocal), BLUR_RECIPROCAL_SHIFT - 16);
+        _mm_storeu_si128((__m128i *) (out + i), _mm_packus_epi16(sum_lo, sum_hi));
+    }
+#endif
+    // Whatever's left (or everything, without SIMD).
+    for (; i < count; i++) {
+        sum = 0;
+        for (k = 0; k < BLUR_TAPS; k++)
+            sum += BLUR_KERNEL[k] * taps[k][i];
+        out[i] = (sum * BLUR_RECIPROCAL) >> BLUR_RECIPROCAL_SHIFT;
+    }
+}
+
+/**
+ * Blurs a single value near the edge of the grid, where some taps are out of bounds.
+ * Those taps are dropped and the rest are re-weighted.
+ *
+ * Params:
+ * - in: Row-major input grid
+ * - width/height: Size of the grid
+ * - x/y: Coordinates of the value to blur
+ * - dx/dy: Axis to blur along (one of them should be 1, the other 0)
+ * Returns: The blurred value
+ */
+static uint8_t blur_edge(const uint8_t *in, int width, int height, int x, int y, int dx, int dy) {
+    int k, x1, y1;
+    int sum = 0;
+    int weight = 0;
+    for (k = 0; k < BLUR_TAPS; k++) {
+        x1 = x + (k - BLUR_RADIUS) * dx;
+        y1 = y + (k - BLUR_RADIUS) * dy;
+        if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height) continue;
+        sum += BLUR_KERNEL[k] * in[y1 * width + x1];
+        weight += BLUR_KERNEL[k];
+    }
+    return sum / weight;
+}
+
+static void blur_vertical(const uint8_t *in, uint8_t *out, int width, int height, bool simd) {
+    const uint8_t *taps[BLUR_TAPS];
+    int x, y, k;
+    for (y = 0; y < height; y++) {
+        if (y >= BLUR_RADIUS && y < height - BLUR_RADIUS) {
+            for (k = 0; k < BLUR_TAPS; k++)
+                taps[k] = in + (y + k - BLUR_RADIUS) * width;
+            blur_span(taps, out + y * width, width, simd);
+        } else {
+            for (x = 0; x < width; x++)
+                out[y * width + x] = blur_edge(in, width, height, x, y, 0, 1);
+        }
+    }
+}
+
+static void blur_horizontal(const uint8_t *in, uint8_t *out, int width, int height, bool simd) {
+    const uint8_t *taps[BLUR_TAPS];
+    int x, y, k;
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < MIN(BLUR_RADIUS, width); x++)
+            out[y * width + x] = blur_edge(in, width, height, x, y, 1, 0);
+        if (width > 2 * BLUR_RADIUS) {
+            for (k = 0; k < BLUR_TAPS; k++)
+                taps[k] = in + y * width + k;
+            blur_span(taps, out + y * width + BLUR_RADIUS, width - 2 * BLUR_RADIUS, simd);
+        }
+        for (x = MAX(width - BLUR_RADIUS, BLUR_RADIUS); x < width; x++)
+            out[y * width + x] = blur_edge(in, width, height, x, y, 1, 0);
+    }
+}
+
+// Originally partially based on 'smooth_hardness' provided in the Assignment 1.01
+// solution code, Piazza post @80. It used a linked-list queue and an in-place 2D
+// blur, which was a lot of allocations for a lot of cells -- this works on flat
+// buffers instead.
+DiffuseNoise::DiffuseNoise(bool simd) {
+    this->simd = simd;
+}
+
+void DiffuseNoise::fill(uint8_t *out, int width, int height) {
+    int x, y, ix, iy, i, step;
+    unsigned int head, tail;
+    unsigned int size = width * height;
+    std::vector<uint8_t> scratch(size);
+    // Every cell is queued exactly once, so this never needs to wrap.
+    std::vector<uint16_t> queue(size);
+
+    for (i = 0; i < (int) size; i++) out[i] = 0;
+
+    // Picks a random hardness and places it in a single random cell
+    // STONE_SEED_COUNT times, enqueuing them along the way.
+    step = 255 / STONE_SEED_COUNT - 1;
+    head = tail = 0;
+    for (i = 0; i < STONE_SEED_COUNT; i++) {
+        // Since we've just initialized everything to 0, this can't fail. Though it can
+        // technically run forever if we're really unlucky. Oh well.
+        do {
+            x = rng_rand() % width;
+            y = rng_rand() % height;
+        } while (out[y * width + x]);
+
+        out[y * width + x] = (i == 0 ? 1 : i * step);
+        queue[tail++] = y * width + x;
+    }
+
+    // Diffuses values out until every cell is filled.
+    while (head < tail) {
+        x = queue[head] % width;
+        y = queue[head] / width;
+        i = out[queue[head++]];
+
+        for (ix = x - 1; ix <= x + 1; ix++) {
+            for (iy = y - 1; iy <= y + 1; iy++) {
+                if (ix == x && iy == y) continue;
+                if (ix >= 0 && ix < width && iy >= 0 && iy < height
+                    && !out[iy * width + ix]) {
+                    out[iy * width + ix] = i;
+                    queue[tail++] = iy * width + ix;
+                }
+            }
+        }
+    }
+
+    // Applies a gaussian convolution to smooth it out.
+    blur_hardness(out, scratch.data(), width, height, simd);
+}
+
+void blur_hardness(uint8_t *grid, uint8_t *scratch, int width, int height, bool simd) {
+    int i;
+    // Bounces between the two buffers, so it ends up back in grid.
+    for (i = 0; i < GAUSSIAN_CONVOLUTION_COUNT; i++) {
+        blur_vertical(grid, scratch, width, height, simd);
+        blur_horizontal(scratch, grid, width, height, simd);
+    }
+}
+
+// Gradient noise picks from these eight directions. The diagonals are unit length too.
+#define GRADIENT_COUNT 8
+#define DIAGONAL 0.70710678f
+const float GRADIENTS[GRADIENT_COUNT][2] = {
+    {1, 0}, {-1, 0}, {0, 1}, {0, -1},
+    {DIAGONAL, DIAGONAL}, {-DIAGONAL, DIAGONAL}, {DIAGONAL, -DIAGONAL}, {-DIAGONAL, -DIAGONAL}
+};
+// With unit gradients, 2D gradient noise stays within +/- sqrt(1/2). This stretches
+// it out to +/- 1 before it's mapped onto hardness.
+#define GRADIENT_RANGE 1.41421356f
+
+/**
+ * One octave of lattice noise: the random values at each lattice point, plus the
+ * interpolation weights for every offset within a lattice cell. Since the spacing
+ * is a whole number of cells, those weights are the same for every lattice cell.
+ */
+class LatticeOctave {
+    public:
+        int period;
+        int cols;
+        int rows;
+        float amplitude;
+        // Value noise uses a as the value. Gradient noise uses (a, b) as the gradient.
+        std::vector<float> a;
+        std::vector<float> b;
+        // Position within a lattice cell (t) and its smoothstep (s).
+        std::vector<float> t;
+        std::vector<float> s;
+
+        LatticeOctave(bool gradient, int period, float amplitude, int width, int height) {
+            int i, g;
+            this->period = period;
+            this->amplitude = amplitude;
+            cols = width / period + 2;
+            rows = height / period + 2;
+            a.resize(cols * rows);
+            b.resize(cols * rows);
+            for (i = 0; i < cols * rows; i++) {
+                if (gradient) {
+                    g = rng_rand() % GRADIENT_COUNT;
+                    a[i] = GRADIENTS[g][0];
+                    b[i] = GRADIENTS[g][1];
+                } else {
+                    a[i] = (float) rng_rand() / RNG_MAX;
+                    b[i] = 0;
+                }
+            }
+            // Sampling the middle of each cell keeps gradient noise from pinning to 0
+            // on every lattice point.
+            t.resize(period);
+            s.resize(period);
+            for (i = 0; i < period; i++) {
+                t[i] = (i + 0.5f) / period;
+                s[i] = t[i] * t[i] * (3 - 2 * t[i]);
+            }
+        }
+};
+
+/**
+ * Adds one lattice cell's worth of noise to a row. Both lattice columns around the
+ * cell have already been interpolated along y, leaving a line through each
+ * (value = slope * distance + offset) to blend between.
+ *
+ * Params:
+ * - acc: Row values to add to
+ * - t/s: Position within the cell and its smoothstep, per value
+ * - count: Number of values
+ * - slope0/offset0: Line through the left lattice column
+ * - slope1/offset1: Line through the right lattice column
+ * - amplitude: Weight of this octave
+ */
+static void lattice_span(float *acc, const float *t, const float *s, int count,
+    float slope0, float offset0, float slope1, float offset1, float amplitude) {
+    int i = 0;
+    float left, right;
+#if defined(__AVX2__)
+    const __m256 one256 = _mm256_set1_ps(1);
+    const __m256 slope0_256 = _mm256_set1_ps(slope0);
+    const __m256 offset0_256 = _mm256_set1_ps(offset0);
+    const __m256 slope1_256 = _mm256_set1_ps(slope1);
+    const __m256 offset1_256 = _mm256_set1_ps(offset1);
+    const __m256 amplitude256 = _mm256_set1_ps(amplitude);
+    __m256 t256, left256, right256;
+    for (; i + 8 <= count; i += 8) {
+        t256 = _mm256_loadu_ps(t + i);
+        left256 = _mm256_add_ps(_mm256_mul_ps(slope0_256, t256), offset0_256);
+        right256 = _mm256_add_ps(_mm256_mul_ps(slope1_256, _mm256_sub_ps(t256, one256)), offset1_256);
+        right256 = _mm256_add_ps(left256, _mm256_mul_ps(_mm256_loadu_ps(s + i), _mm256_sub_ps(right256, left256)));
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(amplitude256, right256)));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 slope0_128 = _mm_set1_ps(slope0);
+    const __m128 offset0_128 = _mm_set1_ps(offset0);
+    const __m128 slope1_128 = _mm_set1_ps(slope1);
+    const __m128 offset1_128 = _mm_set1_ps(offset1);
+    const __m128 amplitude128 = _mm_set1_ps(amplitude);
+    __m128 t128, left128, right128;
+    for (; i + 4 <= count; i += 4) {
+        t128 = _mm_loadu_ps(t + i);
+        left128 = _mm_add_ps(_mm_mul_ps(slope0_128, t128), offset0_128);
+        right128 = _mm_add_ps(_mm_mul_ps(slope1_128, _mm_sub_ps(t128, one)), offset1_128);
+        right128 = _mm_add_ps(left128, _mm_mul_ps(_mm_loadu_ps(s + i), _mm_sub_ps(right128, left128)));
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(amplitude128, right128)));
+    }
+#endif
+    for (; i < count; i++) {
+        left = slope0 * t[i] + offset0;
+        right = slope1 * (t[i] - 1) + offset1;
+        acc[i] += amplitude * (left + s[i] * (right - left));
+    }
+}
+
+LatticeNoise::LatticeNoise(bool gradient, int scale, int octaves) {
+    if (scale < 1) throw dungeon_exception(__PRETTY_FUNCTION__, "noise scale must be at least 1");
+    if (octaves < 1) throw dungeon_exception(__PRETTY_FUNCTION__, "noise must have at least 1 octave");
+    this->gradient = gradient;
+    this->scale = scale;
+    this->octaves = octaves;
+}
+
+void LatticeNoise::fill(uint8_t *out, int width, int height) {
+    std::vector<LatticeOctave> layers;
+    std::vector<float> row(width);
+    std::vector<float> slope, offset;
+    int i, x, y, c, cy, ky, lo, hi, period;
+    float amplitude, total, ty, sy, value;
+
+    period = scale;
+    amplitude = 1;
+    total = 0;
+    for (i = 0; i < octaves; i++) {
+        layers.emplace_back(gradient, period, amplitude, width, height);
+        total += amplitude;
+        amplitude /= 2;
+        period = MAX(period / 2, 1);
+    }
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) row[x] = 0;
+
+        for (LatticeOctave &layer : layers) {
+            cy = y / layer.period;
+            ky = y % layer.period;
+            ty = layer.t[ky];
+            sy = layer.s[ky];
+
+            // Collapses the two lattice rows around y into one line per lattice column.
+            slope.resize(layer.cols);
+            offset.resize(layer.cols);
+            for (c = 0; c < layer.cols; c++) {
+                lo = cy * layer.cols + c;
+                hi = lo + layer.cols;
+                if (gradient) {
+                    slope[c] = layer.a[lo] + sy * (layer.a[hi] - layer.a[lo]);
+                    offset[c] = layer.b[lo] * ty + sy * (layer.b[hi] * (ty - 1) - layer.b[lo] * ty);
+                } else {
+                    slope[c] = 0;
+                    offset[c] = layer.a[lo] + sy * (layer.a[hi] - layer.a[lo]);
+                }
+            }
+
+            for (c = 0; c * layer.period < width; c++) {
+                lattice_span(row.data() + c * layer.period, layer.t.data(), layer.s.data(),
+                    MIN(layer.period, width - c * layer.period),
+                    slope[c], offset[c], slope[c + 1], offset[c + 1], layer.amplitude);
+            }
+        }
+
+        for (x = 0; x < width; x++) {
+            value = row[x] / total;
+            if (gradient) value = (value * GRADIENT_RANGE + 1) / 2;
+            value = MAX(0.0f, MIN(1.0f, value));
+            out[y * width + x] = 1 + (uint8_t) lroundf(value * 253);
+        }
+    }
+}
+
+noise_type_t parse_noise_type(const std::string &name) {
+    if (name == "diffuse") return NOISE_TYPE_DIFFUSE;
+    if (name == "value") return NOISE_TYPE_VALUE;
+    if (name == "gradient") return NOISE_TYPE_GRADIENT;
+    throw dungeon_exception(__PRETTY_FUNCTION__, "invalid noise type: " + name);
+}
+
+NoiseGenerator *create_noise_generator(noise_type_t type, int scale, int octaves) {
+    switch (type) {
+        case NOISE_TYPE_VALUE:
+            return new LatticeNoise(false, scale, octaves);
+        case NOISE_TYPE_GRADIENT:
+            return new LatticeNoise(true, scale, octaves);
+        default:
+            return new DiffuseNoise(true);
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * Generators for the stone hardness map that gets laid down before rooms
+ * are carved out. Each map picks one with its NOISE field.
+ */
+
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cstdint>
+#include <string>
+
+typedef enum {
+    NOISE_TYPE_DIFFUSE,
+    NOISE_TYPE_VALUE,
+    NOISE_TYPE_GRADIENT
+} noise_type_t;
+
+#define NOISE_DEFAULT_SCALE 16
+#define NOISE_DEFAULT_OCTAVES 3
+
+class NoiseGenerator {
+    public:
+        virtual ~NoiseGenerator() {}
+
+        /**
+         * Fills a row-major (y * width + x) buffer with stone hardness. Every value
+         * will be between 1 and 254, since 0 is open floor and 255 is the border.
+         *
+         * Params:
+         * - out: Buffer of at least width * height values
+         * - width: Width of the grid
+         * - height: Height of the grid
+         */
+        virtual void fill(uint8_t *out, int width, int height) = 0;
+};
+
+/**
+ * The original generator: a handful of random seeds are diffused out to
+ * every cell, then the result is blurred twice.
+ */
+class DiffuseNoise : public NoiseGenerator {
+    private:
+        bool simd;
+
+    public:
+        /**
+         * Params:
+         * - simd: Blur with the SSE2/AVX2 code compiled in (see blur_simd_name), or leave
+         *   it all to the scalar loop. Both give the same output.
+         */
+        DiffuseNoise(bool simd);
+        void fill(uint8_t *out, int width, int height) override;
+};
+
+/**
+ * Value or gradient noise on a square lattice, layered as fractal octaves.
+ * Each row is streamed out in one go, with no queue or extra passes.
+ */
+class LatticeNoise : public NoiseGenerator {
+    private:
+        bool gradient;
+        int scale;
+        int octaves;
+
+    public:
+        /**
+         * Params:
+         * - gradient: Use gradient noise if true, value noise if false
+         * - scale: Lattice spacing of the first octave, in cells
+         * - octaves: Number of octaves. Each halves the spacing and amplitude of the last.
+         */
+        LatticeNoise(bool gradient, int scale, int octaves);
+        void fill(uint8_t *out, int width, int height) override;
+};
+
+/**
+ * Returns: The widest SIMD the blur was compiled with ("AVX2", "SSE2", or "none")
+ */
+const char *blur_simd_name();
+
+/**
+ * Smooths a hardness grid with the separable Gaussian blur DiffuseNoise finishes with.
+ *
+ * Params:
+ * - grid: Row-major grid to blur in place
+ * - scratch: Buffer of the same size to work in
+ * - width: Width of the grid
+ * - height: Height of the grid
+ * - simd: Use the SIMD code compiled in, or only the scalar loop
+ */
+void blur_hardness(uint8_t *grid, uint8_t *scratch, int width, int height, bool simd);
+
+/**
+ * Parses a noise type from its name in a map file.
+ *
+ * Params:
+ * - name: Name of the noise type ("diffuse", "value", or "gradient")
+ * Returns: The noise type
+ */
+noise_type_t parse_noise_type(const std::string &name);
+
+/**
+ * Creates a noise generator. The caller is responsible for deleting it.
+ *
+ * Params:
+ * - type: Type of noise to generate
+ * - scale: Lattice spacing, in cells (ignored for diffuse noise)
+ * - octaves: Number of octaves (ignored for diffuse noise)
+ * Returns: The new generator
+ */
+NoiseGenerator *create_noise_generator(noise_type_t type, int scale, int octaves);
+
+#endif
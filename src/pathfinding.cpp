@@ -94,3 +94,26 @@ void generate_pathfinding_map(Dungeon *dungeon, uint32_t **grid, int allow_tunne
         }
     }
 }
+
+void CongestionMap::rebuild(Dungeon *dungeon, const CharacterStore &characters) {
+    uint32_t i;
+    width = dungeon->width;
+    height = dungeon->height;
+    density.assign(width * height, 0);
+    occupied.assign(width * height, 0);
+    for (i = 0; i < characters.size(); i++) {
+        if (characters.kind(i) == CHARACTER_TYPE_MONSTER) add(characters.position(i), 1);
+    }
+}
+
+void CongestionMap::add(IntPair at, int amount) {
+    int x1, y1;
+    density[at.x * height + at.y] += amount;
+    occupied[at.x * height + at.y] += amount;
+    for (const auto &neighbor : NEIGHBORS) {
+        x1 = at.x + neighbor.x;
+        y1 = at.y + neighbor.y;
+        if (x1 < 0 || x1 >= width || y1 < 0 || y1 >= height) continue;
+        density[x1 * height + y1] += amount;
+    }
+}
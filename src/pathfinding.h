@@ -7,6 +7,9 @@
 #ifndef PATHFINDING_H
 #define PATHFINDING_H
 
+#include <cstdint>
+#include <vector>
+
 #include "dungeon.h"
 #include "character.h"
 
@@ -31,4 +34,57 @@ void update_pathfinding(Dungeon *dungeon, uint32_t **pathfinding_no_tunnel, uint
  */
 void generate_pathfinding_map(Dungeon *dungeon, uint32_t **grid, int allow_tunneling, IntPair loc);
 
+/**
+ * How crowded each cell of a floor is, counting the monsters in it and right next
+ * to it. It's kept up to date one move at a time, so monsters heading for the PC can
+ * steer around each other without searching for a way past.
+ */
+class CongestionMap {
+    private:
+        int width = 0;
+        int height = 0;
+        std::vector<uint8_t> density;
+        std::vector<uint8_t> occupied;
+
+        void add(IntPair at, int amount);
+
+    public:
+        /**
+         * Starts over from every monster on a floor.
+         *
+         * Params:
+         *  - dungeon: The floor
+         *  - characters: Everyone on it
+         */
+        void rebuild(Dungeon *dungeon, const CharacterStore &characters);
+
+        /**
+         * Counts a monster that just showed up at a cell.
+         */
+        void enter(IntPair at) {
+            add(at, 1);
+        }
+
+        /**
+         * Stops counting a monster that just left (or died at) a cell.
+         */
+        void leave(IntPair at) {
+            add(at, -1);
+        }
+
+        /**
+         * Returns: How many monsters are in or next to a cell
+         */
+        uint8_t at(int x, int y) const {
+            return density[x * height + y];
+        }
+
+        /**
+         * Returns: Whether there's a monster in a cell
+         */
+        bool occupied_at(int x, int y) const {
+            return occupied[x * height + y];
+        }
+};
+
 #endif
\ No newline at end of file
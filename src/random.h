@@ -2,6 +2,184 @@
 #define RANDOM_H
 
 #include <ostream>
+#include <cstdint>
+#include <string>
+
+// Largest value rng_rand() returns, same as a 32-bit RAND_MAX.
+#define RNG_MAX 0x7fffffff
+// Number of 64-bit words it takes to save an Rng.
+#define RNG_STATE_WORDS 5
+
+/**
+ * A xoshiro256** random number generator. Streams can be split off by name
+ * (a floor, a subsystem, a monster), and each split only depends on its
+ * parent's seed and its own name, not on how much the parent has been used
+ * or in what order the other splits were made.
+ */
+class Rng {
+    private:
+        uint64_t s[4] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+        // What this stream was created from, so splits don't move around as it gets used.
+        uint64_t origin = 0;
+
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+
+        static uint64_t splitmix(uint64_t &x) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+    public:
+        constexpr Rng() {}
+
+        /**
+         * Params:
+         * - seed: Seed to start from
+         */
+        explicit Rng(uint64_t seed) {
+            int i;
+            origin = seed;
+            for (i = 0; i < 4; i++) s[i] = splitmix(seed);
+        }
+
+        /**
+         * Returns: The next 64 random bits
+         */
+        uint64_t next() {
+            uint64_t result = rotl(s[1] * 5, 7) * 9;
+            uint64_t t = s[1] << 17;
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+            return result;
+        }
+
+        /**
+         * Returns: A random number between 0 and RNG_MAX
+         */
+        int rand() {
+            return (int) (next() >> 33);
+        }
+
+        /**
+         * Creates an independent stream from this one. This doesn't use up anything
+         * from this stream.
+         *
+         * Params:
+         * - name: Name of the new stream. The same name always gives the same stream.
+         * Returns: The new stream
+         */
+        Rng split(const std::string &name) const {
+            // FNV-1a, then mixed with where this stream came from.
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            for (char c : name) hash = (hash ^ (uint8_t) c) * 0x100000001b3ULL;
+            uint64_t seed = origin ^ rotl(hash, 32);
+            return Rng(splitmix(seed));
+        }
+
+        /**
+         * Creates an independent, numbered stream from this one, for things like
+         * individual monsters.
+         *
+         * Params:
+         * - index: Number of the new stream
+         * Returns: The new stream
+         */
+        Rng split(uint64_t index) const {
+            uint64_t seed = origin ^ (index * 0xd1342543de82ef95ULL + 1);
+            return Rng(splitmix(seed));
+        }
+
+        /**
+         * Copies out everything needed to pick this stream back up later.
+         *
+         * Params:
+         * - state: Filled with RNG_STATE_WORDS words
+         */
+        void get_state(uint64_t *state) const {
+            int i;
+            for (i = 0; i < 4; i++) state[i] = s[i];
+            state[4] = origin;
+        }
+
+        /**
+         * Picks a stream back up from get_state.
+         *
+         * Params:
+         * - state: RNG_STATE_WORDS words from get_state
+         */
+        void set_state(const uint64_t *state) {
+            int i;
+            for (i = 0; i < 4; i++) s[i] = state[i];
+            origin = state[4];
+        }
+};
+
+// Every thread starts on its own default stream. Code that wants its random numbers
+// to come from a particular stream (a floor being generated, a monster taking its
+// turn) makes it active with an RngScope, so rng_rand() and friends don't need one
+// passed all the way down.
+inline thread_local Rng rng_default;
+inline thread_local Rng *rng_active = nullptr;
+
+/**
+ * Returns: The stream the calling thread is using right now
+ */
+inline Rng &rng_current() {
+    return rng_active ? *rng_active : rng_default;
+}
+
+/**
+ * Reseeds the calling thread's current stream.
+ *
+ * Params:
+ * - seed: Seed to start from
+ */
+inline void rng_seed(uint64_t seed) {
+    rng_current() = Rng(seed);
+}
+
+/**
+ * Returns: The next 64 random bits from the calling thread's current stream
+ */
+inline uint64_t rng_next() {
+    return rng_current().next();
+}
+
+/**
+ * A drop-in for rand() that uses the calling thread's current stream.
+ *
+ * Returns: A random number between 0 and RNG_MAX
+ */
+inline int rng_rand() {
+    return rng_current().rand();
+}
+
+/**
+ * Makes a stream the calling thread's current one until this goes out of scope.
+ */
+class RngScope {
+    private:
+        Rng *previous;
+
+    public:
+        RngScope(Rng &rng) {
+            previous = rng_active;
+            rng_active = &rng;
+        }
+
+        ~RngScope() {
+            rng_active = previous;
+        }
+};
+
 class Dice {
     public:
         int base, dice, sides;
@@ -15,7 +193,7 @@ class Dice {
             int res = base;
             int i;
             for (i = 0; i < dice; i++)
-                res += rand() % sides + 1;
+                res += rng_rand() % sides + 1;
             return res;
         }
 
@@ -0,0 +1,170 @@
+/**
+ * Little-endian readers and writers for save files. Everything goes into (or
+ * comes out of) one flat buffer, so a save is a single allocation that gets
+ * reused from one autosave to the next.
+ */
+
+#ifndef SAVE_FILE_H
+#define SAVE_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <endian.h>
+#include <string>
+#include <vector>
+
+#include "macros.h"
+#include "random.h"
+
+#define SAVE_FILE_MAGIC "KB3SAVE"
+#define SAVE_FILE_MAGIC_SIZE 8
+// Bump whenever the layout changes.
+#define SAVE_FILE_VERSION 1
+// Stands in for the PC in the saved turn queue, where monsters are saved by index.
+#define SAVE_FILE_PC_INDEX UINT16_MAX
+
+class SaveWriter {
+    private:
+        std::vector<uint8_t> &out;
+
+    public:
+        /**
+         * Params:
+         * - out: Buffer to append to
+         */
+        SaveWriter(std::vector<uint8_t> &out) : out(out) {}
+
+        void write_u8(uint8_t value) {
+            out.push_back(value);
+        }
+
+        void write_u16(uint16_t value) {
+            value = htole16(value);
+            out.insert(out.end(), (uint8_t *) &value, (uint8_t *) &value + sizeof (value));
+        }
+
+        void write_u32(uint32_t value) {
+            value = htole32(value);
+            out.insert(out.end(), (uint8_t *) &value, (uint8_t *) &value + sizeof (value));
+        }
+
+        void write_u64(uint64_t value) {
+            value = htole64(value);
+            out.insert(out.end(), (uint8_t *) &value, (uint8_t *) &value + sizeof (value));
+        }
+
+        void write_i32(int32_t value) {
+            write_u32((uint32_t) value);
+        }
+
+        void write_string(const std::string &value) {
+            if (value.length() > UINT16_MAX) throw dungeon_exception(__PRETTY_FUNCTION__, "string is too long to save");
+            write_u16(value.length());
+            out.insert(out.end(), value.begin(), value.end());
+        }
+
+        void write_rng(const Rng &rng) {
+            uint64_t state[RNG_STATE_WORDS];
+            int i;
+            rng.get_state(state);
+            for (i = 0; i < RNG_STATE_WORDS; i++) write_u64(state[i]);
+        }
+
+        /**
+         * Returns: Current position in the buffer, for patching in a value later
+         */
+        size_t position() {
+            return out.size();
+        }
+
+        /**
+         * Overwrites a uint32 that was already written.
+         *
+         * Params:
+         * - position: Where the value was written
+         * - value: New value
+         */
+        void patch_u32(size_t position, uint32_t value) {
+            value = htole32(value);
+            memcpy(out.data() + position, &value, sizeof (value));
+        }
+};
+
+class SaveReader {
+    private:
+        const uint8_t *data;
+        size_t size;
+        size_t offset = 0;
+
+        const uint8_t *take(size_t count) {
+            if (count > size - offset) throw dungeon_exception(__PRETTY_FUNCTION__, "save file ended too early");
+            offset += count;
+            return data + offset - count;
+        }
+
+    public:
+        /**
+         * Params:
+         * - data: Buffer to read from
+         * - size: Size of the buffer, in bytes
+         */
+        SaveReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+        uint8_t read_u8() {
+            return *take(1);
+        }
+
+        uint16_t read_u16() {
+            uint16_t value;
+            memcpy(&value, take(sizeof (value)), sizeof (value));
+            return le16toh(value);
+        }
+
+        uint32_t read_u32() {
+            uint32_t value;
+            memcpy(&value, take(sizeof (value)), sizeof (value));
+            return le32toh(value);
+        }
+
+        uint64_t read_u64() {
+            uint64_t value;
+            memcpy(&value, take(sizeof (value)), sizeof (value));
+            return le64toh(value);
+        }
+
+        int32_t read_i32() {
+            return (int32_t) read_u32();
+        }
+
+        std::string read_string() {
+            uint16_t length = read_u16();
+            return std::string((const char *) take(length), length);
+        }
+
+        void read_rng(Rng &rng) {
+            uint64_t state[RNG_STATE_WORDS];
+            int i;
+            for (i = 0; i < RNG_STATE_WORDS; i++) state[i] = read_u64();
+            rng.set_state(state);
+        }
+
+        /**
+         * Skips over a block of bytes without copying it.
+         *
+         * Params:
+         * - count: Number of bytes
+         * Returns: The start of the block
+         */
+        const uint8_t *read_block(size_t count) {
+            return take(count);
+        }
+
+        /**
+         * Returns: How many bytes have been read so far
+         */
+        size_t position() const {
+            return offset;
+        }
+};
+
+#endif
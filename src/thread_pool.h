@@ -0,0 +1,88 @@
+/**
+ * A fixed set of worker threads that run queued tasks, used to generate
+ * dungeon floors side by side.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex lock;
+        std::condition_variable ready;
+        bool stopping = false;
+
+        void work() {
+            std::function<void()> task;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    ready.wait(guard, [this] { return stopping || !tasks.empty(); });
+                    if (tasks.empty()) return;
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+                task();
+            }
+        }
+
+    public:
+        /**
+         * Starts the worker threads.
+         *
+         * Params:
+         * - threads: Number of workers, or 0 for one per hardware thread
+         */
+        ThreadPool(unsigned int threads) {
+            unsigned int i;
+            if (threads == 0) threads = std::thread::hardware_concurrency();
+            if (threads == 0) threads = 1;
+            for (i = 0; i < threads; i++)
+                workers.emplace_back(&ThreadPool::work, this);
+        }
+
+        /**
+         * Finishes every queued task, then stops the workers.
+         */
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            ready.notify_all();
+            for (std::thread &worker : workers) worker.join();
+        }
+
+        /**
+         * Queues a task to run on the next free worker.
+         *
+         * Params:
+         * - task: Function to run
+         * Returns: A future for the task's result. Anything it throws is rethrown from get().
+         */
+        template <class F>
+        std::future<decltype(std::declval<F>()())> submit(F task) {
+            // packaged_task can't be copied, but std::function needs to be.
+            auto packaged = std::make_shared<std::packaged_task<decltype(std::declval<F>()())()>>(std::move(task));
+            std::future<decltype(std::declval<F>()())> result = packaged->get_future();
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                tasks.emplace([packaged] { (*packaged)(); });
+            }
+            ready.notify_one();
+            return result;
+        }
+};
+
+#endif